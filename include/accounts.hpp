@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+
+using namespace std;
+
+// Accounts (the main account and its subaccounts) one process can trade at once
+constexpr size_t MAX_ACCOUNTS = 16;
+
+namespace accounts {
+    inline thread_local size_t bound_account = 0;
+    inline atomic<size_t> opened{1};
+
+    // The account whose order book, positions, subscriptions and session the
+    // calling thread works on. A session's io thread is bound to its account
+    // for life; the console thread follows the selected account.
+    inline size_t current() { return bound_account; }
+
+    inline void bind(size_t account) { bound_account = account < MAX_ACCOUNTS ? account : 0; }
+
+    // Reserves the next account slot, MAX_ACCOUNTS when all are taken
+    inline size_t open() {
+        size_t next = opened.fetch_add(1);
+        if (next < MAX_ACCOUNTS) return next;
+        opened.store(MAX_ACCOUNTS);
+        return MAX_ACCOUNTS;
+    }
+
+    inline size_t count() { return opened.load() < MAX_ACCOUNTS ? opened.load() : MAX_ACCOUNTS; }
+
+    // Per-account instance of T; account 0 is the one used when nothing is bound
+    template <typename T>
+    T& local(size_t account) {
+        static T instances[MAX_ACCOUNTS];
+        return instances[account < MAX_ACCOUNTS ? account : 0];
+    }
+
+    template <typename T>
+    T& local() { return local<T>(current()); }
+
+    // Binds the calling thread to an account until the scope ends
+    class scope {
+    public:
+        explicit scope(size_t account) : previous(current()) { bind(account); }
+        ~scope() { bind(previous); }
+
+        scope(const scope&) = delete;
+        scope& operator=(const scope&) = delete;
+
+    private:
+        size_t previous;
+    };
+}
@@ -1,69 +1,103 @@
 #pragma once
 
 #include "json.hpp"
+#include <atomic>
+#include <chrono>
 #include <string>
+#include <string_view>
 #include <vector>
 
 using namespace std;
 
 using json = nlohmann::json;
-extern bool AUTH_SENT;
 extern vector<string> SUPPORTED_CURRENCIES;
-extern vector<string> subscriptions;
+
+// Request ids must be unique per connection so responses can be matched
+inline long next_request_id() {
+    static atomic<long> next_id{1};
+    return next_id.fetch_add(1, memory_order_relaxed);
+}
 
 class jsonrpc : public json {
     public:
         jsonrpc(){
             (*this)["jsonrpc"] = "2.0",
-
-            srand( time(NULL) );
-            long number = rand();
-            (*this)["id"] = number;
+            (*this)["id"] = next_request_id();
         }
         
         jsonrpc(const string& method){
             (*this)["jsonrpc"] = "2.0",
             (*this)["method"] = method;
-            srand( time(NULL) );
-            long number = rand();
-            (*this)["id"] = number;
+            (*this)["id"] = next_request_id();
         }
 };
 
 namespace api {
 
+    // Whitespace tokenizer over a command line; tokens are views into the input
+    class tokenizer {
+        private:
+            string_view rest;
+
+        public:
+            explicit tokenizer(string_view input) : rest(input) {}
+
+            string_view next();
+            void skip(size_t count);
+    };
+
     vector<string> getSubscription();
-    static string stream_market_data(const string& input);
     static void process_market_update(const json& data);
     bool is_valid_instrument(const string& instrument);
 
-    void addSubscriptions(const string &index_name);
-
-    bool removeSubscriptions(const string &index_name);
-    
     string process(const string &input);
 
-    string authorize(const string &cmd);
+    string authorize(string_view input);
+
+    string sell(string_view input);
+
+    string buy(string_view input);
+
+    string get_open_orders(string_view input);
+
+    string modify(string_view input);
+
+    string cancel(string_view input);
+
+    string cancel_all(string_view input);
 
-    string sell(const string &input);
+    string view_positions(string_view input);
 
-    string buy(const string &input);
+    string get_orderbook(string_view input);
 
-    string get_open_orders(const string &input);
+    string subscribe(string_view input);
 
-    string modify(const string &input);
+    string unsubscribe(string_view input);
 
-    string cancel(const string &input);
+    string unsubscribe_all(string_view input);
 
-    string cancel_all(const string &input);
+    string get_instruments(string_view input);
 
-    string view_positions(const string &input);
+    string order_status(string_view input);
 
-    string get_orderbook(const string &input);
+    // Non-interactive order entry for strategies and scripted workflows
+    struct order_request {
+        string instrument;
+        bool buy{true};
+        double amount{0.0};
+        double price{0.0};          // ignored for market orders
+        string type{"limit"};
+        string time_in_force{"good_til_cancelled"};
+        string label;
+        chrono::milliseconds good_for{0};   // cancelled client-side after this long; 0 keeps it
+    };
 
-    string subscribe(const string &input);
+    // The private/buy or private/sell frame, empty when the risk gate refuses it
+    string place_order(const order_request& request);
 
-    string unsubscribe(const string &input);
+    // Same, encoded into frame, whose capacity is reused; false when refused
+    bool place_order(const order_request& request, string& frame);
 
-    string unsubscribe_all(const string &input);
+    // The private/edit frame; amount or price <= 0 keeps the current value
+    string amend_order(const string& order_id, double amount, double price);
 }
\ No newline at end of file
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "flat_map.hpp"
+#include "json.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+using json = nlohmann::json;
+
+struct feed_source_stats {
+    string name;
+    uint64_t wins{0};
+    uint64_t losses{0};
+    uint64_t confirmed{0};          // wins that a later copy arrived to confirm
+    chrono::nanoseconds lead{0};    // summed over confirmed wins
+};
+
+// First-wins arbitration between redundant copies of the same public feed.
+// Each update is keyed by channel plus its sequence: change_id for books,
+// timestamp and a digest of the content for tickers and indexes (several
+// can share a millisecond), and a hash of the first trade_id for trades.
+// The first copy to reach the logic stage is dispatched; later copies are
+// dropped and time how far behind they were.
+class FeedArbiter {
+public:
+    // Registers a connection carrying a copy, e.g. "feed0.b"
+    size_t add_source(const string& name);
+
+    // True when this copy is the first seen and should be dispatched
+    bool accept(size_t source, string_view channel, const json& data,
+                chrono::steady_clock::time_point received_at);
+
+    vector<feed_source_stats> stats() const;
+
+    string report() const;
+
+private:
+    struct channel_state {
+        long long sequence{-1};
+        size_t winner{0};
+        chrono::steady_clock::time_point won_at;
+        // Updates already dispatched at this sequence, when it is a timestamp
+        array<uint64_t, 4> digests{};
+        size_t digest_count{0};
+    };
+
+    struct trade_state {
+        size_t winner{0};
+        chrono::steady_clock::time_point won_at;
+    };
+
+    static constexpr size_t STRIPES = 16;
+    static constexpr size_t TRADE_HISTORY = 2048;
+
+    // Striped so feeds for different channels rarely contend
+    struct stripe {
+        mutex stripe_mutex;
+        open_hash_map<string, channel_state, hash<string_view>> channels{256};
+        open_hash_map<uint64_t, trade_state> trades{TRADE_HISTORY};
+        array<uint64_t, TRADE_HISTORY> trade_history{};
+        size_t trade_count{0};
+    };
+
+    void record_win(size_t source);
+    void record_loss(size_t source, size_t winner, chrono::nanoseconds lead);
+    void remember_trade(stripe& s, uint64_t key, const trade_state& state);
+
+    array<stripe, STRIPES> stripes;
+
+    mutable mutex sources_mutex;
+    vector<feed_source_stats> sources;
+};
+
+// The arbiter for the calling thread's account
+FeedArbiter& getFeedArbiter();
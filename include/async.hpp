@@ -0,0 +1,205 @@
+#pragma once
+
+#include "api.hpp"
+#include "flat_map.hpp"
+#include "json.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#if defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <iostream>
+#endif
+
+using namespace std;
+
+using json = nlohmann::json;
+
+struct session;
+class websocket_endpoint;
+
+// Receives the full JSON-RPC response, result or error
+using response_handler = function<void(const json& response)>;
+
+// Where a completion runs; empty runs it inline on the logic stage that read the response
+using executor = function<void(function<void()>)>;
+
+// Ids a session has sent and not yet seen answered
+struct outstanding_requests {
+    mutex ids_mutex;
+    open_hash_map<long, bool> ids{64};
+};
+
+// What the frames of one pending_response share: the caller's handler and
+// how many answers are still due. Each registered frame holds a reference;
+// the last one released returns it to PendingRequests' pool.
+struct request_completion {
+    response_handler handler;
+    const executor* ex{nullptr};
+    shared_ptr<outstanding_requests> outstanding;
+    json response;                  // kept for a delivery queued on the executor
+    atomic<size_t> remaining{0};
+    atomic<size_t> references{0};
+    atomic<bool> done{false};
+};
+
+// Matches responses to outstanding requests by id. Request ids are unique
+// across the process, so one table serves every connection and account;
+// it is open-addressed and completions are pooled, so once warm
+// registering a request adds nothing to the heap.
+class PendingRequests {
+public:
+    void expect(long request_id, response_handler handler);
+
+    // A pooled completion with one reference, held by the caller
+    request_completion* acquire_completion();
+
+    // One frame of a pending_response; the entry takes its own reference
+    void expect(long request_id, request_completion* completion);
+
+    // Runs the completion's handler once, inline or on its executor
+    void deliver(request_completion* completion, const json& response);
+
+    void release(request_completion* completion);
+
+    // True when a handler was waiting for this response; it has been run
+    bool complete(const json& response);
+
+    bool waiting(const json& response) const;
+
+    size_t outstanding() const;
+
+    // Drops these requests' handlers without running them and waits for any
+    // handler already running, so their owner's code can be unloaded after
+    void abandon(const vector<long>& request_ids);
+
+    // A JSON-RPC style error for requests that never reached the exchange
+    static json local_error(long request_id, const string& message);
+
+private:
+    struct waiter {
+        response_handler handler;
+        request_completion* completion{nullptr};
+    };
+
+    mutable mutex pending_mutex;
+    condition_variable idle;
+    open_hash_map<long, waiter> handlers{256};
+    vector<unique_ptr<request_completion>> spare_completions;
+    size_t running{0};
+};
+
+PendingRequests& getPendingRequests();
+
+// One or more frames whose responses are awaited together. Awaitable from
+// C++20 code (co_await yields the response json); C++17 callers use then().
+// With several frames the last response to arrive completes it, or the
+// first error.
+class pending_response {
+public:
+    // ex must outlive every response, as an AsyncSession's does
+    pending_response(websocket_endpoint* endpoint, int connection_id, vector<string> frames,
+                     const executor* ex = nullptr, shared_ptr<outstanding_requests> outstanding = nullptr);
+
+    // Sends the frames; handler runs once on the executor
+    void then(response_handler handler);
+
+    bool await_ready() const { return false; }
+
+    // Templated on the handle so this header stays valid C++17
+    template <typename Handle>
+    void await_suspend(Handle handle) {
+        // Nothing may touch *this once the frames are out: the reply can resume the coroutine first
+        then([this, handle](const json& response) mutable {
+            result = response;
+            handle.resume();
+        });
+    }
+
+    json await_resume() { return move(result); }
+
+private:
+    websocket_endpoint* endpoint;
+    int connection_id;
+    vector<string> frames;
+    const executor* ex;
+    shared_ptr<outstanding_requests> outstanding;
+    json result;
+};
+
+// Request/response view of a session for sequential workflows:
+//
+//   json auth = co_await trader.authorize();
+//   json order = co_await trader.buy({"BTC-PERPETUAL", true, 10, 60000});
+//   co_await trader.edit(order["result"]["order"]["order_id"], 20, 60100);
+//
+// Frames are built against the session's account and sent on its connection.
+class AsyncSession {
+public:
+    explicit AsyncSession(session& s, executor ex = {});
+
+    // Responses still due would complete on this session's executor
+    ~AsyncSession();
+
+    pending_response request(string frame);
+
+    pending_response authorize();
+
+    // Sends a new order without awaiting its reply, which is kept off the
+    // console; the order is followed through its events. Returns the
+    // request id, or -1 when the order was refused or could not be sent.
+    long submit(const api::order_request& order);
+
+    pending_response buy(api::order_request order);
+
+    pending_response sell(api::order_request order);
+
+    // amount or price <= 0 keeps the current value
+    pending_response edit(const string& order_id, double amount, double price);
+
+    pending_response cancel(const string& order_id);
+
+    pending_response get_positions(const string& currency = "", const string& kind = "");
+
+    pending_response get_open_orders();
+
+    pending_response subscribe(const vector<string>& channels);
+
+    pending_response unsubscribe(const vector<string>& channels);
+
+    // Forgets every request still awaited without completing it, for an
+    // owner about to go away, e.g. a strategy being unloaded
+    void abandon();
+
+private:
+    pending_response send(vector<string> frames);
+
+    session& owner;
+    executor ex;
+    shared_ptr<outstanding_requests> outstanding{make_shared<outstanding_requests>()};
+};
+
+#if defined(__cpp_impl_coroutine)
+// Fire-and-forget coroutine for workflows built on AsyncSession; starts
+// eagerly and frees its frame when it finishes
+struct async_task {
+    struct promise_type {
+        async_task get_return_object() { return {}; }
+        std::suspend_never initial_suspend() noexcept { return {}; }
+        std::suspend_never final_suspend() noexcept { return {}; }
+        void return_void() {}
+        void unhandled_exception() {
+            try {
+                throw;
+            } catch (const exception& e) {
+                cerr << "Async workflow failed: " << e.what() << endl;
+            }
+        }
+    };
+};
+#endif
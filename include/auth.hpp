@@ -1,25 +1,74 @@
 #pragma once
 
+#include "hmac.hpp"
+#include <cstddef>
+#include <memory>
+#include <mutex>
 #include <string>
 
 using namespace std;
 
+// Holds the session returned by public/auth: access and refresh tokens with
+// their expiry. The endpoint refreshes the session in the background before
+// it expires, so readers never wait on authentication. Each account keeps
+// its own session. Authentication signs with client_signature from a keyed
+// HMAC context, so the secret never goes over the wire and re-authenticating
+// after a reconnect or a failed refresh is cheap.
 class Password {
 
     private:
-        static int num_sets;
+        mutable mutex token_mutex;
         string access_token;
+        string refresh_token;
+        string scope;
+        long long expires_at{0};        // ms since epoch
+        long long refresh_request_id{0};
+        string client_id;
+        string requested_scope;
+        unique_ptr<HmacSha256> signing_key;
+
+        string signedRequest(const string& session_scope, long long& request_id);
         
-        Password() : access_token("") {}
+        Password() {}
 
     public:
+        // The session of the calling thread's account
         static Password &password();
 
+        static Password &password(size_t account);
+
         Password(const Password&) = delete;
         void operator=(const Password&) = delete;
 
         void setAccessToken(const string& token);
-        void setAccessToken(int& token);
+
+        // Stores the result of a public/auth call
+        void setSession(const string& access, const string& refresh, long long expires_in_seconds,
+                        const string& session_scope);
 
         string getAccessToken() const;
-};
\ No newline at end of file
+        string getRefreshToken() const;
+        string getScope() const;
+        long long getExpiry() const;
+
+        // Keys the HMAC context for client_id; the secret is not stored
+        void setCredentials(const string& id, const string& client_secret);
+
+        // Builds a public/auth client_signature request, empty without credentials
+        string authRequest(const string& session_scope = "session:name");
+
+        // Builds a public/auth refresh_token request, falling back to a fresh
+        // signature once the refresh token is gone; empty without either
+        string refreshRequest();
+
+        // Forgets a refresh token the exchange rejected
+        void dropRefreshToken();
+
+        // True once for the response to the last refreshRequest()
+        bool consumeRefresh(long long response_id);
+
+        // Milliseconds until the session should be refreshed, -1 without one
+        long long refreshDelay(long long now) const;
+
+        void clear();
+};
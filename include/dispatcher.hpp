@@ -0,0 +1,81 @@
+#pragma once
+
+#include "events.hpp"
+#include "json.hpp"
+#include <functional>
+#include <shared_mutex>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+using json = nlohmann::json;
+
+enum class ChannelKind : uint8_t {
+    UNKNOWN,
+    PRICE_INDEX,
+    TICKER,
+    BOOK,
+    TRADES,
+    USER_ORDERS,
+    USER_TRADES,
+    USER_PORTFOLIO,
+    USER_CHANGES
+};
+
+// Resolves the channel family from its prefix, e.g. "ticker" or "user.orders"
+ChannelKind channel_kind(string_view channel);
+
+// Decodes subscription notifications into typed events and hands them to
+// the handlers registered for that channel family
+class ChannelDispatcher {
+public:
+    template <typename Event>
+    using handler = function<void(const Event&)>;
+
+    void on_price_index(handler<price_index_event> fn);
+    void on_ticker(handler<ticker_event> fn);
+    void on_book(handler<book_event> fn);
+    void on_trades(handler<trades_event> fn);
+    void on_user_orders(handler<user_orders_event> fn);
+    void on_user_trades(handler<user_trades_event> fn);
+    void on_user_portfolio(handler<portfolio_event> fn);
+    void on_user_changes(handler<user_changes_event> fn);
+
+    // Returns false for channels no decoder is registered for
+    bool dispatch(string_view channel, const json& data);
+
+private:
+    shared_mutex handlers_mutex;
+    vector<handler<price_index_event>> price_index_handlers;
+    vector<handler<ticker_event>> ticker_handlers;
+    vector<handler<book_event>> book_handlers;
+    vector<handler<trades_event>> trades_handlers;
+    vector<handler<user_orders_event>> user_orders_handlers;
+    vector<handler<user_trades_event>> user_trades_handlers;
+    vector<handler<portfolio_event>> user_portfolio_handlers;
+    vector<handler<user_changes_event>> user_changes_handlers;
+};
+
+namespace decode {
+    price_index_event price_index(const json& data);
+    ticker_event ticker(const json& data);
+    book_event book(const json& data);
+    trade_event trade(const json& data);
+    order_event order(const json& data);
+    position_event position(const json& data);
+    portfolio_event portfolio(const json& data);
+    user_changes_event user_changes(const json& data);
+
+    // Decode over an existing event, reusing its strings' and vectors' capacity
+    void into(price_index_event& event, const json& data);
+    void into(ticker_event& event, const json& data);
+    void into(book_event& event, const json& data);
+    void into(trade_event& event, const json& data);
+    void into(order_event& event, const json& data);
+    void into(position_event& event, const json& data);
+    void into(portfolio_event& event, const json& data);
+    void into(user_changes_event& event, const json& data);
+}
+
+ChannelDispatcher& getChannelDispatcher();
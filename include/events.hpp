@@ -0,0 +1,124 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Typed forms of the subscription notifications the client understands.
+// instrument_id is the InstrumentRegistry id of instrument_name.
+
+struct price_index_event {
+    string index_name;
+    string currency;        // upper-cased base, "btc_usd" -> "BTC"
+    double price{0.0};
+    long long timestamp{0};
+};
+
+struct ticker_event {
+    uint32_t instrument_id{0};
+    string instrument_name;
+    long long timestamp{0};
+    double best_bid_price{0.0};
+    double best_bid_amount{0.0};
+    double best_ask_price{0.0};
+    double best_ask_amount{0.0};
+    double last_price{0.0};
+    double mark_price{0.0};
+    double index_price{0.0};
+    double open_interest{0.0};
+};
+
+struct book_level {
+    double price{0.0};
+    double amount{0.0};     // 0 removes the level
+};
+
+struct book_event {
+    uint32_t instrument_id{0};
+    string instrument_name;
+    bool snapshot{false};
+    long long timestamp{0};
+    long long change_id{0};
+    long long prev_change_id{0};
+    vector<book_level> bids;
+    vector<book_level> asks;
+};
+
+struct trade_event {
+    uint32_t instrument_id{0};
+    string instrument_name;
+    string trade_id;
+    string order_id;        // user trades only
+    string label;           // user trades only
+    bool buy{false};
+    double price{0.0};
+    double amount{0.0};
+    double fee{0.0};
+    double index_price{0.0};
+    double mark_price{0.0};
+    long long trade_seq{0};
+    long long timestamp{0};
+};
+
+struct trades_event {
+    vector<trade_event> trades;
+};
+
+struct order_event {
+    uint32_t instrument_id{0};
+    string instrument_name;
+    string order_id;
+    string label;
+    string order_state;
+    string order_type;
+    bool buy{false};
+    double price{0.0};
+    double amount{0.0};
+    double filled_amount{0.0};
+    double average_price{0.0};
+    long long creation_timestamp{0};
+    long long last_update_timestamp{0};
+};
+
+struct user_orders_event {
+    vector<order_event> orders;
+};
+
+struct user_trades_event {
+    vector<trade_event> trades;
+};
+
+struct position_event {
+    uint32_t instrument_id{0};
+    string instrument_name;
+    double size{0.0};
+    double average_price{0.0};
+    double mark_price{0.0};
+    double index_price{0.0};
+    double realized_profit_loss{0.0};
+    double floating_profit_loss{0.0};
+    double initial_margin{0.0};
+    double maintenance_margin{0.0};
+};
+
+struct portfolio_event {
+    string currency;
+    double equity{0.0};
+    double balance{0.0};
+    double margin_balance{0.0};
+    double initial_margin{0.0};
+    double maintenance_margin{0.0};
+    double available_funds{0.0};
+    double total_pl{0.0};
+    double session_upl{0.0};
+    double session_rpl{0.0};
+};
+
+struct user_changes_event {
+    string instrument_name;
+    vector<trade_event> trades;
+    vector<position_event> positions;
+    vector<order_event> orders;
+};
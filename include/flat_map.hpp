@@ -0,0 +1,176 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Open-addressing hash map with linear probing and tombstones. Capacity is
+// kept a power of two and at most half full, so probes stay short and the
+// table lives in one contiguous allocation. For string keys use
+// hash<string_view> so lookups can take a string_view without a copy.
+template <typename Key, typename Value, typename Hash = hash<Key>>
+class open_hash_map {
+private:
+    enum class slot_state : uint8_t { EMPTY, FULL, DELETED };
+
+    struct slot {
+        Key key{};
+        Value value{};
+        slot_state state{slot_state::EMPTY};
+    };
+
+    vector<slot> slots;
+    vector<slot> spare;     // the table before the last same-capacity rehash
+    size_t count{0};
+    size_t used{0};     // full + deleted
+
+    template <typename K>
+    size_t probe(const K& key) const {
+        size_t mask = slots.size() - 1;
+        size_t index = Hash{}(key) & mask;
+        while (slots[index].state != slot_state::EMPTY) {
+            if (slots[index].state == slot_state::FULL && slots[index].key == key) return index;
+            index = (index + 1) & mask;
+        }
+        return slots.size();
+    }
+
+    // Purging tombstones at the same capacity swaps tables with spare, so a
+    // map whose size holds steady stops allocating once both exist
+    void rehash(size_t capacity) {
+        vector<slot> old = move(slots);
+        if (spare.size() == capacity) {
+            slots = move(spare);
+        } else {
+            slots.clear();
+            slots.resize(capacity);
+        }
+        spare.clear();
+        count = used = 0;
+        for (auto& s : old) {
+            if (s.state == slot_state::FULL) insert_or_assign(move(s.key), move(s.value));
+            s = slot{};
+        }
+        if (old.size() == capacity) spare = move(old);
+    }
+
+public:
+    explicit open_hash_map(size_t capacity = 16) {
+        size_t size = 16;
+        while (size < capacity * 2) size <<= 1;
+        slots.resize(size);
+    }
+
+    template <typename K>
+    Value* find(const K& key) {
+        size_t index = probe(key);
+        return index == slots.size() ? nullptr : &slots[index].value;
+    }
+
+    template <typename K>
+    const Value* find(const K& key) const {
+        size_t index = probe(key);
+        return index == slots.size() ? nullptr : &slots[index].value;
+    }
+
+    Value& insert_or_assign(Key key, Value value) {
+        if ((used + 1) * 2 > slots.size()) {
+            rehash(count * 4 > slots.size() ? slots.size() * 2 : slots.size());
+        }
+
+        size_t mask = slots.size() - 1;
+        size_t index = Hash{}(key) & mask;
+        size_t tombstone = slots.size();
+        while (slots[index].state != slot_state::EMPTY) {
+            if (slots[index].state == slot_state::FULL && slots[index].key == key) {
+                slots[index].value = move(value);
+                return slots[index].value;
+            }
+            if (slots[index].state == slot_state::DELETED && tombstone == slots.size()) tombstone = index;
+            index = (index + 1) & mask;
+        }
+
+        if (tombstone != slots.size()) {
+            index = tombstone;
+        } else {
+            used++;
+        }
+        slots[index].key = move(key);
+        slots[index].value = move(value);
+        slots[index].state = slot_state::FULL;
+        count++;
+        return slots[index].value;
+    }
+
+    template <typename K>
+    bool erase(const K& key) {
+        size_t index = probe(key);
+        if (index == slots.size()) return false;
+        slots[index].state = slot_state::DELETED;
+        slots[index].key = Key{};
+        slots[index].value = Value{};
+        count--;
+        return true;
+    }
+
+    template <typename Fn>
+    void for_each(Fn fn) const {
+        for (const auto& s : slots) {
+            if (s.state == slot_state::FULL) fn(s.key, s.value);
+        }
+    }
+
+    void clear() {
+        for (auto& s : slots) s = slot{};
+        count = used = 0;
+    }
+
+    size_t size() const { return count; }
+
+    bool empty() const { return count == 0; }
+};
+
+// Array indexed by a dense id (e.g. an interned instrument id) that grows in
+// fixed chunks which never move. Elements are reached without a lock, so with
+// atomic elements writers and readers on different threads need none either;
+// only allocating a new chunk takes the mutex.
+template <typename T, size_t CHUNK = 1024, size_t CHUNKS = 4096>
+class chunked_array {
+public:
+    chunked_array() = default;
+    chunked_array(const chunked_array&) = delete;
+    chunked_array& operator=(const chunked_array&) = delete;
+
+    ~chunked_array() {
+        for (auto& chunk : chunks) delete[] chunk.load(memory_order_relaxed);
+    }
+
+    // nullptr when index lies in a chunk not allocated yet
+    T* find(size_t index) const {
+        if (index >= CHUNK * CHUNKS) return nullptr;
+        T* chunk = chunks[index / CHUNK].load(memory_order_acquire);
+        return chunk != nullptr ? &chunk[index % CHUNK] : nullptr;
+    }
+
+    // Allocates the chunk on first use; nullptr past the last chunk
+    T* at(size_t index) {
+        if (T* element = find(index)) return element;
+        if (index >= CHUNK * CHUNKS) return nullptr;
+
+        lock_guard<mutex> lock(grow_mutex);
+        atomic<T*>& chunk = chunks[index / CHUNK];
+        if (chunk.load(memory_order_relaxed) == nullptr) chunk.store(new T[CHUNK](), memory_order_release);
+        return &chunk.load(memory_order_relaxed)[index % CHUNK];
+    }
+
+private:
+    array<atomic<T*>, CHUNKS> chunks{};
+    mutex grow_mutex;
+};
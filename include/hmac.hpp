@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <initializer_list>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+typedef struct evp_md_ctx_st EVP_MD_CTX;
+
+// Lowercase hex through a 256-entry table; out must hold 2 * length chars
+void hex_encode(const unsigned char* data, size_t length, char* out);
+
+// HMAC-SHA256 keyed once. The key's inner and outer pad blocks are hashed up
+// front, so a signature copies two digest states instead of re-deriving them,
+// and the secret itself is not kept.
+class HmacSha256 {
+public:
+    static constexpr size_t DIGEST_SIZE = 32;
+
+    explicit HmacSha256(string_view key);
+    ~HmacSha256();
+
+    HmacSha256(const HmacSha256&) = delete;
+    HmacSha256& operator=(const HmacSha256&) = delete;
+
+    // MAC over the concatenation of parts
+    void sign(initializer_list<string_view> parts, unsigned char out[DIGEST_SIZE]);
+
+    string sign_hex(initializer_list<string_view> parts);
+
+private:
+    EVP_MD_CTX* inner;
+    EVP_MD_CTX* outer;
+    EVP_MD_CTX* work;
+};
+
+// Deribit client_signature: hex(HMAC(secret, timestamp \n nonce \n data))
+string client_signature(HmacSha256& key, long long timestamp, string_view nonce, string_view data = {});
+
+struct signature_benchmark {
+    double legacy_ns;       // utils::get_signature, keyed and hex-formatted per call
+    double keyed_ns;        // client_signature over a reused HmacSha256
+};
+
+signature_benchmark benchmark_signatures(size_t iterations);
@@ -0,0 +1,105 @@
+#pragma once
+
+#include "json.hpp"
+#include <cstdint>
+#include <atomic>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+using json = nlohmann::json;
+
+enum class InstrumentKind : uint8_t {
+    UNKNOWN,
+    FUTURE,
+    OPTION,
+    SPOT,
+    FUTURE_COMBO,
+    OPTION_COMBO
+};
+
+struct instrument_info {
+    uint32_t id{0};
+    string name;
+    string base_currency;
+    InstrumentKind kind{InstrumentKind::UNKNOWN};
+    double tick_size{0.0};
+    double contract_size{0.0};
+    double min_trade_amount{0.0};
+    long long expiration_timestamp{0};
+    bool inverse{false};
+    bool listed{false};     // false when only interned from user input
+};
+
+// Interns instrument names to dense ids and holds the metadata returned by
+// public/get_instruments. Ids are stable for the lifetime of the process.
+class InstrumentRegistry {
+public:
+    static constexpr uint32_t INVALID_ID = UINT32_MAX;
+    static constexpr uint32_t CACHE_VERSION = 1;
+
+    uint32_t intern(string_view name);
+
+    uint32_t find(string_view name) const;
+
+    bool is_listed(string_view name) const;
+
+    // A copy: load() and load_cache() update entries in place
+    optional<instrument_info> get(uint32_t id) const;
+
+    // Remembers what a get_instruments request asked for, so its result can
+    // delist what the exchange no longer returns for that currency and kind
+    void expect_listing(long request_id, string_view currency, string_view kind);
+
+    // Applies a get_instruments result, returning the number of instruments
+    // added, changed or delisted
+    size_t load(const json& instruments, long request_id = 0);
+
+    bool load_cache(const string& path);
+
+    // Snapshots the listed instruments and writes them on a background thread
+    bool save_cache();
+
+    long long cache_timestamp() const;
+
+    size_t size() const;
+
+    bool loaded() const;
+
+    static bool is_instrument_list(const json& result);
+
+private:
+    uint32_t intern_locked(string_view name);
+
+    mutable shared_mutex registry_mutex;
+    deque<instrument_info> instruments;
+    unordered_map<string_view, uint32_t> index;
+    size_t listed_count{0};
+    string cache_path;
+
+    // "currency/kind" of each outstanding get_instruments request, and the
+    // ids each scope returned last time
+    unordered_map<long, string> pending_listings;
+    unordered_map<string, vector<uint32_t>> listings;
+
+    // Shared with the writer threads, which may outlive a save_cache() call
+    struct cache_writer {
+        mutex write_mutex;
+        uint64_t written{0};
+        atomic<uint64_t> queued{0};
+        atomic<long long> cached_at{0};
+    };
+    shared_ptr<cache_writer> writer{make_shared<cache_writer>()};
+};
+
+InstrumentKind parse_instrument_kind(string_view kind);
+
+InstrumentRegistry& getInstrumentRegistry();
@@ -0,0 +1,173 @@
+#pragma once
+
+#include "events.hpp"
+#include "flat_map.hpp"
+#include "json.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+using json = nlohmann::json;
+
+enum class OrderState : uint8_t {
+    PENDING_NEW,
+    OPEN,
+    PARTIALLY_FILLED,
+    FILLED,
+    CANCELLED,
+    REJECTED,
+    UNTRIGGERED
+};
+
+const char* to_string(OrderState state);
+
+// Differences found between the local book and a private/get_open_orders snapshot
+struct reconcile_report {
+    size_t added{0};        // open on the exchange, unknown or closed locally
+    size_t updated{0};      // fill, amount or price differed
+    size_t closed{0};       // live locally, absent from the exchange
+    vector<string> details;
+
+    bool diverged() const { return added + updated + closed > 0; }
+};
+
+struct order {
+    uint32_t slot{0};
+    long request_id{0};
+    string order_id;
+    string label;
+    string instrument_name;
+    uint32_t instrument_id{0};
+    string order_type;
+    bool buy{false};
+    double price{0.0};
+    double amount{0.0};
+    double filled_amount{0.0};
+    double average_price{0.0};
+    OrderState state{OrderState::PENDING_NEW};
+    string reject_reason;
+    long long last_update{0};
+    int connection_id{-1};      // order-entry connection that carried the buy/sell
+
+    bool is_live() const {
+        return state == OrderState::PENDING_NEW || state == OrderState::OPEN ||
+               state == OrderState::PARTIALLY_FILLED || state == OrderState::UNTRIGGERED;
+    }
+};
+
+// Local order book of our own orders, kept current from request responses
+// and user.orders notifications. Orders are indexed by exchange order id;
+// live orders are also chained per label and per instrument. The most recent
+// MAX_FINISHED finished orders stay queryable, older slots are reused.
+class OrderManager {
+public:
+    static constexpr size_t MAX_FINISHED = 4096;
+
+    OrderManager();
+
+    void on_order_sent(long request_id, const string& instrument, const string& label,
+                       bool buy, double amount, double price, const string& order_type);
+
+    // Returns true when the response was for an order request
+    bool on_response(const json& response);
+
+    void on_order_update(const order_event& update);
+
+    // A sent order request that never reached the exchange, e.g. dropped by
+    // the kill switch; false when it was not pending
+    bool on_order_dropped(long request_id, const string& reason);
+
+    // Records the connection a new-order request left on, so its edits and
+    // cancels can follow it
+    void on_order_routed(long request_id, int connection_id);
+
+    optional<order> find(string_view order_id) const;
+
+    // An order whose request has not been answered yet
+    optional<order> find_request(long request_id) const;
+
+    // The order a new-order request created, answered or not
+    optional<order> by_request(long request_id) const;
+
+    vector<order> by_label(string_view label) const;
+
+    vector<order> by_instrument(uint32_t instrument_id) const;
+
+    vector<order> live_orders() const;
+
+    size_t live_count(uint32_t instrument_id) const;
+
+    // Live orders whose instrument settles in currency, optionally with label
+    vector<order> open_orders(string_view currency, string_view label = {}) const;
+
+    // Builds a private/get_open_orders request whose response on_response
+    // reconciles against the local book
+    string reconcile_request();
+
+    // True once a reconciliation snapshot has seeded the book
+    bool synced() const { return is_synced.load(memory_order_acquire); }
+
+    // Result of the most recent reconciliation
+    reconcile_report last_reconcile() const;
+
+    void on_reconcile(function<void(const reconcile_report&)> fn);
+
+private:
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    struct links {
+        uint32_t prev{NIL};
+        uint32_t next{NIL};
+    };
+
+    struct entry {
+        order data;
+        links by_label;
+        links by_instrument;
+        bool linked{false};
+        bool retired{false};        // queued in finished
+    };
+
+    uint32_t allocate();
+    void retire(uint32_t slot);
+    void recycle(uint32_t slot);
+    void apply(uint32_t slot, const order_event& update);
+    void apply_json(const json& data);
+    void link(uint32_t slot);
+    void unlink(uint32_t slot);
+    uint32_t match_pending(const order_event& update) const;
+    void reconcile(const json& snapshot, long long sent_at);
+
+    template <typename Index, typename Key>
+    vector<order> collect(const Index& index, const Key& key, links entry::*member) const;
+
+    mutable mutex orders_mutex;
+    vector<entry> orders;
+    open_hash_map<string, uint32_t, hash<string_view>> by_order_id;
+    open_hash_map<string, uint32_t, hash<string_view>> label_heads;
+    open_hash_map<uint32_t, uint32_t> instrument_heads;
+    open_hash_map<uint32_t, uint32_t> instrument_live;
+    open_hash_map<long, uint32_t> pending_requests;
+    open_hash_map<long, uint32_t> requests;
+    vector<uint32_t> free_slots;
+    vector<uint32_t> finished;      // ring of MAX_FINISHED, oldest at finished_cursor once full
+    size_t finished_cursor{0};
+
+    long reconcile_id{0};
+    long long reconcile_sent_at{0};
+    reconcile_report reconciled;
+    atomic<bool> is_synced{false};
+    function<void(const reconcile_report&)> reconcile_handler;
+};
+
+// The order book of the calling thread's account
+OrderManager& getOrderManager();
+
+OrderManager& getOrderManager(size_t account);
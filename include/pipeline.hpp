@@ -0,0 +1,120 @@
+#pragma once
+
+#include "spsc_ring.hpp"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+
+using namespace std;
+
+// Inbound frames flow io -> decode -> logic, one thread per stage
+enum class PipelineStage : uint8_t {
+    IO,         // websocketpp reader: copies the payload out and returns
+    DECODE,     // JSON parse
+    LOGIC       // dispatch, order and portfolio state, console
+};
+
+struct stage_config {
+    int cpu{-1};                // -1 leaves the thread unpinned
+    int policy{0};              // SCHED_OTHER, SCHED_FIFO or SCHED_RR
+    int priority{0};            // for the real-time policies
+    size_t spin{2000};          // polls before the consumer parks
+};
+
+// DERIBIT_PIPELINE_<STAGE>_CPU, _POLICY (other|fifo|rr), _PRIORITY and _SPIN
+stage_config stage_config_from_env(PipelineStage stage);
+
+// Applies pinning and scheduling to the calling thread; false if the OS refused
+bool apply_stage_config(PipelineStage stage, const stage_config& config);
+
+const char* stage_name(PipelineStage stage);
+
+// SPSC ring between two stages. The producer never blocks: when the ring is
+// full, frames spill to a locked overflow list that the consumer drains after
+// the ring, so ordering holds and a slow stage cannot stall the socket.
+template <typename T>
+class stage_queue {
+public:
+    explicit stage_queue(size_t capacity) : ring(capacity) {}
+
+    // Producer only
+    void push(T value) {
+        if (spilled.load(memory_order_acquire) || !ring.try_push(value)) {
+            lock_guard<mutex> lock(overflow_mutex);
+            overflow.push_back(move(value));
+            spilled.store(true, memory_order_release);
+            overflowed.fetch_add(1, memory_order_relaxed);
+        }
+
+        // Pairs with the fence in pop(): either the consumer sees the frame or we see it parked
+        atomic_thread_fence(memory_order_seq_cst);
+        if (parked.load(memory_order_relaxed)) {
+            lock_guard<mutex> lock(park_mutex);
+            wake.notify_one();
+        }
+    }
+
+    // Consumer only; waits up to timeout once spin polls find nothing
+    bool pop(T& value, size_t spin, chrono::microseconds timeout) {
+        for (size_t i = 0; i <= spin; ++i) {
+            if (try_pop(value)) return true;
+        }
+
+        unique_lock<mutex> lock(park_mutex);
+        parked.store(true, memory_order_relaxed);
+        atomic_thread_fence(memory_order_seq_cst);
+        if (!try_pop(value)) {
+            wake.wait_for(lock, timeout);
+            parked.store(false, memory_order_relaxed);
+            lock.unlock();
+            return try_pop(value);
+        }
+        parked.store(false, memory_order_relaxed);
+        return true;
+    }
+
+    void wake_consumer() {
+        lock_guard<mutex> lock(park_mutex);
+        wake.notify_all();
+    }
+
+    // Frames that missed the ring since the last call
+    size_t take_overflow_count() { return overflowed.exchange(0, memory_order_relaxed); }
+
+private:
+    bool try_pop(T& value) {
+        if (!draining.empty()) {
+            value = move(draining.front());
+            draining.pop_front();
+            return true;
+        }
+        if (ring.try_pop(value)) return true;
+
+        // Everything in the ring predates the overflow, so it is only taken once the ring is dry
+        if (!spilled.load(memory_order_acquire)) return false;
+        lock_guard<mutex> lock(overflow_mutex);
+        draining.swap(overflow);
+        spilled.store(false, memory_order_release);
+        if (draining.empty()) return false;
+        value = move(draining.front());
+        draining.pop_front();
+        return true;
+    }
+
+    spsc_ring<T> ring;
+
+    mutex overflow_mutex;
+    deque<T> overflow;
+    deque<T> draining;          // consumer-owned batch taken from overflow
+    atomic<bool> spilled{false};
+    atomic<size_t> overflowed{0};
+
+    mutex park_mutex;
+    condition_variable wake;
+    atomic<bool> parked{false};
+};
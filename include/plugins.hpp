@@ -0,0 +1,127 @@
+#pragma once
+
+#include "sessions.hpp"
+#include "strategy.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <string>
+#include <thread>
+#include <variant>
+#include <vector>
+
+using namespace std;
+
+// Same order as strategy_event's alternatives
+enum class StrategyCallback : uint8_t {
+    BOOK,
+    TRADES,
+    TICKER,
+    ORDER,
+    FILL,
+    TASK,           // posted work, e.g. a resumed request
+    COUNT
+};
+
+struct strategy_callback_stats {
+    uint64_t calls{0};
+    uint64_t total_ns{0};
+    uint64_t max_ns{0};
+};
+
+struct strategy_load {
+    string path;
+    size_t account{0};
+    int cpu{-1};
+    size_t queued{0};
+    uint64_t dropped{0};
+    array<strategy_callback_stats, static_cast<size_t>(StrategyCallback::COUNT)> callbacks;
+};
+
+// Loads strategy plugins and feeds them the dispatcher's events. Each
+// strategy runs on its own thread (pinned when given a cpu) with its own
+// queue, so a slow one only falls behind itself: past MAX_QUEUED its market
+// data is dropped, while order and fill events are always kept.
+class StrategyHost {
+public:
+    static constexpr size_t MAX_QUEUED = 65536;
+    static constexpr chrono::milliseconds SLOW_CALLBACK{1};
+
+    // DERIBIT_STRATEGIES="a.so,b.so" for the main account, pinned to DERIBIT_STRATEGY_CPUS="6,7"
+    size_t load_from_env(SessionStore& sessions);
+
+    bool load(const string& path, SessionStore& sessions, session& owner, int cpu = -1);
+
+    // Stops the strategy, closes its object and loads the file again, e.g. after a rebuild
+    bool reload(const string& path);
+
+    bool unload(const string& path);
+
+    void unload_all();
+
+    vector<strategy_load> load_stats() const;
+
+    string report() const;
+
+private:
+    using strategy_event = variant<book_event, trades_event, ticker_event, order_event, trade_event,
+                                   function<void()>>;
+
+    struct plugin : StrategyContext {
+        string path;
+        SessionStore* sessions{nullptr};
+        session* owner{nullptr};
+        int cpu{-1};
+
+        void* handle{nullptr};
+        Strategy* strategy{nullptr};
+        destroy_strategy_fn destroy{nullptr};
+        unique_ptr<AsyncSession> requests;
+
+        // Replies can outlive the plugin; its executor posts only while this is set
+        struct post_target {
+            mutex target_mutex;
+            plugin* target{nullptr};
+        };
+        shared_ptr<post_target> alive{make_shared<post_target>()};
+        thread worker;
+
+        mutex queue_mutex;
+        condition_variable wake;
+        deque<strategy_event> queue;
+        bool running{true};
+        atomic<uint64_t> dropped{0};
+
+        struct callback_counters {
+            atomic<uint64_t> calls{0};
+            atomic<uint64_t> total_ns{0};
+            atomic<uint64_t> max_ns{0};
+        };
+        array<callback_counters, static_cast<size_t>(StrategyCallback::COUNT)> callbacks;
+
+        long submit(const api::order_request& request) override;
+        bool cancel(const string& order_id) override;
+        bool cancel_all() override;
+        size_t account() const override { return owner->account; }
+        AsyncSession& async() override { return *requests; }
+        void post(function<void()> task) override;
+    };
+
+    void register_handlers();
+    void publish(const strategy_event& event, size_t account, bool market_data);
+    void run(plugin& p);
+    static void stop(plugin& p);
+
+    mutable shared_mutex plugins_mutex;
+    vector<unique_ptr<plugin>> plugins;
+    atomic<size_t> loaded{0};
+    once_flag handlers_registered;
+};
+
+StrategyHost& getStrategyHost();
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+// Heap allocations made so far by the calling thread. Counted only in
+// programs whose operator new calls count_heap_allocation(), as the
+// allocation test does; elsewhere this stays 0 and the probes report nothing.
+uint64_t heap_allocations();
+
+void count_heap_allocation();
+
+// Hot paths whose heap allocations per pass are sampled for the metrics screen
+enum class HotPath : uint8_t {
+    DISPATCH,           // decoding a notification into its pooled event and running its handlers
+    ORDER_ENTRY,        // risk check, OMS record and frame encoding of a new order
+    REQUEST,            // registering a handler for an awaited response
+    COUNT
+};
+
+// Counts the calling thread's allocations between construction and destruction
+class alloc_probe {
+public:
+    explicit alloc_probe(HotPath path) : path(path), start(heap_allocations()) {}
+    ~alloc_probe();
+
+    alloc_probe(const alloc_probe&) = delete;
+    alloc_probe& operator=(const alloc_probe&) = delete;
+
+private:
+    HotPath path;
+    uint64_t start;
+};
+
+// Per-thread free lists of reusable objects. A released object keeps the
+// capacity of its strings and vectors, so once a thread's pool has warmed up
+// decoding into it no longer touches the heap. Objects go back to the free
+// list of the thread releasing them; callers overwrite every field they use.
+template <typename T>
+class object_pool {
+public:
+    class handle {
+    public:
+        explicit handle(T* object) : object(object) {}
+        handle(handle&& other) noexcept : object(exchange(other.object, nullptr)) {}
+        handle(const handle&) = delete;
+        handle& operator=(const handle&) = delete;
+        handle& operator=(handle&&) = delete;
+        ~handle() { if (object != nullptr) object_pool::release(object); }
+
+        T& operator*() const { return *object; }
+        T* operator->() const { return object; }
+
+    private:
+        T* object;
+    };
+
+    static handle acquire() {
+        vector<unique_ptr<T>>& free = free_list();
+        if (free.empty()) {
+            created.fetch_add(1, memory_order_relaxed);
+            return handle(new T());
+        }
+        T* object = free.back().release();
+        free.pop_back();
+        return handle(object);
+    }
+
+    // Objects ever constructed across all threads; flat once every thread is warm
+    static uint64_t allocated() { return created.load(memory_order_relaxed); }
+
+private:
+    static void release(T* object) { free_list().emplace_back(object); }
+
+    static vector<unique_ptr<T>>& free_list() {
+        thread_local vector<unique_ptr<T>> free = [] {
+            vector<unique_ptr<T>> v;
+            v.reserve(16);
+            return v;
+        }();
+        return free;
+    }
+
+    static inline atomic<uint64_t> created{0};
+};
+
+// Registers a pool under name for the report
+void track_pool(const string& name, uint64_t (*allocated)());
+
+template <typename T>
+void track_pool(const string& name) {
+    track_pool(name, &object_pool<T>::allocated);
+}
+
+// Allocations per pass of each hot path, and the objects each pool has built
+string allocation_report();
@@ -0,0 +1,102 @@
+#pragma once
+
+#include "events.hpp"
+#include "flat_map.hpp"
+#include "instruments.hpp"
+#include "json.hpp"
+#include <atomic>
+#include <cstdint>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+using json = nlohmann::json;
+
+struct position {
+    uint32_t instrument_id{0};
+    string instrument_name;
+    string currency;
+    InstrumentKind kind{InstrumentKind::UNKNOWN};
+    bool inverse{false};        // size in USD, PnL in the base currency
+    double size{0.0};           // signed, negative when short
+    double average_price{0.0};
+    double mark_price{0.0};
+    double index_price{0.0};
+    double realized_pnl{0.0};
+    double unrealized_pnl{0.0};
+    double initial_margin{0.0};
+    double maintenance_margin{0.0};
+    bool marked_by_ticker{false};
+    long long last_update{0};
+};
+
+// Latest ticker prices of an instrument, 0 until one arrives
+struct ticker_mark {
+    atomic<double> mark_price{0.0};
+    atomic<double> index_price{0.0};
+};
+
+// Positions and account margin kept current from user.trades, user.changes
+// and user.portfolio, and marked to market on ticker and index updates.
+// Positions are stored by instrument id so a lookup is an index.
+class PortfolioCache {
+public:
+    void on_trade(const trade_event& trade);
+    void on_position(const position_event& update);
+    void on_changes(const user_changes_event& changes);
+    void on_portfolio(const portfolio_event& update);
+    void on_ticker(const ticker_event& ticker);
+    void on_index(const price_index_event& index);
+
+    // Builds a private/get_positions request whose response seeds the cache
+    string snapshot_request();
+
+    // Returns true when the response was the seeding snapshot
+    bool on_response(const json& response);
+
+    bool synced() const { return is_synced.load(memory_order_acquire); }
+
+    // Signed position size, 0 when flat or unknown
+    double exposure(uint32_t instrument_id) const;
+
+    optional<position> get(uint32_t instrument_id) const;
+
+    // Open positions filtered by currency and instrument kind name
+    vector<position> positions(string_view currency = {}, string_view kind = {}) const;
+
+    optional<portfolio_event> account(string_view currency) const;
+
+private:
+    position& slot(uint32_t instrument_id, string_view name);
+    void apply_position(const position_event& update);
+    void apply_trade(const trade_event& trade);
+    bool seen_trade(const string& trade_id);
+    static void mark(position& p, double price);
+    position marked(const position& p) const;
+
+    mutable shared_mutex portfolio_mutex;
+    vector<position> by_instrument;
+    vector<portfolio_event> accounts;
+
+    // Trades arrive on both user.trades and user.changes; apply each once
+    static constexpr size_t TRADE_HISTORY = 4096;
+    open_hash_map<string, bool, hash<string_view>> applied_trades{TRADE_HISTORY};
+    vector<string> trade_history;
+    size_t trade_cursor{0};
+
+    long snapshot_id{0};
+    atomic<bool> is_synced{false};
+
+    // Tickers only store here, without portfolio_mutex; positions are marked
+    // with them when read
+    chunked_array<ticker_mark> ticker_marks;
+};
+
+// The positions of the calling thread's account
+PortfolioCache& getPortfolioCache();
+
+PortfolioCache& getPortfolioCache(size_t account);
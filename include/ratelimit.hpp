@@ -0,0 +1,123 @@
+#pragma once
+
+#include "json.hpp"
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+using json = nlohmann::json;
+
+// Deribit charges matching-engine requests (order entry) and everything
+// else against separate credit pools
+enum class RequestClass : uint8_t {
+    MATCHING_ENGINE,
+    NON_MATCHING_ENGINE
+};
+
+// Outbound priority classes, most urgent first
+enum class SendPriority : uint8_t {
+    CANCEL,         // cancels and the kill switch
+    AMEND,
+    NEW_ORDER,
+    QUERY,
+    COUNT
+};
+
+enum class ThrottleMode : uint8_t {
+    QUEUE,
+    REJECT
+};
+
+struct credit_bucket {
+    double capacity;
+    double refill_per_second;
+    double cost;
+    double credits;
+    chrono::steady_clock::time_point last_refill;
+
+    credit_bucket(double capacity, double refill_per_second, double cost);
+
+    void refill(chrono::steady_clock::time_point now);
+    bool try_take(chrono::steady_clock::time_point now);
+    chrono::nanoseconds time_until_available(chrono::steady_clock::time_point now);
+};
+
+// Per-connection outbound scheduler. Requests that fit their credit bucket
+// go out immediately unless the socket is congested; the rest wait in
+// priority lanes and drain most urgent first. In REJECT mode new orders and
+// amends are refused instead; cancels and the client's own traffic (queries,
+// subscriptions, token refreshes, reconciliation) always queue. Queued
+// edits of the same order are coalesced into one.
+class RateLimiter {
+public:
+    // COALESCED: folded into a queued edit of the same order, which now
+    // carries this request's id; the id it replaced will get no response
+    enum Decision : uint8_t { SEND, QUEUED, REJECTED, COALESCED };
+
+    RateLimiter();
+
+    // Lowest-tier defaults: 20 order requests burst at 5/s, 100 others at 20/s
+    void set_bucket(RequestClass type, double capacity, double refill_per_second, double cost);
+
+    void set_mode(ThrottleMode mode);
+
+    ThrottleMode mode() const { return throttle_mode; }
+
+    // congested holds everything back, e.g. while the socket write buffer is full.
+    // On COALESCED, superseded receives the request id that was replaced.
+    Decision admit(const string& message, bool congested = false, long* superseded = nullptr);
+
+    // Pops the next queued message whose bucket has credit; false when none is ready
+    bool next_ready(string& message, chrono::nanoseconds& queued_for);
+
+    // Time until the head of the queue can go, zero when nothing is queued
+    chrono::nanoseconds next_delay();
+
+    bool has_queued();
+
+    // The exchange answered too_many_requests: our view of its credits is stale
+    void on_throttled();
+
+    // Drops queued new orders and amends, returning the dropped frames
+    vector<string> drop_pending_orders();
+
+    static RequestClass classify(string_view message);
+
+    static bool is_cancel(string_view message);
+
+    static SendPriority priority(string_view message);
+
+private:
+    struct queued_message {
+        string message;
+        RequestClass type;
+        chrono::steady_clock::time_point queued_at;
+
+        // Edits only
+        long request_id{0};
+        string order_id;
+        json params;
+    };
+
+    using lane = deque<queued_message>;
+
+    credit_bucket& bucket(RequestClass type);
+
+    mutex limiter_mutex;
+    credit_bucket matching;
+    credit_bucket non_matching;
+    ThrottleMode throttle_mode{ThrottleMode::QUEUE};
+
+    array<lane, static_cast<size_t>(SendPriority::COUNT)> lanes;
+
+    // Queued edits by order id; deque elements stay put while the lane grows and drains at its ends
+    unordered_map<string, queued_message*> queued_edits;
+};
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "events.hpp"
+#include "flat_map.hpp"
+#include "json.hpp"
+#include <atomic>
+#include <cstdint>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+using json = nlohmann::json;
+
+// A limit of 0 disables that check
+struct risk_limits {
+    double max_order_size{0.0};
+    double max_notional{0.0};       // in USD, see RiskGate
+    double price_collar{0.10};      // max distance from the reference price, as a fraction
+    double max_position{0.0};       // absolute size after the order fills
+    uint32_t max_open_orders{200};
+};
+
+enum RiskViolation : uint8_t {
+    RISK_OK = 0,
+    RISK_ORDER_SIZE = 1 << 0,
+    RISK_NOTIONAL = 1 << 1,
+    RISK_PRICE_COLLAR = 1 << 2,
+    RISK_POSITION = 1 << 3,
+    RISK_OPEN_ORDERS = 1 << 4
+};
+
+string describe_violations(uint8_t violations);
+
+struct risk_order {
+    uint32_t instrument_id{0};
+    bool buy{false};
+    double amount{0.0};
+    double price{0.0};          // 0 for market orders
+    bool new_order{true};       // edits skip the position and open-order checks
+};
+
+// Pre-trade checks run between order construction and send. Limits are
+// resolved once per interned instrument into a flat slot so a check is a
+// handful of comparisons folded into a violation mask.
+//
+// Notional is in USD throughout: the amount itself for inverse futures,
+// amount * price for linear instruments quoted in USD/USDC, and for options
+// the underlying's value, amount * index (unchecked until an index arrives).
+class RiskGate {
+public:
+    RiskGate();
+
+    void set_default_limits(const risk_limits& limits);
+
+    void set_limits(string_view instrument, const risk_limits& limits);
+
+    // {"default": {...}, "instruments": {"BTC-PERPETUAL": {...}}}
+    bool load(const json& config);
+
+    bool load_file(const string& path);
+
+    // Returns a RiskViolation mask, RISK_OK when the order may go out
+    uint8_t check(const risk_order& order);
+
+    void on_ticker(const ticker_event& ticker);
+
+    void on_index(const price_index_event& index);
+
+    // Mean nanoseconds per check over iterations, for the metrics screen
+    double benchmark(size_t iterations);
+
+private:
+    struct slot {
+        double max_order_size;
+        double max_notional;
+        double price_collar;
+        double max_position;
+        double max_open_orders;
+        double notional_fixed;      // 1 for inverse contracts sized in USD
+        double notional_price;      // 1 for linear contracts sized in the base currency
+        double notional_index;      // 1 for options, valued at the underlying index
+        double index_weight;        // 0 for options, whose prices are not index-denominated
+        uint32_t currency;
+        bool resolved;
+    };
+
+    static uint8_t evaluate(const slot& s, double mark_price, double index_price, const risk_order& order,
+                            double exposure, size_t open_orders);
+    slot make_slot(uint32_t instrument_id);
+    double mark_of(uint32_t instrument_id) const;
+    void build(uint32_t instrument_id);
+    uint32_t currency_index(string_view currency);
+
+    shared_mutex gate_mutex;
+    risk_limits defaults;
+    open_hash_map<uint32_t, risk_limits> overrides;
+    vector<slot> slots;
+    vector<string> currencies;
+    vector<double> index_prices;
+
+    // Written by every ticker, on whichever market-data shard carries the
+    // instrument, so kept outside gate_mutex
+    chunked_array<atomic<double>> marks;
+};
+
+RiskGate& getRiskGate();
@@ -0,0 +1,72 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "flat_map.hpp"
+
+using namespace std;
+
+struct route_stats {
+    int connection_id{-1};
+    double ewma_rtt_us{0.0};        // 0 until the first reply
+    uint32_t in_flight{0};
+    uint64_t picked{0};
+    uint64_t acked{0};
+    uint64_t errors{0};             // replies carrying an error
+    uint64_t timeouts{0};           // no reply before the endpoint's request timeout
+    uint64_t skipped_congested{0};
+};
+
+// Chooses the order-entry connection for each matching-engine request:
+// lowest EWMA round trip scaled by requests in flight, skipping connections
+// whose socket or send queue is backed up. Replies feed the estimate back.
+class OrderRouter {
+public:
+    static constexpr double EWMA_ALPHA = 0.2;
+
+    // False when the connection was already registered
+    bool add(int connection_id);
+
+    void remove(int connection_id);
+
+    size_t size() const;
+
+    // Keeps preferred unless it and at least one other connection are registered
+    int pick(int preferred, const function<bool(int)>& congested);
+
+    void on_sent(int connection_id, long request_id, chrono::steady_clock::time_point sent_at);
+
+    // True when the reply answered a routed request
+    bool on_response(int connection_id, long request_id, bool error, chrono::steady_clock::time_point now);
+
+    // The request timer fired before any reply; frees its in-flight slot
+    void on_timeout(long request_id);
+
+    vector<route_stats> stats() const;
+
+    string report() const;
+
+    // The "id" of a JSON-RPC frame as written by json::dump(), 0 if absent
+    static long request_id(string_view message);
+
+    // The "order_id" or "label" parameter of an edit or cancel, empty when absent
+    static string_view order_id(string_view message);
+    static string_view label(string_view message);
+
+private:
+    struct in_flight_request {
+        int connection_id{-1};
+        chrono::steady_clock::time_point sent_at;
+    };
+
+    route_stats* find(int connection_id);
+
+    mutable mutex router_mutex;
+    vector<route_stats> connections;
+    open_hash_map<long, in_flight_request> pending{256};
+};
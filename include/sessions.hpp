@@ -0,0 +1,65 @@
+#pragma once
+
+#include "websocket.hpp"
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+// One authenticated account: its own endpoint (and so its own io thread and
+// connection), token and scope. The first session is the main account.
+struct session {
+    size_t account{0};
+    string name;
+    string client_id;
+    unique_ptr<websocket_endpoint> endpoint;
+    int connection_id{-1};
+
+    bool connected() const { return connection_id != -1; }
+};
+
+// Holds every session the process trades and routes commands by account
+class SessionStore {
+public:
+    SessionStore();
+
+    // Adds a session bound to the next free account, nullptr when the name is
+    // taken or every account is in use
+    session* add(const string& name);
+
+    session* find(string_view name);
+
+    session& get(size_t account);
+
+    // The session the console is trading; the calling thread is bound to it
+    session& active();
+
+    bool select(string_view name);
+
+    // Connects the session's endpoint and sends public/auth when credentials are given
+    bool connect(session& s, const string& uri, const string& client_id = "",
+                 const string& client_secret = "");
+
+    // Builds "Deribit <connection> <args>" for the session, processes it against
+    // that account's state and sends the result on its connection
+    bool route(session& s, const string& args);
+
+    bool route(string_view name, const string& args);
+
+    // Fires the kill switch on every session, returning the frames sent
+    int kill_switch();
+
+    // Lifts the kill switch latch on every session
+    void resume_trading();
+
+    vector<const session*> list() const;
+
+private:
+    mutable mutex store_mutex;
+    deque<session> sessions;     // stable addresses
+    size_t active_account{0};
+};
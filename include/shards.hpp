@@ -0,0 +1,93 @@
+#pragma once
+
+#include "dispatcher.hpp"
+#include "flat_map.hpp"
+#include "json.hpp"
+#include "pipeline.hpp"
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+using json = nlohmann::json;
+
+struct shard_load {
+    size_t shard{0};
+    int cpu{-1};
+    uint64_t events{0};
+    uint64_t busy_ns{0};
+    uint64_t overflow{0};       // frames that missed the ring
+    uint64_t book_gaps{0};      // book changes whose prev_change_id did not follow on
+    size_t instruments{0};
+};
+
+// Fans per-instrument market data (ticker, book, trades.<instrument>) out to
+// worker threads by interned instrument id. One instrument always lands on
+// the same shard, so its events stay in order, and the shard owns that
+// instrument's sequencing state without taking a lock. One pool serves every
+// endpoint and account in the process; each frame runs bound to its account.
+class MarketDataShards {
+public:
+    // DERIBIT_MD_SHARDS workers (0 dispatches inline), pinned to DERIBIT_MD_SHARD_CPUS="4,5,..."
+    MarketDataShards();
+    ~MarketDataShards();
+
+    MarketDataShards(const MarketDataShards&) = delete;
+    MarketDataShards& operator=(const MarketDataShards&) = delete;
+
+    // Called from each endpoint's logic stage, for the calling thread's account.
+    // Takes data and returns true for per-instrument channels; otherwise the
+    // caller dispatches it inline.
+    bool route(string_view channel, json& data);
+
+    size_t size() const { return shards.size(); }
+
+    size_t shard_of(uint32_t instrument_id) const;
+
+    vector<shard_load> load() const;
+
+    string report() const;
+
+private:
+    struct md_frame {
+        size_t account{0};
+        uint32_t instrument_id{0};
+        string channel;
+        json data;
+    };
+
+    struct shard {
+        explicit shard(size_t capacity) : queue(capacity) {}
+
+        // The queue takes one producer at a time; each endpoint's logic stage is one
+        mutex producer_mutex;
+        stage_queue<md_frame> queue;
+        thread worker;
+        int cpu{-1};
+
+        atomic<uint64_t> events{0};
+        atomic<uint64_t> busy_ns{0};
+        atomic<uint64_t> overflow{0};
+        atomic<uint64_t> book_gaps{0};
+        atomic<size_t> instruments{0};
+
+        // Worker-only: last book change_id per account and instrument
+        open_hash_map<uint64_t, long long> last_change{256};
+    };
+
+    static constexpr size_t SHARD_QUEUE_CAPACITY = 8192;
+
+    void run(shard& s, size_t index);
+    void track_book(shard& s, const md_frame& frame);
+
+    atomic<bool> running{true};
+    vector<unique_ptr<shard>> shards;
+};
+
+// The process-wide pool
+MarketDataShards& getMarketDataShards();
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <utility>
+
+using namespace std;
+
+// Bounded lock-free ring for exactly one producer thread and one consumer
+// thread. Capacity is rounded up to a power of two; each side caches the
+// other's index so the shared cache line is only read when the cached view
+// says the ring is full or empty.
+template <typename T>
+class spsc_ring {
+public:
+    explicit spsc_ring(size_t capacity) {
+        size_t size = 2;
+        while (size < capacity) size <<= 1;
+        mask = size - 1;
+        slots = make_unique<T[]>(size);
+    }
+
+    spsc_ring(const spsc_ring&) = delete;
+    spsc_ring& operator=(const spsc_ring&) = delete;
+
+    // Producer only; false when full, leaving value untouched
+    bool try_push(T& value) {
+        size_t tail = write_index.load(memory_order_relaxed);
+        if (tail - cached_read >= mask + 1) {
+            cached_read = read_index.load(memory_order_acquire);
+            if (tail - cached_read >= mask + 1) return false;
+        }
+        slots[tail & mask] = move(value);
+        write_index.store(tail + 1, memory_order_release);
+        return true;
+    }
+
+    // Consumer only
+    bool try_pop(T& value) {
+        size_t head = read_index.load(memory_order_relaxed);
+        if (head == cached_write) {
+            cached_write = write_index.load(memory_order_acquire);
+            if (head == cached_write) return false;
+        }
+        value = move(slots[head & mask]);
+        read_index.store(head + 1, memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return read_index.load(memory_order_acquire) == write_index.load(memory_order_acquire);
+    }
+
+    size_t capacity() const { return mask + 1; }
+
+private:
+    static constexpr size_t CACHE_LINE = 64;
+
+    unique_ptr<T[]> slots;
+    size_t mask;
+
+    alignas(CACHE_LINE) atomic<size_t> write_index{0};
+    size_t cached_read{0};          // producer's view of read_index
+
+    alignas(CACHE_LINE) atomic<size_t> read_index{0};
+    size_t cached_write{0};         // consumer's view of write_index
+};
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "api.hpp"
+#include "async.hpp"
+#include "events.hpp"
+#include <cstddef>
+#include <functional>
+#include <string>
+
+using namespace std;
+
+// Strategy SDK. A strategy is a shared object built against these headers:
+//
+//   class Momentum : public Strategy { void on_ticker(const ticker_event& e) override; ... };
+//   DERIBIT_STRATEGY(Momentum)
+//
+//   g++ -std=c++17 -shared -fPIC -Iinclude momentum.cpp -o momentum.so
+//
+// Built with -std=c++20, a strategy can co_await context.async() requests.
+//
+// The host dlopen()s it, runs every callback on the strategy's own thread in
+// arrival order and times each one.
+
+#define DERIBIT_STRATEGY_ABI_VERSION 3
+
+// Orders go out on the owning account's connection; safe to call from any callback
+class StrategyContext {
+public:
+    virtual ~StrategyContext() = default;
+
+    // Request id of the order frame, -1 when the risk gate or the connection refused it
+    virtual long submit(const api::order_request& request) = 0;
+
+    virtual bool cancel(const string& order_id) = 0;
+
+    virtual bool cancel_all() = 0;
+
+    virtual size_t account() const = 0;
+
+    // Requests whose replies resume on this strategy's thread; strategies
+    // built as C++20 can co_await them from an async_task
+    virtual AsyncSession& async() = 0;
+
+    // Runs task on this strategy's thread, after the events already queued
+    virtual void post(function<void()> task) = 0;
+};
+
+class Strategy {
+public:
+    virtual ~Strategy() = default;
+
+    // The context outlives the strategy
+    virtual void on_start(StrategyContext& context) {}
+    virtual void on_stop() {}
+
+    virtual void on_book(const book_event& e) {}
+    virtual void on_trades(const trades_event& e) {}
+    virtual void on_ticker(const ticker_event& e) {}
+    virtual void on_order(const order_event& e) {}
+    virtual void on_fill(const trade_event& e) {}
+};
+
+extern "C" {
+    typedef Strategy* (*create_strategy_fn)();
+    typedef void (*destroy_strategy_fn)(Strategy*);
+    typedef int (*strategy_abi_fn)();
+}
+
+// Exports the entry points the host looks up
+#define DERIBIT_STRATEGY(type)                                                      \
+    extern "C" Strategy* deribit_create_strategy() { return new type(); }           \
+    extern "C" void deribit_destroy_strategy(Strategy* s) { delete s; }             \
+    extern "C" int deribit_strategy_abi() { return DERIBIT_STRATEGY_ABI_VERSION; }
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "json.hpp"
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+using json = nlohmann::json;
+
+enum class SubscriptionState : uint8_t {
+    INACTIVE,               // wanted locally, not subscribed on the exchange
+    PENDING_SUBSCRIBE,
+    ACTIVE,
+    PENDING_UNSUBSCRIBE
+};
+
+// How public channels are spread over parallel feed connections. Channels of
+// one instrument always share a connection; private channels stay on the
+// authenticated one (connection 0). In the split layout connection 0 only
+// carries order entry and private channels, and `connections` counts the
+// market-data connections besides it.
+enum class ShardPolicy : uint8_t {
+    HASH,           // by instrument name
+    CURRENCY,       // BTC, ETH, ... each on a fixed connection
+    KIND            // futures, options, spot and indexes apart
+};
+
+struct feed_sharding {
+    size_t connections{1};
+    ShardPolicy policy{ShardPolicy::HASH};
+    size_t copies{1};           // redundant connections per feed, arbitrated first-wins
+    bool split{false};          // public data never shares connection 0 with orders
+
+    // Connections carrying public channels besides connection 0
+    size_t feed_links() const { return split ? connections : connections - 1; }
+};
+
+// DERIBIT_FEED_CONNECTIONS, DERIBIT_FEED_SHARD_POLICY (hash|currency|kind), DERIBIT_FEED_COPIES
+// and DERIBIT_SESSION_LAYOUT (shared|split)
+feed_sharding feed_sharding_from_env();
+
+// Connection index for a channel, in [0, sharding.feed_links()]
+size_t feed_shard(string_view channel, const feed_sharding& sharding);
+
+// Tracks the channel set for a connection and produces only the
+// subscribe/unsubscribe deltas needed to bring the exchange in line with it
+class SubscriptionManager {
+public:
+    static constexpr size_t DEFAULT_CHUNK_SIZE = 200;
+
+    vector<string> subscribe(const vector<string>& channels);
+
+    vector<string> unsubscribe(const vector<string>& channels);
+
+    // Forgets every channel; returns true if any was live on the exchange
+    bool clear();
+
+    // Subscribe frames for every channel that is wanted but not live
+    vector<string> resubscribe();
+
+    // Called once the exchange has dropped every subscription (unsubscribe_all, reconnect)
+    void mark_all_inactive();
+
+    // Same for the public channels of one feed connection that dropped
+    void mark_inactive(size_t shard);
+
+    // Subscribe frames for the channels of one feed connection that are wanted but not live
+    vector<string> resubscribe(size_t shard);
+
+    // Returns true when the response belonged to a subscription request
+    bool on_response(const json& response);
+
+    vector<string> channels() const;
+
+    bool contains(const string& channel) const;
+
+    SubscriptionState state(const string& channel) const;
+
+    void set_chunk_size(size_t size);
+
+    // Frames are built per feed connection, so each one carries a single shard's channels
+    void set_sharding(const feed_sharding& config);
+
+    feed_sharding sharding() const;
+
+private:
+    struct pending_request {
+        bool subscribe;
+        vector<string> channels;
+    };
+
+    vector<string> build_frames(bool subscribe, const vector<string>& channels);
+
+    mutable mutex subscription_mutex;
+    unordered_map<string, SubscriptionState> channel_states;
+    unordered_map<long, pending_request> pending;
+    size_t chunk_size{DEFAULT_CHUNK_SIZE};
+    feed_sharding shards{feed_sharding_from_env()};
+};
+
+// Subscriptions live on a connection, so each account has its own set
+SubscriptionManager& getSubscriptionManager();
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+using namespace std;
+
+// What a timer is for; each kind has one handler, so a timer itself is just
+// a kind and a 64-bit key (request id, order slot, connection id)
+enum class TimerKind : uint8_t {
+    REQUEST_TIMEOUT,
+    ORDER_EXPIRY,
+    RECONCILE,
+    HEARTBEAT,
+    COUNT
+};
+
+// Generation in the high half, node index in the low half; 0 is never issued
+using timer_id = uint64_t;
+
+// Hashed timer wheel. Timers sit in the slot of their deadline tick, on
+// intrusive lists threaded through a preallocated node pool, so schedule
+// and cancel are O(1) and allocate nothing until the pool has to grow.
+// Thread-safe; handlers run on the thread calling advance(), outside the
+// lock, and may schedule or cancel.
+class TimerWheel {
+public:
+    using handler = function<void(uint64_t key)>;
+
+    explicit TimerWheel(chrono::milliseconds tick = chrono::milliseconds(10), size_t slots = 4096,
+                        size_t capacity = 65536);
+
+    void on(TimerKind kind, handler fn);
+
+    timer_id schedule(TimerKind kind, uint64_t key, chrono::milliseconds delay);
+
+    // False when the timer already fired or was cancelled
+    bool cancel(timer_id id);
+
+    // Fires every timer due by now, returning how many fired
+    size_t advance(chrono::steady_clock::time_point now);
+
+    size_t size() const;
+
+    chrono::milliseconds tick() const { return tick_length; }
+
+private:
+    static constexpr uint32_t NIL = UINT32_MAX;
+
+    struct node {
+        uint64_t key{0};
+        uint64_t deadline{0};       // in ticks
+        uint32_t prev{NIL};
+        uint32_t next{NIL};         // doubles as the free list link
+        uint32_t generation{1};
+        TimerKind kind{TimerKind::COUNT};
+        bool armed{false};
+    };
+
+    struct fired {
+        TimerKind kind;
+        uint64_t key;
+    };
+
+    uint64_t ticks_at(chrono::steady_clock::time_point now) const;
+    uint32_t acquire();
+    void release(uint32_t index);
+    void unlink(uint32_t index);
+
+    const chrono::milliseconds tick_length;
+    const chrono::steady_clock::time_point origin;
+    const uint64_t slot_mask;
+
+    mutable mutex wheel_mutex;
+    vector<node> nodes;
+    vector<uint32_t> heads;
+    uint32_t free_head{NIL};
+    uint64_t current{0};
+    size_t armed_count{0};
+
+    array<handler, static_cast<size_t>(TimerKind::COUNT)> handlers;
+    vector<fired> due;              // advance()'s scratch, reused between calls
+};
@@ -19,7 +19,13 @@ public:
         ORDER_PLACEMENT,
         MARKET_DATA_PROCESSING,
         WEBSOCKET_MESSAGE_PROPAGATION,
-        TRADING_LOOP_END_TO_END
+        TRADING_LOOP_END_TO_END,
+        RISK_CHECK,
+        THROTTLE_DELAY,
+        KILL_SWITCH,
+        FEED_LEAD,              // how far the winning copy of a market data update led the other
+        STRATEGY_CALLBACK,      // time spent inside a plugin strategy's callback
+        LATENCY_TYPE_COUNT
     };
 
     struct LatencyMetric {
@@ -33,6 +39,14 @@ public:
 
     void stop_measurement(LatencyType type, const string& unique_id = "");
 
+    // Records a duration timed by the caller, for paths too short to pay for start/stop
+    void record(LatencyType type, chrono::nanoseconds duration);
+
+    // Counts occurrences of non-timed events such as throttled requests
+    void count_event(const string& event, size_t count = 1);
+
+    map<string, size_t> get_event_counts();
+
     string generate_report();
 
     map<LatencyType, vector<LatencyMetric>> get_raw_metrics();
@@ -40,10 +54,13 @@ public:
     void reset();
 
 private:
-    
+    static constexpr size_t MAX_SAMPLES = 1 << 14;
+
     mutex metrics_mutex;
     map<LatencyType, vector<LatencyMetric>> latency_metrics;
+    size_t sample_cursor[LATENCY_TYPE_COUNT] = {};
     map<string, LatencyMetric> active_measurements;
+    map<string, size_t> event_counts;
 };
 
 
@@ -12,6 +12,8 @@
 
 namespace utils {
     long long time_now();
+    // Not NaN or infinite; unlike std::isfinite it survives -ffast-math
+    bool is_finite(double value);
     std::string gen_random(const int len);
     std::string get_signature(long long timestamp, std::string nonce, 
                             std::string data, std::string clientsecret);
@@ -4,10 +4,13 @@
 #include <map>
 #include <string>
 #include <mutex>
+#include <shared_mutex>
 #include <condition_variable>
 #include <vector>
 #include <thread>
 #include <memory>
+#include <atomic>
+#include <chrono>
 
 #include <websocketpp/config/asio_client.hpp> 
 #include <boost/asio.hpp>
@@ -17,11 +20,27 @@
 
 #include <nlohmann/json.hpp>
 
+#include "flat_map.hpp"
+#include "ratelimit.hpp"
+#include "pipeline.hpp"
+#include "router.hpp"
+#include "shards.hpp"
+#include "subscriptions.hpp"
+#include "timer_wheel.hpp"
+
 typedef websocketpp::client<websocketpp::config::asio_tls_client> client;
 typedef std::shared_ptr<boost::asio::ssl::context> context_ptr;
 
 class websocket_endpoint;
 
+// PRIMARY endpoints trade and open the feeds; FEED endpoints carry a share of
+// the public channels; MIRROR endpoints carry a redundant copy of either
+enum class FeedRole : uint8_t {
+    PRIMARY,
+    FEED,
+    MIRROR
+};
+
 class connection_metadata {
 private:
     int m_id;
@@ -32,6 +51,10 @@ private:
     std::string m_error_reason;
     std::vector<std::string> m_summaries;
     websocket_endpoint* m_endpoint;
+    RateLimiter m_limiter;
+    bool m_order_entry{false};
+    // Only the count of sent frames is shown, so they are not kept
+    std::atomic<size_t> m_sent_count{0};
 
 public:
     typedef websocketpp::lib::shared_ptr<connection_metadata> ptr;
@@ -46,6 +69,11 @@ public:
     int get_id();
     websocketpp::connection_hdl get_hdl();
     std::string get_status();
+    RateLimiter& limiter() { return m_limiter; }
+
+    // Extra authenticated connections that only carry orders
+    void set_order_entry() { m_order_entry = true; }
+    bool order_entry() const { return m_order_entry; }
     void record_sent_message(std::string const &message);
     void record_summary(std::string const &message, std::string const &sent);
 
@@ -54,6 +82,10 @@ public:
     void on_close(client * c, websocketpp::connection_hdl hdl);
     void on_message(websocketpp::connection_hdl hdl, client::message_ptr msg);
 
+    static bool decode_frame(const std::string& payload, nlohmann::json& received_json);
+    void process_message(nlohmann::json& received_json, const std::string& payload, bool text,
+                         std::chrono::steady_clock::time_point received_at);
+
     friend std::ostream &operator<< (std::ostream &out, connection_metadata const &data);
 };
 
@@ -65,24 +97,211 @@ private:
 
     client m_endpoint;
     websocketpp::lib::shared_ptr<websocketpp::lib::thread> m_thread;
+    size_t m_account;
 
+    // connect() adds connections from the main thread while the io and logic
+    // threads look them up
     con_list m_connection_list;
+    mutable std::shared_mutex m_connection_mutex;
     int m_next_id;
 
     std::mutex message_mutex;
     std::map<int, std::vector<std::string>> connection_messages;
 
+    // Request timeouts, client-side order expiry, reconciliation and
+    // heartbeat deadlines, advanced every tick on the io thread
+    TimerWheel m_timers;
+    std::unique_ptr<boost::asio::steady_timer> m_wheel_timer;
+    std::atomic<timer_id> m_reconcile_timer{0};
+    std::atomic<int> m_reconcile_connection{-1};
+    std::chrono::seconds m_reconcile_interval;
+    std::chrono::milliseconds m_request_timeout;
+    std::chrono::seconds m_heartbeat_interval;
+    std::mutex m_timer_mutex;
+    struct request_timer {
+        timer_id timer{0};
+        int connection_id{-1};
+    };
+    open_hash_map<long, request_timer> m_request_timers{1024};
+    std::map<int, timer_id> m_heartbeat_timers;
+
+    struct drain_timer {
+        std::unique_ptr<boost::asio::steady_timer> timer;
+        bool armed{false};
+    };
+    std::mutex m_drain_mutex;
+    std::map<int, drain_timer> m_drain_timers;
+
+    std::mutex m_refresh_mutex;
+    std::unique_ptr<boost::asio::steady_timer> m_refresh_timer;
+
+    std::mutex m_kill_mutex;
+    std::map<int, std::string> m_kill_frames;
+    // Latched by the kill switch; order frames hold the gate shared while they
+    // go out, so none can slip onto the wire after the latch
+    std::shared_mutex m_kill_gate;
+    std::atomic<bool> m_killed{false};
+    std::unique_ptr<boost::asio::signal_set> m_kill_signals;
+
+    // Connections stay in m_connection_list for the endpoint's lifetime, so
+    // frames can carry a plain pointer to theirs
+    struct inbound_frame {
+        connection_metadata* connection{nullptr};
+        std::string payload;
+        bool text{true};
+        std::chrono::steady_clock::time_point received_at;
+    };
+
+    struct decoded_frame {
+        connection_metadata* connection{nullptr};
+        nlohmann::json message;
+        std::string payload;
+        bool text{true};
+        std::chrono::steady_clock::time_point received_at;
+    };
+
+    static constexpr size_t STAGE_QUEUE_CAPACITY = 4096;
+
+    stage_queue<inbound_frame> m_decode_queue{STAGE_QUEUE_CAPACITY};
+    stage_queue<decoded_frame> m_logic_queue{STAGE_QUEUE_CAPACITY};
+    std::atomic<bool> m_pipeline_running{true};
+    std::thread m_decode_thread;
+    std::thread m_logic_thread;
+
+    // Extra connections (each with its own io thread) that carry a share of
+    // the public channels, or a copy of them; their notifications reach the
+    // same dispatcher
+    struct feed_link {
+        std::unique_ptr<websocket_endpoint> endpoint;
+        int connection_id{-1};
+    };
+    FeedRole m_feed_role;
+    std::string m_feed_name;
+    // Set by open_mirrors() once connect() has started the threads reading it
+    std::atomic<size_t> m_arbiter_source;
+    feed_sharding m_feed_sharding;
+    std::mutex m_feed_mutex;
+    std::vector<feed_link> m_feeds;
+    std::vector<feed_link> m_mirrors;
+
+    // A feed endpoint reopens its connection with backoff when it drops and
+    // resubscribes its shard's channels once the new one is up
+    size_t m_feed_shard{0};
+    std::string m_feed_uri;
+    std::atomic<int> m_feed_connection{-1};
+    std::atomic<bool> m_closing{false};
+    unsigned m_reconnect_attempts{0};
+    std::unique_ptr<boost::asio::steady_timer> m_reconnect_timer;
+    void schedule_reconnect();
+
+    // Order-entry connections besides the first (DERIBIT_ORDER_CONNECTIONS
+    // in total); the router spreads matching-engine requests over them
+    OrderRouter m_router;
+    std::mutex m_order_mutex;
+    std::vector<int> m_order_connections;
+
+    void open_order_connections(std::string const &uri);
+    int route_order(int id);
+    int pinned_connection(std::string const &message);
+
+    void open_feeds(std::string const &uri);
+    void open_mirrors(std::string const &uri, size_t copies);
+    bool route_feed(std::string const &message, int& result);
+    void mirror_feed(std::string const &message);
+
+    void run_decode_stage(stage_config config);
+    void run_logic_stage(stage_config config);
+
+    void wait_for_kill_signal();
+
+    void register_timers();
+    void schedule_wheel_tick();
+    void on_request_timeout(long request_id);
+    void schedule_drain(int id);
+    bool congested(connection_metadata::ptr metadata);
+    int transmit(connection_metadata::ptr metadata, std::string const &message);
+
 public:
-    websocket_endpoint();
+    // Every callback runs on this endpoint's own io thread, bound to account
+    explicit websocket_endpoint(size_t account = 0, FeedRole role = FeedRole::PRIMARY,
+                                std::string feed_name = "feed0");
     ~websocket_endpoint();
 
+    size_t account() const { return m_account; }
+
+    OrderRouter& router() { return m_router; }
+
+    // Signs in the extra order-entry connections once the first is logged in
+    void authenticate_order_connections();
+
+    // Connections carrying public channels: the feeds, plus this endpoint's first unless split
+    size_t feed_count();
+
+    bool is_mirror() const { return m_feed_role == FeedRole::MIRROR; }
+
+    // The connection a feed endpoint currently carries its shard on
+    int feed_connection() const { return m_feed_connection; }
+
+    // Open and close of a connection, on the io thread
+    void on_feed_open(int id);
+    void on_feed_lost(int id);
+
+    // False when a redundant copy of this update already won arbitration
+    bool arbitrate(std::string_view channel, nlohmann::json const &data,
+                   std::chrono::steady_clock::time_point received_at);
+
+    // Called on the io thread; never blocks
+    void enqueue_frame(connection_metadata* connection, std::string payload, bool text,
+                       std::chrono::steady_clock::time_point received_at);
+
     int connect(std::string const &uri);
     void close(int id, websocketpp::close::status::value code, std::string reason);
-    int send(int id, std::string message);
+    int send(int id, std::string const &message);
     connection_metadata::ptr get_metadata(int id) const;
 
     int streamSubscriptions(const std::vector<std::string>& connections);
 
+    // Reconciles the local order book against the exchange now and then
+    // periodically; restarting replaces the previous schedule
+    void start_reconciliation(int id);
+
+    // Refreshes the session token shortly before it expires, or after delay
+    void schedule_token_refresh(int id, std::chrono::milliseconds delay = std::chrono::milliseconds(0));
+
+    TimerWheel& timers() { return m_timers; }
+
+    // Cancels the order of request_id on connection_id if it is still live after `after`
+    void expire_order(long request_id, int connection_id, std::chrono::milliseconds after);
+
+    // Starts the timeout of a request as it is admitted on connection_id, before any throttling
+    void arm_request_timeout(long request_id, int connection_id);
+
+    // Clears the timeout of an answered request
+    void request_answered(long request_id);
+
+    // Asks the exchange for heartbeats (DERIBIT_HEARTBEAT_SECONDS, 0 disables) and
+    // watches for them
+    void start_heartbeat(int id);
+
+    void on_heartbeat(int id, bool test_request);
+
+    // Pre-encodes a cancel_all frame for an authenticated connection
+    void arm_kill_switch(int id);
+
+    // Latches order entry off, drops queued orders and amends (rejecting them
+    // in the OMS), then sends every armed cancel_all ahead of all queued
+    // traffic. Also fired by SIGUSR1. Returns frames sent.
+    int kill_switch();
+
+    bool killed() const { return m_killed.load(); }
+
+    // Lifts the kill switch latch
+    void resume_trading();
+
+    // Marks an order request that will never reach the exchange as rejected and
+    // answers anyone awaiting it
+    void reject_request(long request_id, const std::string& reason);
+
 
     std::vector<std::string> get_messages(int connection_id) {
         std::vector<std::string> messages;
@@ -701,13 +701,23 @@
 #include "util.hpp"
 #include "json.hpp"
 #include "auth.hpp"
-
+#include "instruments.hpp"
+#include "subscriptions.hpp"
+#include "oms.hpp"
+#include "pool.hpp"
+#include "portfolio.hpp"
+#include "risk.hpp"
+
+#include <cctype>
+#include <chrono>
+#include <cmath>
+#include <iterator>
 #include <iostream>
 #include <string>
-#include <sstream>
+#include <string_view>
+#include <array>
+#include <cstdint>
 #include <vector>
-#include <functional>
-#include <regex>
 #include <set>
 #include <fmt/color.h>
 
@@ -718,44 +728,92 @@
 using namespace std;
 
 // Global variables defined in header
-bool AUTH_SENT = false;
 vector<string> SUPPORTED_CURRENCIES = {"BTC", "ETH", "SOL", "XRP", "MATIC",
                                      "USDC", "USDT", "JPY", "CAD", "AUD", "GBP", 
                                      "EUR", "USD", "CHF", "BRL", "MXN", "COP", 
                                      "CLP", "PEN", "ECS", "ARS"};
-vector<string> subscriptions;
 
 // Subscription management functions
 vector<string> api::getSubscription() {
-    return subscriptions;
+    return getSubscriptionManager().channels();
 }
 
-void api::addSubscriptions(const string &index_name) {
-    string subscription = "deribit_price_index." + index_name;
-    if (find(subscriptions.begin(), subscriptions.end(), subscription) == subscriptions.end()) {
-        subscriptions.push_back(subscription);
+// Validation functions
+namespace {
+    size_t take_while(string_view s, size_t pos, int (*pred)(int)) {
+        while (pos < s.size() && pred(static_cast<unsigned char>(s[pos]))) ++pos;
+        return pos;
     }
-}
 
-bool api::removeSubscriptions(const string &index_name) {
-    string subscription_to_remove = "deribit_price_index." + index_name;
-    auto it = find(subscriptions.begin(), subscriptions.end(), subscription_to_remove);
-    if (it != subscriptions.end()) {
-        subscriptions.erase(it);
-        return true;
+    // Structural check used until the registry has been loaded. Accepts
+    // BTC-PERPETUAL, BTC_USDC-PERPETUAL, BTC-27DEC24, BTC-27DEC24-100000-C,
+    // XRP_USDC-7MAR25-0d625-P and spot pairs such as BTC_USDC.
+    bool looks_like_instrument(string_view s) {
+        size_t pos = take_while(s, 0, isupper);
+        if (pos < 2) return false;
+        if (pos < s.size() && s[pos] == '_') {
+            size_t quote = take_while(s, pos + 1, isupper);
+            if (quote == pos + 1) return false;
+            pos = quote;
+            if (pos == s.size()) return true;
+        }
+        if (pos == s.size() || s[pos] != '-') return false;
+
+        string_view rest = s.substr(pos + 1);
+        if (rest == "PERPETUAL") return true;
+
+        size_t day = take_while(rest, 0, isdigit);
+        size_t month = take_while(rest, day, isupper);
+        size_t year = take_while(rest, month, isdigit);
+        if (day < 1 || day > 2 || month - day != 3 || year - month != 2) return false;
+        if (year == rest.size()) return true;
+
+        string_view strike = rest.substr(year);
+        if (strike.size() < 4 || strike[0] != '-') return false;
+        char type = strike.back();
+        if ((type != 'C' && type != 'P') || strike[strike.size() - 2] != '-') return false;
+        strike = strike.substr(1, strike.size() - 3);
+        for (char c : strike) {
+            if (!isdigit(static_cast<unsigned char>(c)) && c != 'd') return false;
+        }
+        return !strike.empty();
     }
-    return false;
 }
 
-// Validation functions
 bool api::is_valid_instrument(const string& instrument) {
-    regex instrument_pattern(R"(^[A-Z]{3,4}(-)(PERPETUAL|[0-9]{2}[A-Z]{3}[0-9]{2})$)");
-    return regex_match(instrument, instrument_pattern);
+    InstrumentRegistry& registry = getInstrumentRegistry();
+    if (registry.loaded()) {
+        return registry.is_listed(instrument);
+    }
+    return looks_like_instrument(instrument);
 }
 
-// Command processing
-string api::process(const string &input) {
-    map<string, function<string(string)>> action_map = {
+string_view api::tokenizer::next() {
+    size_t begin = rest.find_first_not_of(" \t\n");
+    if (begin == string_view::npos) {
+        rest = {};
+        return {};
+    }
+    size_t end = rest.find_first_of(" \t\n", begin);
+    string_view token = rest.substr(begin, end == string_view::npos ? string_view::npos : end - begin);
+    rest = end == string_view::npos ? string_view{} : rest.substr(end);
+    return token;
+}
+
+void api::tokenizer::skip(size_t count) {
+    while (count-- > 0) next();
+}
+
+// Command dispatch: a perfect hash over the command names, resolved at compile time
+namespace {
+    using handler = string (*)(string_view);
+
+    struct command {
+        string_view name;
+        handler fn;
+    };
+
+    constexpr command commands[] = {
         {"authorize", api::authorize},
         {"sell", api::sell},
         {"buy", api::buy},
@@ -767,122 +825,179 @@ string api::process(const string &input) {
         {"orderbook", api::get_orderbook},
         {"subscribe", api::subscribe},
         {"unsubscribe", api::unsubscribe},
-        {"unsubscribe_all", api::unsubscribe_all}
+        {"unsubscribe_all", api::unsubscribe_all},
+        {"instruments", api::get_instruments},
+        {"status", api::order_status}
     };
 
-    istringstream s(input.substr(8));
-    int id;
-    string cmd;
-    s >> id >> cmd;
+    constexpr size_t num_commands = sizeof(commands) / sizeof(commands[0]);
+    constexpr size_t table_size = 32;
+    static_assert((table_size & (table_size - 1)) == 0, "table size must be a power of two");
+    static_assert(num_commands <= table_size, "dispatch table too small");
 
-    auto find = action_map.find(cmd);
-    if (find == action_map.end()) {
-        utils::printerr("ERROR: Unrecognized command. Please enter 'help' to see available commands.\n");
-        return "";
+    constexpr uint32_t hash_command(string_view name, uint32_t seed) {
+        uint32_t h = 2166136261u ^ seed;
+        for (char c : name) {
+            h ^= static_cast<unsigned char>(c);
+            h *= 16777619u;
+        }
+        return h ^ (h >> 15);
+    }
+
+    constexpr bool is_perfect(uint32_t seed) {
+        bool used[table_size] = {};
+        for (const auto& cmd : commands) {
+            size_t slot = hash_command(cmd.name, seed) & (table_size - 1);
+            if (used[slot]) return false;
+            used[slot] = true;
+        }
+        return true;
+    }
+
+    constexpr uint32_t find_seed() {
+        uint32_t seed = 0;
+        while (!is_perfect(seed)) ++seed;
+        return seed;
+    }
+
+    constexpr uint32_t command_seed = find_seed();
+
+    constexpr array<int8_t, table_size> build_table() {
+        array<int8_t, table_size> table{};
+        for (auto& slot : table) slot = -1;
+        for (size_t i = 0; i < num_commands; ++i) {
+            table[hash_command(commands[i].name, command_seed) & (table_size - 1)] = static_cast<int8_t>(i);
+        }
+        return table;
+    }
+
+    constexpr array<int8_t, table_size> command_table = build_table();
+
+    handler find_command(string_view name) {
+        int8_t index = command_table[hash_command(name, command_seed) & (table_size - 1)];
+        if (index < 0 || commands[index].name != name) return nullptr;
+        return commands[index].fn;
     }
-    return find->second(input.substr(8));
 }
 
-// Market data streaming
-string api::stream_market_data(const string& input) {
-    if (subscriptions.empty()) {
-        fmt::print(fg(fmt::color::red) | fmt::emphasis::bold,
-            "> No active subscriptions. Please subscribe to symbols first.\n");
+// Command processing
+string api::process(const string &input) {
+    string_view args(input);
+    if (args.size() < 8) {
+        utils::printerr("ERROR: Unrecognized command. Please enter 'help' to see available commands.\n");
         return "";
     }
+    args.remove_prefix(8);
 
-    jsonrpc j;
-    j["method"] = "public/subscribe";
-    j["params"] = {
-        {"channels", subscriptions}
-    };
-    
-    return j.dump();
+    tokenizer t(args);
+    t.next();
+    handler fn = find_command(t.next());
+    if (fn == nullptr) {
+        utils::printerr("ERROR: Unrecognized command. Please enter 'help' to see available commands.\n");
+        return "";
+    }
+    return fn(args);
 }
 
 // Subscription commands
-string api::subscribe(const string &input) {
-    istringstream is(input);
-    int id;
-    string cmd;
-    string index_name;
 
-    is >> id >> cmd >> index_name;
+// Accepts a full channel (ticker.BTC-PERPETUAL.100ms) or a bare price index name (btc_usd)
+static string to_channel(string_view name) {
+    if (name.find('.') != string_view::npos) return string(name);
+    return "deribit_price_index." + string(name);
+}
 
-    addSubscriptions(index_name);
-    
-    jsonrpc j;
-    j["method"] = "public/subscribe";
-    j["params"] = {
-        {"channels", subscriptions}
-    };
+string api::subscribe(string_view input) {
+    tokenizer t(input);
+    t.skip(2);
+    string index_name(t.next());
+    if (index_name.empty()) {
+        utils::printerr("> Error: Channel or index name is required\n");
+        return "";
+    }
+
+    vector<string> frames = getSubscriptionManager().subscribe({to_channel(index_name)});
+    if (frames.empty()) {
+        fmt::print(fmt::fg(fmt::color::yellow) | fmt::emphasis::bold,
+            "> Already subscribed to {}\n", index_name);
+        return "";
+    }
 
     fmt::print(fmt::fg(fmt::color::green) | fmt::emphasis::bold,
            "> Subscribed to {}\n", index_name);
            
-    return j.dump();
+    return frames.front();
 }
 
-string api::unsubscribe(const string &input) {
-    istringstream is(input);
-    int id;
-    string cmd;
-    string index_name;
+string api::unsubscribe(string_view input) {
+    tokenizer t(input);
+    t.skip(2);
+    string index_name(t.next());
+    string channel = to_channel(index_name);
 
-    is >> id >> cmd >> index_name;
-
-    if(!removeSubscriptions(index_name)) {
+    SubscriptionManager& manager = getSubscriptionManager();
+    if (!manager.contains(channel)) {
         fmt::print(fmt::fg(fmt::color::red) | fmt::emphasis::bold,
            "> Error: Incorrect index name or not subscribed to the specified index.\n");
-    } else {
-        fmt::print(fmt::fg(fmt::color::yellow) | fmt::emphasis::bold,
-            "> Unsubscribed from {}\n", index_name);
+        return "";
     }
-    return "";
+
+    vector<string> frames = manager.unsubscribe({channel});
+    fmt::print(fmt::fg(fmt::color::yellow) | fmt::emphasis::bold,
+        "> Unsubscribed from {}\n", index_name);
+    return frames.empty() ? "" : frames.front();
 }
 
-string api::unsubscribe_all(const string &input) {
-    subscriptions.clear();
+string api::unsubscribe_all(string_view input) {
+    bool live = getSubscriptionManager().clear();
     fmt::print(fmt::fg(fmt::color::yellow) | fmt::emphasis::bold,
         "> Unsubscribed from all symbols\n");
-    return "";
+    if (!live) return "";
+
+    jsonrpc j("public/unsubscribe_all");
+    j["params"] = json::object();
+    return j.dump();
 }
 
-string api::authorize(const string &input) {
-    istringstream s(input);
-    string auth;
-    string id;
-    string flag{""};
-    string client_id;
-    string client_secret;
-    long long tm = utils::time_now();
+string api::authorize(string_view input) {
+    tokenizer t(input);
+    t.skip(2);
+    string client_id(t.next());
+    string client_secret(t.next());
+    if (client_id.empty() || client_secret.empty()) {
+        utils::printerr("> Usage: authorize <client_id> <client_secret>\n");
+        return "";
+    }
 
-    s >> id >> auth >> client_id >> client_secret >> flag;
-    string nonce = utils::gen_random(10);
+    // client_signature: only an HMAC of the secret goes over the wire
+    Password& credentials = Password::password();
+    credentials.setCredentials(client_id, client_secret);
+    return credentials.authRequest("session:name");
+}
+// Contracts are converted to the amount the exchange and the risk limits use
+static double order_amount(const string& instrument, double amount, int contracts) {
+    if (amount > 0) return amount;
+    optional<instrument_info> info = getInstrumentRegistry().get(getInstrumentRegistry().find(instrument));
+    return contracts * (info && info->contract_size > 0 ? info->contract_size : 1.0);
+}
 
-    jsonrpc j;
-    j["method"] = "public/auth";
-    j["params"] = {
-        {"grant_type", "client_credentials"},  // Using simple client credentials auth
-        {"client_id", client_id},
-        {"client_secret", client_secret},
-        {"timestamp", tm},
-        {"nonce", nonce},
-        {"scope", "session:name"}
-    };
+// Runs the pre-trade risk gate; false means the order must not be sent
+static bool passes_risk(const string& instrument, bool buy, double amount, double price, bool new_order = true) {
+    risk_order order{getInstrumentRegistry().intern(instrument), buy, amount, price, new_order};
 
-    // Set AUTH_SENT flag if -s flag is provided and request is valid
-    if (flag == "-s" && j.dump() != "") {
-        AUTH_SENT = true;
-    }
+    auto start = chrono::steady_clock::now();
+    uint8_t violations = getRiskGate().check(order);
+    getLatencyTracker().record(LatencyTracker::RISK_CHECK,
+        chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start));
 
-    return j.dump();
+    if (violations != RISK_OK) {
+        utils::printerr("> Order rejected by risk gate: " + describe_violations(violations) + "\n");
+        return false;
+    }
+    return true;
 }
-string api::sell(const string &input) {
-    string sell;
-    string id;
-    string instrument;
-    string cmd;
+
+string api::sell(string_view input) {
     string access_key;
     string order_type;
     string label;
@@ -890,16 +1005,19 @@ string api::sell(const string &input) {
     int contracts{0};
     double amount{0.0};
 
-    istringstream s(input);
-    s >> id >> sell >> instrument >> label;
+    tokenizer t(input);
+    t.skip(2);
+    string instrument(t.next());
+    label = t.next();
 
-    if (Password::password().getAccessToken() == "") {
-        utils::printcmd("Enter the access token: ");
-        cin >> access_key;
-    } else {
-        access_key = Password::password().getAccessToken();
+    if (!is_valid_instrument(instrument)) {
+        utils::printerr("\nUnknown instrument: " + instrument + "\n");
+        return "";
     }
 
+    // The connection is already authenticated; the token is only passed along when we hold one
+    access_key = Password::password().getAccessToken();
+
     utils::printcmd("\nEnter 1 for contracts or 2 for amount: ");
     int choice;
     cin >> choice;
@@ -973,10 +1091,10 @@ string api::sell(const string &input) {
     getLatencyTracker().start_measurement(LatencyTracker::ORDER_PLACEMENT);
 
     jsonrpc j("private/sell");
-    j["params"] = {
-        {"instrument_name", instrument},
-        {"access_token", access_key}
-    };
+    j["params"] = {{"instrument_name", instrument}};
+    if (!access_key.empty()) {
+        j["params"]["access_token"] = access_key;
+    }
 
     if (choice == 2 && amount > 0) { 
         j["params"]["amount"] = amount;
@@ -995,16 +1113,21 @@ string api::sell(const string &input) {
     j["params"]["label"] = label;
     j["params"]["time_in_force"] = frc;
 
+    double quantity = order_amount(instrument, choice == 2 ? amount : 0.0, contracts);
+    if (!passes_risk(instrument, false, quantity, price)) {
+        getLatencyTracker().stop_measurement(LatencyTracker::ORDER_PLACEMENT);
+        return "";
+    }
+
+    getOrderManager().on_order_sent(j["id"].get<long>(), instrument, label, false,
+                                    quantity, price, order_type);
+
     getLatencyTracker().stop_measurement(LatencyTracker::ORDER_PLACEMENT);
 
     return j.dump();
 }
 
-string api::buy(const string &input) {
-    string buy;
-    string id;
-    string instrument;
-    string cmd;
+string api::buy(string_view input) {
     string access_key;
     string order_type;
     string label;
@@ -1012,17 +1135,19 @@ string api::buy(const string &input) {
     int contracts{0};
     double amount{0.0};
 
-    istringstream s(input);
-    s >> id >> buy >> instrument >> label;
+    tokenizer t(input);
+    t.skip(2);
+    string instrument(t.next());
+    label = t.next();
 
-    if (Password::password().getAccessToken() == "") {
-        utils::printcmd("Enter the access token: ");
-        cin >> access_key;
-    }
-    else {
-        access_key = Password::password().getAccessToken();
+    if (!is_valid_instrument(instrument)) {
+        utils::printerr("\nUnknown instrument: " + instrument + "\n");
+        return "";
     }
 
+    // The connection is already authenticated; the token is only passed along when we hold one
+    access_key = Password::password().getAccessToken();
+
     utils::printcmd("\nEnter 1 for contracts or 2 for amount: ");
     int choice;
     cin >> choice;
@@ -1112,8 +1237,10 @@ string api::buy(const string &input) {
 
     jsonrpc j("private/buy");
 
-    j["params"] = {{"instrument_name", instrument},
-                   {"access_token", access_key}};
+    j["params"] = {{"instrument_name", instrument}};
+    if (!access_key.empty()) {
+        j["params"]["access_token"] = access_key;
+    }
 
     // Explicitly choose either amount or contracts based on choice
     if (choice == 2 && amount > 0) { 
@@ -1135,23 +1262,120 @@ string api::buy(const string &input) {
     j["params"]["label"] = label;
     j["params"]["time_in_force"] = frc;
 
+    double quantity = order_amount(instrument, choice == 2 ? amount : 0.0, contracts);
+    if (!passes_risk(instrument, true, quantity, price)) {
+        getLatencyTracker().stop_measurement(LatencyTracker::ORDER_PLACEMENT);
+        return "";
+    }
+
+    getOrderManager().on_order_sent(j["id"].get<long>(), instrument, label, true,
+                                    quantity, price, order_type);
+
     getLatencyTracker().stop_measurement(LatencyTracker::ORDER_PLACEMENT);
 
     return j.dump();
 }
 
-string api::modify(const string &input) {
-    istringstream is(input);
-    int id;
-    string cmd;
-    string ord_id;
-    
-    is >> id >> cmd >> ord_id;
+// Appends s as a JSON string literal
+static void append_json_string(string& out, string_view s) {
+    out += '"';
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            fmt::format_to(back_inserter(out), "\\u{:04x}", static_cast<unsigned>(c));
+        } else {
+            out += c;
+        }
+    }
+    out += '"';
+}
+
+string api::place_order(const order_request& request) {
+    thread_local string frame = [] {
+        string s;
+        s.reserve(512);
+        return s;
+    }();
+    return place_order(request, frame) ? frame : "";
+}
+
+bool api::place_order(const order_request& request, string& frame) {
+    alloc_probe probe(HotPath::ORDER_ENTRY);
+    frame.clear();
+    if (!is_valid_instrument(request.instrument) || !utils::is_finite(request.amount) || request.amount <= 0 ||
+        !utils::is_finite(request.price)) {
+        utils::printerr("> Invalid order for " + request.instrument + "\n");
+        return false;
+    }
+
+    auto start = chrono::steady_clock::now();
+    bool market = request.type.find("market") != string::npos;
+    double price = market ? 0.0 : request.price;
+    if (!passes_risk(request.instrument, request.buy, request.amount, price)) return false;
+
+    // Written straight into the caller's buffer rather than through a json tree,
+    // in the same key order json::dump() produces
+    long request_id = next_request_id();
+    fmt::format_to(back_inserter(frame), "{{\"id\":{},\"jsonrpc\":\"2.0\",\"method\":\"private/{}\",\"params\":{{"
+                   "\"amount\":{},\"instrument_name\":", request_id, request.buy ? "buy" : "sell", request.amount);
+    append_json_string(frame, request.instrument);
+    if (!request.label.empty()) {
+        frame += ",\"label\":";
+        append_json_string(frame, request.label);
+    }
+    if (price > 0) fmt::format_to(back_inserter(frame), ",\"price\":{}", price);
+    frame += ",\"time_in_force\":";
+    append_json_string(frame, request.time_in_force);
+    frame += ",\"type\":";
+    append_json_string(frame, request.type);
+    frame += "}}";
+
+    getOrderManager().on_order_sent(request_id, request.instrument, request.label, request.buy,
+                                    request.amount, price, request.type);
+    getLatencyTracker().record(LatencyTracker::ORDER_PLACEMENT,
+        chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start));
+    return true;
+}
+
+// Rejects cancel/modify requests for orders the local OMS knows are already done
+static bool check_order_live(const string& ord_id) {
+    optional<order> known = getOrderManager().find(ord_id);
+    if (known && !known->is_live()) {
+        utils::printerr("> Order " + ord_id + " is already " + to_string(known->state) + "\n");
+        return false;
+    }
+    return true;
+}
+
+string api::amend_order(const string& order_id, double amount, double price) {
+    if (order_id.empty() || !check_order_live(order_id)) return "";
+
+    if (optional<order> known = getOrderManager().find(order_id)) {
+        if (!passes_risk(known->instrument_name, known->buy, amount > 0 ? amount : known->amount,
+                         price > 0 ? price : known->price, false)) {
+            return "";
+        }
+    }
+
+    jsonrpc j("private/edit");
+    j["params"] = {{"order_id", order_id}};
+    if (amount > 0) j["params"]["amount"] = amount;
+    if (price > 0) j["params"]["price"] = price;
+    return j.dump();
+}
+
+string api::modify(string_view input) {
+    tokenizer t(input);
+    t.skip(2);
+    string ord_id(t.next());
 
     if (ord_id.empty()) {
         utils::printerr("Error: Order ID is required\n");
         return "";
     }
+    if (!check_order_live(ord_id)) return "";
 
     jsonrpc j("private/edit");
     double amount = -1.0;
@@ -1170,18 +1394,24 @@ string api::modify(const string &input) {
     if (amount > 0) j["params"]["amount"] = amount;
     if (price > 0) j["params"]["price"] = price;
 
+    // Edits of orders the OMS knows are gated on their new size and price
+    if (optional<order> known = getOrderManager().find(ord_id)) {
+        if (!passes_risk(known->instrument_name, known->buy, amount > 0 ? amount : known->amount,
+                         price > 0 ? price : known->price, false)) {
+            getLatencyTracker().stop_measurement(LatencyTracker::ORDER_PLACEMENT);
+            return "";
+        }
+    }
+
     getLatencyTracker().stop_measurement(LatencyTracker::ORDER_PLACEMENT);
 
     return j.dump();
 }
 
-string api::cancel(const string &input) {
-    istringstream iss(input);
-    int id;
-    string cmd;
-    string ord_id;
-
-    iss >> id >> cmd >> ord_id;
+string api::cancel(string_view input) {
+    tokenizer t(input);
+    t.skip(2);
+    string ord_id(t.next());
     if (ord_id.empty()) { 
         fmt::print(fmt::fg(fmt::color::red) | fmt::emphasis::bold,
                 "> Order ID cannot be blank.\n");
@@ -1189,6 +1419,7 @@ string api::cancel(const string &input) {
                 "> If you want to cancel all orders, use cancel_all instead.\n");
         return "";
     }
+    if (!check_order_live(ord_id)) return "";
 
     getLatencyTracker().start_measurement(LatencyTracker::ORDER_PLACEMENT);
 
@@ -1200,19 +1431,17 @@ string api::cancel(const string &input) {
     return j.dump();
 }
 
-string api::cancel_all(const string &input) {
-    istringstream iss(input);
-    int id;
-    string cmd;
-    string option;
-    string label;
+string api::cancel_all(string_view input) {
+    tokenizer t(input);
+    t.skip(2);
+    string option(t.next());
+    string label(t.next());
 
     getLatencyTracker().start_measurement(LatencyTracker::ORDER_PLACEMENT);
 
     jsonrpc j;
     j["params"] = {};
 
-    iss >> id >> cmd >> option >> label;
     if (option.empty()) { 
         j["method"] = "private/cancel_all";
     }
@@ -1232,17 +1461,48 @@ string api::cancel_all(const string &input) {
     getLatencyTracker().stop_measurement(LatencyTracker::ORDER_PLACEMENT);
     return j.dump();
 }
-string api::get_open_orders(const string &input) {
+static void print_orders(const vector<order>& orders) {
+    for (const auto& o : orders) {
+        fmt::print(fmt::fg(fmt::color::green),
+            "> {} {} {} {} {}/{} @ {} [{}]{}\n",
+            o.order_id.empty() ? "(pending)" : o.order_id, o.instrument_name,
+            o.buy ? "buy" : "sell", o.order_type, o.filled_amount, o.amount, o.price,
+            to_string(o.state), o.reject_reason.empty() ? "" : " " + o.reject_reason);
+    }
+}
+
+string api::get_open_orders(string_view input) {
 
     getLatencyTracker().start_measurement(LatencyTracker::MARKET_DATA_PROCESSING);
 
-    istringstream is(input);
+    tokenizer t(input);
+    t.skip(2);
+    string opt1(t.next());
+    string opt2(t.next());
 
-    int id;
-    string cmd;
-    string opt1;
-    string opt2;
-    is >> id >> cmd >> opt1 >> opt2;
+    // -r forces a round trip; otherwise the reconciled local mirror answers
+    bool remote = opt1 == "-r";
+    if (remote) {
+        opt1 = opt2;
+        opt2 = string(t.next());
+    }
+
+    OrderManager& oms = getOrderManager();
+    if (!remote && oms.synced()) {
+        bool by_currency = find(SUPPORTED_CURRENCIES.begin(), SUPPORTED_CURRENCIES.end(), opt1) != SUPPORTED_CURRENCIES.end();
+        vector<order> orders;
+        if (opt1.empty() || by_currency) {
+            orders = oms.open_orders(opt1, opt2);
+        } else {
+            orders = oms.by_instrument(getInstrumentRegistry().find(opt1));
+        }
+        getLatencyTracker().stop_measurement(LatencyTracker::MARKET_DATA_PROCESSING);
+
+        fmt::print(fmt::fg(fmt::color::cyan) | fmt::emphasis::bold,
+            "> {} open order(s) (local mirror)\n", orders.size());
+        print_orders(orders);
+        return "";
+    }
 
     jsonrpc j;
 
@@ -1268,14 +1528,19 @@ string api::get_open_orders(const string &input) {
     return j.dump();
 }
 
-string api::view_positions(const string &input) {
+string api::view_positions(string_view input) {
     getLatencyTracker().start_measurement(LatencyTracker::MARKET_DATA_PROCESSING);
-    istringstream is(input);
-    int id;
-    string cmd;
-    string currency;
-    string kind;    
-    is >> id >> cmd >> currency >> kind;
+    tokenizer t(input);
+    t.skip(2);
+    string currency(t.next());
+    string kind(t.next());
+
+    // -r forces a round trip; otherwise the seeded position cache answers
+    bool remote = currency == "-r";
+    if (remote) {
+        currency = kind;
+        kind = string(t.next());
+    }
     
     if (!currency.empty()) {
         static const set<string> valid_currencies = {
@@ -1301,6 +1566,31 @@ string api::view_positions(const string &input) {
         }
     }
     
+    PortfolioCache& cache = getPortfolioCache();
+    if (!remote && cache.synced()) {
+        vector<position> positions = cache.positions(currency, kind);
+        getLatencyTracker().stop_measurement(LatencyTracker::MARKET_DATA_PROCESSING);
+
+        fmt::print(fmt::fg(fmt::color::cyan) | fmt::emphasis::bold,
+            "> {} open position(s) (local cache)\n", positions.size());
+        for (const auto& p : positions) {
+            fmt::print(fmt::fg(fmt::color::green),
+                "> {} size {} avg {} mark {} uPnL {} rPnL {} IM {} MM {}\n",
+                p.instrument_name, p.size, p.average_price, p.mark_price,
+                p.unrealized_pnl, p.realized_pnl, p.initial_margin, p.maintenance_margin);
+        }
+        for (const auto& code : SUPPORTED_CURRENCIES) {
+            if (!currency.empty() && code != currency) continue;
+            if (optional<portfolio_event> account = cache.account(code)) {
+                fmt::print(fmt::fg(fmt::color::yellow),
+                    "> {} equity {} available {} IM {} MM {}\n", account->currency,
+                    account->equity, account->available_funds,
+                    account->initial_margin, account->maintenance_margin);
+            }
+        }
+        return "";
+    }
+
     jsonrpc j;
     j["method"] = "private/get_positions";
     
@@ -1316,15 +1606,12 @@ string api::view_positions(const string &input) {
     return j.dump();
 }
 
-string api::get_orderbook(const string &input) {
+string api::get_orderbook(string_view input) {
     getLatencyTracker().start_measurement(LatencyTracker::MARKET_DATA_PROCESSING);
-    istringstream is(input);
-    int id;
-    string cmd;
-    string instrument;
+    tokenizer t(input);
+    t.skip(2);
+    string instrument(t.next());
     int depth = 10;
-
-    is >> id >> cmd >> instrument;
     
     if (instrument.empty()) {
         fmt::print(fmt::fg(fmt::color::red) | fmt::emphasis::bold,
@@ -1340,4 +1627,49 @@ string api::get_orderbook(const string &input) {
     };
     getLatencyTracker().stop_measurement(LatencyTracker::MARKET_DATA_PROCESSING);
     return j.dump();
-}
\ No newline at end of file
+}
+
+string api::get_instruments(string_view input) {
+    tokenizer t(input);
+    t.skip(2);
+    string currency(t.next());
+    string kind(t.next());
+
+    jsonrpc j("public/get_instruments");
+    j["params"] = {
+        {"currency", currency.empty() ? "any" : currency},
+        {"expired", false}
+    };
+    if (!kind.empty()) {
+        j["params"]["kind"] = kind;
+    }
+    getInstrumentRegistry().expect_listing(j["id"].get<long>(), currency, kind);
+    return j.dump();
+}
+
+string api::order_status(string_view input) {
+    tokenizer t(input);
+    t.skip(2);
+    string key(t.next());
+    if (key.empty()) {
+        utils::printerr("> Error: Order ID or label is required\n");
+        return "";
+    }
+
+    OrderManager& oms = getOrderManager();
+    vector<order> orders;
+    if (optional<order> found = oms.find(key)) {
+        orders.push_back(*found);
+    } else {
+        orders = oms.by_label(key);
+    }
+
+    if (orders.empty()) {
+        fmt::print(fmt::fg(fmt::color::yellow) | fmt::emphasis::bold,
+            "> No local order with id or label {}\n", key);
+        return "";
+    }
+
+    print_orders(orders);
+    return "";
+}
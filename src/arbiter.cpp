@@ -0,0 +1,171 @@
+#include "arbiter.hpp"
+#include "accounts.hpp"
+#include "dispatcher.hpp"
+#include "tracker.hpp"
+#include <algorithm>
+#include <fmt/core.h>
+#include <sstream>
+
+using namespace std;
+
+size_t FeedArbiter::add_source(const string& name) {
+    lock_guard<mutex> lock(sources_mutex);
+    sources.push_back({name});
+    return sources.size() - 1;
+}
+
+void FeedArbiter::record_win(size_t source) {
+    lock_guard<mutex> lock(sources_mutex);
+    if (source < sources.size()) sources[source].wins++;
+}
+
+void FeedArbiter::record_loss(size_t source, size_t winner, chrono::nanoseconds lead) {
+    {
+        lock_guard<mutex> lock(sources_mutex);
+        if (source < sources.size()) sources[source].losses++;
+        if (winner < sources.size()) {
+            sources[winner].confirmed++;
+            sources[winner].lead += lead;
+        }
+    }
+    getLatencyTracker().record(LatencyTracker::FEED_LEAD, lead);
+}
+
+void FeedArbiter::remember_trade(stripe& s, uint64_t key, const trade_state& state) {
+    uint64_t& slot = s.trade_history[s.trade_count++ % TRADE_HISTORY];
+    if (s.trade_count > TRADE_HISTORY) s.trades.erase(slot);
+    slot = key;
+    s.trades.insert_or_assign(key, state);
+}
+
+// Order-sensitive hash of every value in an update; copies of one update are identical
+static uint64_t content_digest(const json& value, uint64_t seed = 1469598103934665603ULL) {
+    auto mix = [&seed](uint64_t h) { seed = (seed ^ h) * 1099511628211ULL; };
+    switch (value.type()) {
+        case json::value_t::object:
+        case json::value_t::array:
+            for (const auto& item : value) seed = content_digest(item, seed);
+            break;
+        case json::value_t::string:
+            mix(hash<string_view>{}(value.get_ref<const string&>()));
+            break;
+        case json::value_t::number_float:
+            mix(hash<double>{}(value.get<double>()));
+            break;
+        case json::value_t::number_integer:
+        case json::value_t::number_unsigned:
+            mix(hash<long long>{}(value.get<long long>()));
+            break;
+        case json::value_t::boolean:
+            mix(value.get<bool>() ? 2 : 1);
+            break;
+        default:
+            mix(0);
+            break;
+    }
+    return seed;
+}
+
+bool FeedArbiter::accept(size_t source, string_view channel, const json& data,
+                         chrono::steady_clock::time_point received_at) {
+    ChannelKind kind = channel_kind(channel);
+    stripe& s = stripes[hash<string_view>{}(channel) % STRIPES];
+
+    if (kind == ChannelKind::TRADES) {
+        if (!data.is_array() || data.empty() || !data[0].contains("trade_id")) return true;
+        const json& id = data[0]["trade_id"];
+        uint64_t key = hash<string_view>{}(channel) * 1099511628211ULL ^
+                       (id.is_string() ? hash<string_view>{}(id.get_ref<const string&>())
+                                       : hash<long long>{}(id.get<long long>()));
+
+        unique_lock<mutex> lock(s.stripe_mutex);
+        if (trade_state* seen = s.trades.find(key)) {
+            trade_state winner = *seen;
+            lock.unlock();
+            record_loss(source, winner.winner, received_at - winner.won_at);
+            return false;
+        }
+        remember_trade(s, key, {source, received_at});
+        lock.unlock();
+        record_win(source);
+        return true;
+    }
+
+    long long sequence;
+    uint64_t digest = 0;
+    if (kind == ChannelKind::BOOK && data.contains("change_id")) {
+        sequence = data["change_id"].get<long long>();
+    } else if (data.is_object() && data.contains("timestamp")) {
+        sequence = data["timestamp"].get<long long>();
+        digest = content_digest(data);
+    } else {
+        return true;
+    }
+
+    unique_lock<mutex> lock(s.stripe_mutex);
+    channel_state* found = s.channels.find(channel);
+    channel_state& state = found != nullptr ? *found : s.channels.insert_or_assign(string(channel), channel_state());
+
+    // Another update in the same millisecond, not a copy of one already seen
+    if (digest != 0 && sequence == state.sequence) {
+        auto seen = state.digests.begin() + min(state.digest_count, state.digests.size());
+        if (find(state.digests.begin(), seen, digest) == seen) {
+            state.digests[state.digest_count++ % state.digests.size()] = digest;
+            state.winner = source;
+            state.won_at = received_at;
+            lock.unlock();
+            record_win(source);
+            return true;
+        }
+    }
+
+    if (sequence <= state.sequence) {
+        // Only the copy of the latest update has a winner to measure against
+        bool same = sequence == state.sequence;
+        channel_state winner = state;
+        lock.unlock();
+        if (same) {
+            record_loss(source, winner.winner, received_at - winner.won_at);
+        } else {
+            lock_guard<mutex> stats_lock(sources_mutex);
+            if (source < sources.size()) sources[source].losses++;
+        }
+        return false;
+    }
+
+    state.sequence = sequence;
+    state.winner = source;
+    state.won_at = received_at;
+    state.digests[0] = digest;
+    state.digest_count = 1;
+    lock.unlock();
+    record_win(source);
+    return true;
+}
+
+vector<feed_source_stats> FeedArbiter::stats() const {
+    lock_guard<mutex> lock(sources_mutex);
+    return sources;
+}
+
+string FeedArbiter::report() const {
+    vector<feed_source_stats> all = stats();
+    if (all.size() < 2) return "";
+
+    uint64_t total = 0;
+    for (const auto& s : all) total += s.wins;
+
+    ostringstream os;
+    os << "Feed arbitration:\n";
+    for (const auto& s : all) {
+        double win_rate = total > 0 ? 100.0 * s.wins / total : 0.0;
+        double lead_us = s.confirmed > 0 ? chrono::duration<double, micro>(s.lead).count() / s.confirmed : 0.0;
+        os << fmt::format("  {:<10} {:>9} wins {:5.1f}%  {:>9} confirmed  {:>9} late copies  {:8.1f} us mean lead\n",
+                          s.name, s.wins, win_rate, s.confirmed, s.losses, lead_us);
+    }
+    return os.str();
+}
+
+FeedArbiter& getFeedArbiter() {
+    return accounts::local<FeedArbiter>();
+}
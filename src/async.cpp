@@ -0,0 +1,312 @@
+#include "async.hpp"
+#include "accounts.hpp"
+#include "auth.hpp"
+#include "pool.hpp"
+#include "router.hpp"
+#include "sessions.hpp"
+#include "subscriptions.hpp"
+
+using namespace std;
+
+namespace {
+    // Keeps a completion out of the pool until a delivery queued on its
+    // executor has run or been dropped
+    struct completion_ref {
+        request_completion* completion;
+
+        explicit completion_ref(request_completion* completion) : completion(completion) {}
+        completion_ref(const completion_ref& other) : completion(other.completion) {
+            completion->references++;
+        }
+        completion_ref& operator=(const completion_ref&) = delete;
+        ~completion_ref() { getPendingRequests().release(completion); }
+    };
+}
+
+void PendingRequests::expect(long request_id, response_handler handler) {
+    alloc_probe probe(HotPath::REQUEST);
+    lock_guard<mutex> lock(pending_mutex);
+    handlers.insert_or_assign(request_id, waiter{move(handler), nullptr});
+}
+
+request_completion* PendingRequests::acquire_completion() {
+    request_completion* completion = nullptr;
+    {
+        lock_guard<mutex> lock(pending_mutex);
+        if (!spare_completions.empty()) {
+            completion = spare_completions.back().release();
+            spare_completions.pop_back();
+        }
+    }
+    if (completion == nullptr) completion = new request_completion();
+    completion->done = false;
+    completion->references = 1;
+    return completion;
+}
+
+void PendingRequests::expect(long request_id, request_completion* completion) {
+    alloc_probe probe(HotPath::REQUEST);
+    completion->references++;
+    lock_guard<mutex> lock(pending_mutex);
+    handlers.insert_or_assign(request_id, waiter{nullptr, completion});
+}
+
+void PendingRequests::deliver(request_completion* completion, const json& response) {
+    if (completion->done.exchange(true)) return;
+    if (completion->ex == nullptr || !*completion->ex) {
+        completion->handler(response);
+        return;
+    }
+    // The logic stage reuses its json, so the executor gets a copy
+    completion->response = response;
+    completion->references++;
+    (*completion->ex)([ref = completion_ref(completion)] {
+        ref.completion->handler(ref.completion->response);
+    });
+}
+
+void PendingRequests::release(request_completion* completion) {
+    if (completion->references.fetch_sub(1) != 1) return;
+
+    // Cleared here: the handler can hold an unloading strategy's code
+    completion->handler = nullptr;
+    completion->response = nullptr;
+    completion->outstanding.reset();
+    completion->ex = nullptr;
+    lock_guard<mutex> lock(pending_mutex);
+    spare_completions.emplace_back(completion);
+}
+
+bool PendingRequests::complete(const json& response) {
+    if (!response.contains("id") || !response["id"].is_number_integer()) return false;
+
+    long request_id = response["id"].get<long>();
+    waiter answered;
+    {
+        lock_guard<mutex> lock(pending_mutex);
+        if (handlers.empty()) return false;
+        waiter* waiting = handlers.find(request_id);
+        if (waiting == nullptr) return false;
+        answered = move(*waiting);
+        handlers.erase(request_id);
+        running++;
+    }
+    // Released before abandon() may return: the handler can hold an unloading strategy's code
+    auto finish = [this, &answered] {
+        answered.handler = nullptr;
+        if (answered.completion != nullptr) release(answered.completion);
+        lock_guard<mutex> lock(pending_mutex);
+        if (--running == 0) idle.notify_all();
+    };
+    try {
+        if (request_completion* completion = answered.completion) {
+            if (completion->outstanding) {
+                lock_guard<mutex> lock(completion->outstanding->ids_mutex);
+                completion->outstanding->ids.erase(request_id);
+            }
+            if (response.contains("error") || --completion->remaining == 0) deliver(completion, response);
+        } else {
+            answered.handler(response);
+        }
+    } catch (...) {
+        finish();
+        throw;
+    }
+    finish();
+    return true;
+}
+
+bool PendingRequests::waiting(const json& response) const {
+    if (!response.contains("id") || !response["id"].is_number_integer()) return false;
+
+    lock_guard<mutex> lock(pending_mutex);
+    return !handlers.empty() && handlers.find(response["id"].get<long>()) != nullptr;
+}
+
+size_t PendingRequests::outstanding() const {
+    lock_guard<mutex> lock(pending_mutex);
+    return handlers.size();
+}
+
+void PendingRequests::abandon(const vector<long>& request_ids) {
+    vector<waiter> dropped;
+    unique_lock<mutex> lock(pending_mutex);
+    for (long request_id : request_ids) {
+        waiter* waiting = handlers.find(request_id);
+        if (waiting == nullptr) continue;
+        dropped.push_back(move(*waiting));
+        handlers.erase(request_id);
+    }
+    idle.wait(lock, [this] { return running == 0; });
+    lock.unlock();
+    for (auto& w : dropped) {
+        if (w.completion != nullptr) release(w.completion);
+    }
+}
+
+json PendingRequests::local_error(long request_id, const string& message) {
+    return {{"jsonrpc", "2.0"}, {"id", request_id}, {"error", {{"code", -1}, {"message", message}}}};
+}
+
+PendingRequests& getPendingRequests() {
+    static PendingRequests pending;
+    return pending;
+}
+
+pending_response::pending_response(websocket_endpoint* endpoint, int connection_id, vector<string> frames,
+                                   const executor* ex, shared_ptr<outstanding_requests> outstanding)
+    : endpoint(endpoint), connection_id(connection_id), frames(move(frames)), ex(ex),
+      outstanding(move(outstanding)) {}
+
+void pending_response::then(response_handler handler) {
+    // Delivered once, on the caller's executor
+    PendingRequests& pending = getPendingRequests();
+    request_completion* state = pending.acquire_completion();
+    state->handler = move(handler);
+    state->ex = ex;
+    state->outstanding = outstanding;
+    state->remaining = frames.size();
+
+    if (frames.empty()) {
+        pending.deliver(state, {{"jsonrpc", "2.0"}, {"result", json::array()}});
+        pending.release(state);
+        return;
+    }
+
+    // Copied out: the last send may complete the coroutine that owns *this
+    websocket_endpoint* target = endpoint;
+    int connection = connection_id;
+    vector<string> outgoing = move(frames);
+
+    // An empty frame is one the builder refused, e.g. at the risk gate
+    for (const auto& frame : outgoing) {
+        if (frame.empty() || OrderRouter::request_id(frame) == 0) {
+            pending.deliver(state, PendingRequests::local_error(OrderRouter::request_id(frame),
+                                                                "request rejected before sending"));
+            pending.release(state);
+            return;
+        }
+    }
+    for (const auto& frame : outgoing) {
+        long request_id = OrderRouter::request_id(frame);
+        if (state->outstanding) {
+            lock_guard<mutex> lock(state->outstanding->ids_mutex);
+            state->outstanding->ids.insert_or_assign(request_id, true);
+        }
+        pending.expect(request_id, state);
+    }
+    // Ours is dropped before sending: the entries keep it alive until answered
+    pending.release(state);
+    for (const auto& frame : outgoing) {
+        if (target == nullptr || target->send(connection, frame) != 0) {
+            long request_id = OrderRouter::request_id(frame);
+            pending.complete(PendingRequests::local_error(request_id, "send failed"));
+        }
+    }
+}
+
+AsyncSession::AsyncSession(session& s, executor ex) : owner(s), ex(move(ex)) {}
+
+AsyncSession::~AsyncSession() {
+    abandon();
+}
+
+pending_response AsyncSession::send(vector<string> frames) {
+    return pending_response(owner.endpoint.get(), owner.connection_id, move(frames), &ex, outstanding);
+}
+
+void AsyncSession::abandon() {
+    vector<long> request_ids;
+    {
+        lock_guard<mutex> lock(outstanding->ids_mutex);
+        outstanding->ids.for_each([&request_ids](long request_id, bool) { request_ids.push_back(request_id); });
+        outstanding->ids.clear();
+    }
+    getPendingRequests().abandon(request_ids);
+}
+
+pending_response AsyncSession::request(string frame) {
+    return send({move(frame)});
+}
+
+pending_response AsyncSession::authorize() {
+    accounts::scope bound(owner.account);
+    return send({Password::password().authRequest()});
+}
+
+long AsyncSession::submit(const api::order_request& order) {
+    if (!owner.connected()) return -1;
+
+    accounts::scope bound(owner.account);
+    thread_local string frame = [] {
+        string s;
+        s.reserve(512);
+        return s;
+    }();
+    if (!api::place_order(order, frame)) return -1;
+
+    long request_id = OrderRouter::request_id(frame);
+    // Before sending, while the order is still pending under its request id
+    if (order.good_for.count() > 0) {
+        owner.endpoint->expire_order(request_id, owner.connection_id, order.good_for);
+    }
+    getPendingRequests().expect(request_id, [](const json&) {});
+    if (owner.endpoint->send(owner.connection_id, frame) == 0) return request_id;
+
+    getPendingRequests().complete(PendingRequests::local_error(request_id, "send failed"));
+    return -1;
+}
+
+pending_response AsyncSession::buy(api::order_request order) {
+    accounts::scope bound(owner.account);
+    order.buy = true;
+    string frame = api::place_order(order);
+    if (order.good_for.count() > 0 && !frame.empty() && owner.endpoint) {
+        owner.endpoint->expire_order(OrderRouter::request_id(frame), owner.connection_id, order.good_for);
+    }
+    return send({move(frame)});
+}
+
+pending_response AsyncSession::sell(api::order_request order) {
+    accounts::scope bound(owner.account);
+    order.buy = false;
+    string frame = api::place_order(order);
+    if (order.good_for.count() > 0 && !frame.empty() && owner.endpoint) {
+        owner.endpoint->expire_order(OrderRouter::request_id(frame), owner.connection_id, order.good_for);
+    }
+    return send({move(frame)});
+}
+
+pending_response AsyncSession::edit(const string& order_id, double amount, double price) {
+    accounts::scope bound(owner.account);
+    return send({api::amend_order(order_id, amount, price)});
+}
+
+pending_response AsyncSession::cancel(const string& order_id) {
+    accounts::scope bound(owner.account);
+    return send({api::process("Deribit " + to_string(owner.connection_id) + " cancel " + order_id)});
+}
+
+pending_response AsyncSession::get_positions(const string& currency, const string& kind) {
+    jsonrpc j("private/get_positions");
+    j["params"] = json::object();
+    if (!currency.empty()) j["params"]["currency"] = currency;
+    if (!kind.empty()) j["params"]["kind"] = kind;
+    return send({j.dump()});
+}
+
+pending_response AsyncSession::get_open_orders() {
+    jsonrpc j("private/get_open_orders");
+    j["params"] = json::object();
+    return send({j.dump()});
+}
+
+pending_response AsyncSession::subscribe(const vector<string>& channels) {
+    accounts::scope bound(owner.account);
+    return send(getSubscriptionManager().subscribe(channels));
+}
+
+pending_response AsyncSession::unsubscribe(const vector<string>& channels) {
+    accounts::scope bound(owner.account);
+    return send(getSubscriptionManager().unsubscribe(channels));
+}
@@ -1,34 +1,134 @@
 #include <iostream>
 #include <string>
 #include "auth.hpp"
+#include "accounts.hpp"
+#include "api.hpp"
+#include "util.hpp"
+#include <algorithm>
 
 using namespace std;
 
-int Password::num_sets = 0;  
-
 Password &Password::password() {
-    static Password pwd;
-    return pwd;
+    return password(accounts::current());
+}
+
+Password &Password::password(size_t account) {
+    static Password sessions[MAX_ACCOUNTS];
+    return sessions[account < MAX_ACCOUNTS ? account : 0];
 }
 
 void Password::setAccessToken(const string& token) {
-    if(num_sets > 1) {
-        cout << "WARNING: Access token can only be set once per session" << endl;
-        return;
-    }
+    lock_guard<mutex> lock(token_mutex);
     access_token = token;
-    num_sets++;
 }
 
-void Password::setAccessToken(int& token) {
-    if(num_sets > 1) {
-        cout << "WARNING: Access token can only be set once per session" << endl;
-        return;
-    }
-    access_token = to_string(token);
-    num_sets++;
+void Password::setSession(const string& access, const string& refresh, long long expires_in_seconds,
+                          const string& session_scope) {
+    lock_guard<mutex> lock(token_mutex);
+    access_token = access;
+    if (!refresh.empty()) refresh_token = refresh;
+    scope = session_scope;
+    expires_at = expires_in_seconds > 0 ? utils::time_now() + expires_in_seconds * 1000 : 0;
 }
 
 string Password::getAccessToken() const {
+    lock_guard<mutex> lock(token_mutex);
     return access_token;
-}
\ No newline at end of file
+}
+
+string Password::getRefreshToken() const {
+    lock_guard<mutex> lock(token_mutex);
+    return refresh_token;
+}
+
+string Password::getScope() const {
+    lock_guard<mutex> lock(token_mutex);
+    return scope;
+}
+
+long long Password::getExpiry() const {
+    lock_guard<mutex> lock(token_mutex);
+    return expires_at;
+}
+
+void Password::setCredentials(const string& id, const string& client_secret) {
+    lock_guard<mutex> lock(token_mutex);
+    client_id = id;
+    signing_key = make_unique<HmacSha256>(client_secret);
+}
+
+string Password::signedRequest(const string& session_scope, long long& request_id) {
+    long long now = utils::time_now();
+    string nonce = utils::gen_random(10);
+
+    jsonrpc j("public/auth");
+    j["params"] = {
+        {"grant_type", "client_signature"},
+        {"client_id", client_id},
+        {"timestamp", now},
+        {"nonce", nonce},
+        {"data", ""},
+        {"signature", client_signature(*signing_key, now, nonce)}
+    };
+    if (!session_scope.empty()) j["params"]["scope"] = session_scope;
+    request_id = j["id"].get<long>();
+    return j.dump();
+}
+
+string Password::authRequest(const string& session_scope) {
+    lock_guard<mutex> lock(token_mutex);
+    if (!signing_key) return "";
+
+    requested_scope = session_scope;
+    long long request_id = 0;
+    return signedRequest(session_scope, request_id);
+}
+
+string Password::refreshRequest() {
+    lock_guard<mutex> lock(token_mutex);
+    if (refresh_token.empty()) {
+        // Same scope as the login, so a named session is replaced rather than duplicated
+        return signing_key ? signedRequest(requested_scope, refresh_request_id) : "";
+    }
+
+    jsonrpc j("public/auth");
+    j["params"] = {
+        {"grant_type", "refresh_token"},
+        {"refresh_token", refresh_token}
+    };
+    refresh_request_id = j["id"].get<long>();
+    return j.dump();
+}
+
+void Password::dropRefreshToken() {
+    lock_guard<mutex> lock(token_mutex);
+    refresh_token.clear();
+}
+
+bool Password::consumeRefresh(long long response_id) {
+    lock_guard<mutex> lock(token_mutex);
+    if (refresh_request_id == 0 || response_id != refresh_request_id) return false;
+    refresh_request_id = 0;
+    return true;
+}
+
+long long Password::refreshDelay(long long now) const {
+    lock_guard<mutex> lock(token_mutex);
+    if ((refresh_token.empty() && !signing_key) || expires_at == 0) return -1;
+
+    // Refresh with a fifth of the lifetime to spare, but never in a tight loop
+    long long remaining = expires_at - now;
+    return max(1000LL, remaining - max(60000LL, remaining / 5));
+}
+
+void Password::clear() {
+    lock_guard<mutex> lock(token_mutex);
+    access_token.clear();
+    refresh_token.clear();
+    scope.clear();
+    expires_at = 0;
+    refresh_request_id = 0;
+    client_id.clear();
+    requested_scope.clear();
+    signing_key.reset();
+}
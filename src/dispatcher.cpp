@@ -0,0 +1,340 @@
+#include "dispatcher.hpp"
+#include "instruments.hpp"
+#include "pool.hpp"
+
+#include <cctype>
+#include <mutex>
+#include <unordered_map>
+
+using namespace std;
+
+namespace {
+    double number(const json& j, const char* key) {
+        auto it = j.find(key);
+        return it != j.end() && it->is_number() ? it->get<double>() : 0.0;
+    }
+
+    long long integer(const json& j, const char* key) {
+        auto it = j.find(key);
+        return it != j.end() && it->is_number() ? it->get<long long>() : 0;
+    }
+
+    // Assigns in place, so a reused event keeps its string's capacity
+    void text(string& out, const json& j, const char* key) {
+        auto it = j.find(key);
+        if (it == j.end() || it->is_null()) {
+            out.clear();
+        } else if (it->is_string()) {
+            out.assign(it->get_ref<const string&>());
+        } else {
+            out = it->dump();
+        }
+    }
+
+    bool text_equals(const json& j, const char* key, string_view expected) {
+        auto it = j.find(key);
+        return it != j.end() && it->is_string() && it->get_ref<const string&>() == expected;
+    }
+
+    uint32_t instrument_id(const string& name) {
+        return name.empty() ? InstrumentRegistry::INVALID_ID : getInstrumentRegistry().intern(name);
+    }
+
+    // Raw books send ["new"|"change"|"delete", price, amount], grouped books [price, amount]
+    void levels(vector<book_level>& result, const json& data, const char* side) {
+        result.clear();
+        auto it = data.find(side);
+        if (it == data.end() || !it->is_array()) return;
+
+        result.reserve(it->size());
+        for (const auto& level : *it) {
+            if (!level.is_array() || level.size() < 2) continue;
+            if (level[0].is_string()) {
+                if (level.size() < 3) continue;
+                bool removed = level[0].get_ref<const string&>() == "delete";
+                result.push_back({level[1].get<double>(), removed ? 0.0 : level[2].get<double>()});
+            } else {
+                result.push_back({level[0].get<double>(), level[1].get<double>()});
+            }
+        }
+    }
+
+    // Decodes over the existing items, so their strings are reused too
+    template <typename Item>
+    void decode_list(vector<Item>& result, const json& data) {
+        if (data.is_array()) {
+            result.resize(data.size());
+            size_t i = 0;
+            for (const auto& item : data) decode::into(result[i++], item);
+        } else if (data.is_object()) {
+            result.resize(1);
+            decode::into(result[0], data);
+        } else {
+            result.clear();
+        }
+    }
+
+    template <typename Event, typename Decoder>
+    bool notify(const vector<function<void(const Event&)>>& handlers, Decoder decoder) {
+        if (handlers.empty()) return true;
+        alloc_probe probe(HotPath::DISPATCH);
+        auto event = object_pool<Event>::acquire();
+        decoder(*event);
+        for (const auto& fn : handlers) fn(*event);
+        return true;
+    }
+}
+
+ChannelKind channel_kind(string_view channel) {
+    static const unordered_map<string_view, ChannelKind> prefixes = {
+        {"deribit_price_index", ChannelKind::PRICE_INDEX},
+        {"ticker", ChannelKind::TICKER},
+        {"book", ChannelKind::BOOK},
+        {"trades", ChannelKind::TRADES},
+        {"user.orders", ChannelKind::USER_ORDERS},
+        {"user.trades", ChannelKind::USER_TRADES},
+        {"user.portfolio", ChannelKind::USER_PORTFOLIO},
+        {"user.changes", ChannelKind::USER_CHANGES}
+    };
+
+    size_t end = channel.find('.');
+    if (end != string_view::npos && channel.substr(0, end) == "user") {
+        end = channel.find('.', end + 1);
+    }
+
+    auto it = prefixes.find(channel.substr(0, end));
+    return it == prefixes.end() ? ChannelKind::UNKNOWN : it->second;
+}
+
+price_index_event decode::price_index(const json& data) {
+    price_index_event event;
+    into(event, data);
+    return event;
+}
+
+void decode::into(price_index_event& event, const json& data) {
+    text(event.index_name, data, "index_name");
+    event.currency.assign(event.index_name, 0, event.index_name.find('_'));
+    for (auto& c : event.currency) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+    event.price = number(data, "price");
+    event.timestamp = integer(data, "timestamp");
+}
+
+ticker_event decode::ticker(const json& data) {
+    ticker_event event;
+    into(event, data);
+    return event;
+}
+
+void decode::into(ticker_event& event, const json& data) {
+    text(event.instrument_name, data, "instrument_name");
+    event.instrument_id = instrument_id(event.instrument_name);
+    event.timestamp = integer(data, "timestamp");
+    event.best_bid_price = number(data, "best_bid_price");
+    event.best_bid_amount = number(data, "best_bid_amount");
+    event.best_ask_price = number(data, "best_ask_price");
+    event.best_ask_amount = number(data, "best_ask_amount");
+    event.last_price = number(data, "last_price");
+    event.mark_price = number(data, "mark_price");
+    event.index_price = number(data, "index_price");
+    event.open_interest = number(data, "open_interest");
+}
+
+book_event decode::book(const json& data) {
+    book_event event;
+    into(event, data);
+    return event;
+}
+
+void decode::into(book_event& event, const json& data) {
+    text(event.instrument_name, data, "instrument_name");
+    event.instrument_id = instrument_id(event.instrument_name);
+    event.snapshot = text_equals(data, "type", "snapshot");
+    event.timestamp = integer(data, "timestamp");
+    event.change_id = integer(data, "change_id");
+    event.prev_change_id = integer(data, "prev_change_id");
+    levels(event.bids, data, "bids");
+    levels(event.asks, data, "asks");
+}
+
+trade_event decode::trade(const json& data) {
+    trade_event event;
+    into(event, data);
+    return event;
+}
+
+void decode::into(trade_event& event, const json& data) {
+    text(event.instrument_name, data, "instrument_name");
+    event.instrument_id = instrument_id(event.instrument_name);
+    text(event.trade_id, data, "trade_id");
+    text(event.order_id, data, "order_id");
+    text(event.label, data, "label");
+    event.buy = text_equals(data, "direction", "buy");
+    event.price = number(data, "price");
+    event.amount = number(data, "amount");
+    event.fee = number(data, "fee");
+    event.index_price = number(data, "index_price");
+    event.mark_price = number(data, "mark_price");
+    event.trade_seq = integer(data, "trade_seq");
+    event.timestamp = integer(data, "timestamp");
+}
+
+order_event decode::order(const json& data) {
+    order_event event;
+    into(event, data);
+    return event;
+}
+
+void decode::into(order_event& event, const json& data) {
+    text(event.instrument_name, data, "instrument_name");
+    event.instrument_id = instrument_id(event.instrument_name);
+    text(event.order_id, data, "order_id");
+    text(event.label, data, "label");
+    text(event.order_state, data, "order_state");
+    text(event.order_type, data, "order_type");
+    event.buy = text_equals(data, "direction", "buy");
+    event.price = number(data, "price");
+    event.amount = number(data, "amount");
+    event.filled_amount = number(data, "filled_amount");
+    event.average_price = number(data, "average_price");
+    event.creation_timestamp = integer(data, "creation_timestamp");
+    event.last_update_timestamp = integer(data, "last_update_timestamp");
+}
+
+position_event decode::position(const json& data) {
+    position_event event;
+    into(event, data);
+    return event;
+}
+
+void decode::into(position_event& event, const json& data) {
+    text(event.instrument_name, data, "instrument_name");
+    event.instrument_id = instrument_id(event.instrument_name);
+    event.size = number(data, "size");
+    event.average_price = number(data, "average_price");
+    event.mark_price = number(data, "mark_price");
+    event.index_price = number(data, "index_price");
+    event.realized_profit_loss = number(data, "realized_profit_loss");
+    event.floating_profit_loss = number(data, "floating_profit_loss");
+    event.initial_margin = number(data, "initial_margin");
+    event.maintenance_margin = number(data, "maintenance_margin");
+}
+
+portfolio_event decode::portfolio(const json& data) {
+    portfolio_event event;
+    into(event, data);
+    return event;
+}
+
+void decode::into(portfolio_event& event, const json& data) {
+    text(event.currency, data, "currency");
+    event.equity = number(data, "equity");
+    event.balance = number(data, "balance");
+    event.margin_balance = number(data, "margin_balance");
+    event.initial_margin = number(data, "initial_margin");
+    event.maintenance_margin = number(data, "maintenance_margin");
+    event.available_funds = number(data, "available_funds");
+    event.total_pl = number(data, "total_pl");
+    event.session_upl = number(data, "session_upl");
+    event.session_rpl = number(data, "session_rpl");
+}
+
+user_changes_event decode::user_changes(const json& data) {
+    user_changes_event event;
+    into(event, data);
+    return event;
+}
+
+void decode::into(user_changes_event& event, const json& data) {
+    text(event.instrument_name, data, "instrument_name");
+    static const json none;
+    auto field = [&](const char* key) -> const json& {
+        auto it = data.find(key);
+        return it == data.end() ? none : *it;
+    };
+    decode_list(event.trades, field("trades"));
+    decode_list(event.positions, field("positions"));
+    decode_list(event.orders, field("orders"));
+}
+
+void ChannelDispatcher::on_price_index(handler<price_index_event> fn) {
+    unique_lock<shared_mutex> lock(handlers_mutex);
+    price_index_handlers.push_back(move(fn));
+}
+
+void ChannelDispatcher::on_ticker(handler<ticker_event> fn) {
+    unique_lock<shared_mutex> lock(handlers_mutex);
+    ticker_handlers.push_back(move(fn));
+}
+
+void ChannelDispatcher::on_book(handler<book_event> fn) {
+    unique_lock<shared_mutex> lock(handlers_mutex);
+    book_handlers.push_back(move(fn));
+}
+
+void ChannelDispatcher::on_trades(handler<trades_event> fn) {
+    unique_lock<shared_mutex> lock(handlers_mutex);
+    trades_handlers.push_back(move(fn));
+}
+
+void ChannelDispatcher::on_user_orders(handler<user_orders_event> fn) {
+    unique_lock<shared_mutex> lock(handlers_mutex);
+    user_orders_handlers.push_back(move(fn));
+}
+
+void ChannelDispatcher::on_user_trades(handler<user_trades_event> fn) {
+    unique_lock<shared_mutex> lock(handlers_mutex);
+    user_trades_handlers.push_back(move(fn));
+}
+
+void ChannelDispatcher::on_user_portfolio(handler<portfolio_event> fn) {
+    unique_lock<shared_mutex> lock(handlers_mutex);
+    user_portfolio_handlers.push_back(move(fn));
+}
+
+void ChannelDispatcher::on_user_changes(handler<user_changes_event> fn) {
+    unique_lock<shared_mutex> lock(handlers_mutex);
+    user_changes_handlers.push_back(move(fn));
+}
+
+bool ChannelDispatcher::dispatch(string_view channel, const json& data) {
+    shared_lock<shared_mutex> lock(handlers_mutex);
+
+    switch (channel_kind(channel)) {
+        case ChannelKind::PRICE_INDEX:
+            return notify(price_index_handlers, [&](price_index_event& e) { decode::into(e, data); });
+        case ChannelKind::TICKER:
+            return notify(ticker_handlers, [&](ticker_event& e) { decode::into(e, data); });
+        case ChannelKind::BOOK:
+            return notify(book_handlers, [&](book_event& e) { decode::into(e, data); });
+        case ChannelKind::TRADES:
+            return notify(trades_handlers, [&](trades_event& e) { decode_list(e.trades, data); });
+        case ChannelKind::USER_ORDERS:
+            return notify(user_orders_handlers, [&](user_orders_event& e) { decode_list(e.orders, data); });
+        case ChannelKind::USER_TRADES:
+            return notify(user_trades_handlers, [&](user_trades_event& e) { decode_list(e.trades, data); });
+        case ChannelKind::USER_PORTFOLIO:
+            return notify(user_portfolio_handlers, [&](portfolio_event& e) { decode::into(e, data); });
+        case ChannelKind::USER_CHANGES:
+            return notify(user_changes_handlers, [&](user_changes_event& e) { decode::into(e, data); });
+        default:
+            return false;
+    }
+}
+
+ChannelDispatcher& getChannelDispatcher() {
+    static ChannelDispatcher dispatcher;
+    static const bool pools_tracked = [] {
+        track_pool<price_index_event>("price_index_event");
+        track_pool<ticker_event>("ticker_event");
+        track_pool<book_event>("book_event");
+        track_pool<trades_event>("trades_event");
+        track_pool<user_orders_event>("user_orders_event");
+        track_pool<user_trades_event>("user_trades_event");
+        track_pool<portfolio_event>("portfolio_event");
+        track_pool<user_changes_event>("user_changes_event");
+        return true;
+    }();
+    (void)pools_tracked;
+    return dispatcher;
+}
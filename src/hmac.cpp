@@ -0,0 +1,117 @@
+#include "hmac.hpp"
+#include "util.hpp"
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <array>
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+using namespace std;
+
+namespace {
+    constexpr size_t BLOCK_SIZE = 64;
+
+    constexpr array<char, 512> make_hex_table() {
+        constexpr char digits[] = "0123456789abcdef";
+        array<char, 512> table{};
+        for (size_t i = 0; i < 256; ++i) {
+            table[2 * i] = digits[i >> 4];
+            table[2 * i + 1] = digits[i & 0x0f];
+        }
+        return table;
+    }
+
+    constexpr array<char, 512> HEX_TABLE = make_hex_table();
+}
+
+void hex_encode(const unsigned char* data, size_t length, char* out) {
+    for (size_t i = 0; i < length; ++i) {
+        memcpy(out + 2 * i, &HEX_TABLE[2 * data[i]], 2);
+    }
+}
+
+HmacSha256::HmacSha256(string_view key)
+    : inner(EVP_MD_CTX_new()), outer(EVP_MD_CTX_new()), work(EVP_MD_CTX_new()) {
+    unsigned char block[BLOCK_SIZE] = {0};
+    if (key.size() > BLOCK_SIZE) {
+        unsigned int length = 0;
+        EVP_Digest(key.data(), key.size(), block, &length, EVP_sha256(), nullptr);
+    } else {
+        memcpy(block, key.data(), key.size());
+    }
+
+    unsigned char pad[BLOCK_SIZE];
+    for (size_t i = 0; i < BLOCK_SIZE; ++i) pad[i] = block[i] ^ 0x36;
+    EVP_DigestInit_ex(inner, EVP_sha256(), nullptr);
+    EVP_DigestUpdate(inner, pad, BLOCK_SIZE);
+
+    for (size_t i = 0; i < BLOCK_SIZE; ++i) pad[i] = block[i] ^ 0x5c;
+    EVP_DigestInit_ex(outer, EVP_sha256(), nullptr);
+    EVP_DigestUpdate(outer, pad, BLOCK_SIZE);
+
+    // Neither the key nor its pads outlive the constructor
+    OPENSSL_cleanse(block, sizeof(block));
+    OPENSSL_cleanse(pad, sizeof(pad));
+}
+
+HmacSha256::~HmacSha256() {
+    EVP_MD_CTX_free(inner);
+    EVP_MD_CTX_free(outer);
+    EVP_MD_CTX_free(work);
+}
+
+void HmacSha256::sign(initializer_list<string_view> parts, unsigned char out[DIGEST_SIZE]) {
+    unsigned char inner_digest[DIGEST_SIZE];
+    unsigned int length = 0;
+
+    EVP_MD_CTX_copy_ex(work, inner);
+    for (string_view part : parts) EVP_DigestUpdate(work, part.data(), part.size());
+    EVP_DigestFinal_ex(work, inner_digest, &length);
+
+    EVP_MD_CTX_copy_ex(work, outer);
+    EVP_DigestUpdate(work, inner_digest, DIGEST_SIZE);
+    EVP_DigestFinal_ex(work, out, &length);
+}
+
+string HmacSha256::sign_hex(initializer_list<string_view> parts) {
+    unsigned char digest[DIGEST_SIZE];
+    sign(parts, digest);
+
+    string hex(2 * DIGEST_SIZE, '\0');
+    hex_encode(digest, DIGEST_SIZE, hex.data());
+    return hex;
+}
+
+string client_signature(HmacSha256& key, long long timestamp, string_view nonce, string_view data) {
+    char stamp[24];
+    int stamp_length = snprintf(stamp, sizeof(stamp), "%lld", timestamp);
+    return key.sign_hex({string_view(stamp, stamp_length), "\n", nonce, "\n", data});
+}
+
+signature_benchmark benchmark_signatures(size_t iterations) {
+    const string secret = "benchmark-client-secret-0123456789abcdef";
+    const string nonce = "abcdefghij";
+    long long timestamp = utils::time_now();
+    iterations = max<size_t>(iterations, 1);
+
+    volatile size_t sink = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        sink = sink + utils::get_signature(timestamp + i, nonce, "", secret).size();
+    }
+    auto legacy = chrono::steady_clock::now() - start;
+
+    HmacSha256 key(secret);
+    start = chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        sink = sink + client_signature(key, timestamp + i, nonce).size();
+    }
+    auto keyed = chrono::steady_clock::now() - start;
+
+    return {
+        chrono::duration<double, nano>(legacy).count() / iterations,
+        chrono::duration<double, nano>(keyed).count() / iterations
+    };
+}
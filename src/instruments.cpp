@@ -0,0 +1,326 @@
+#include "instruments.hpp"
+#include "util.hpp"
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <algorithm>
+#include <mutex>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+namespace {
+    // Cache layout: header, fixed-size records, then a blob of names
+    struct cache_header {
+        char magic[8];
+        uint32_t version;
+        uint32_t count;
+        int64_t timestamp;
+        uint64_t strings_size;
+    };
+
+    struct cache_record {
+        double tick_size;
+        double contract_size;
+        double min_trade_amount;
+        int64_t expiration_timestamp;
+        uint32_t name_offset;
+        uint32_t base_offset;
+        uint16_t name_length;
+        uint8_t base_length;
+        uint8_t kind;
+        uint8_t inverse;
+        uint8_t padding[3];
+    };
+
+    constexpr char CACHE_MAGIC[8] = {'D', 'R', 'B', 'I', 'N', 'S', 'T', '\0'};
+}
+
+InstrumentKind parse_instrument_kind(string_view kind) {
+    if (kind == "future") return InstrumentKind::FUTURE;
+    if (kind == "option") return InstrumentKind::OPTION;
+    if (kind == "spot") return InstrumentKind::SPOT;
+    if (kind == "future_combo") return InstrumentKind::FUTURE_COMBO;
+    if (kind == "option_combo") return InstrumentKind::OPTION_COMBO;
+    return InstrumentKind::UNKNOWN;
+}
+
+uint32_t InstrumentRegistry::intern_locked(string_view name) {
+    auto it = index.find(name);
+    if (it != index.end()) return it->second;
+
+    // deque never relocates elements, so the key view stays valid
+    instrument_info& info = instruments.emplace_back();
+    info.id = static_cast<uint32_t>(instruments.size() - 1);
+    info.name = string(name);
+    index.emplace(info.name, info.id);
+    return info.id;
+}
+
+uint32_t InstrumentRegistry::intern(string_view name) {
+    {
+        shared_lock<shared_mutex> lock(registry_mutex);
+        auto it = index.find(name);
+        if (it != index.end()) return it->second;
+    }
+    unique_lock<shared_mutex> lock(registry_mutex);
+    return intern_locked(name);
+}
+
+uint32_t InstrumentRegistry::find(string_view name) const {
+    shared_lock<shared_mutex> lock(registry_mutex);
+    auto it = index.find(name);
+    return it == index.end() ? INVALID_ID : it->second;
+}
+
+bool InstrumentRegistry::is_listed(string_view name) const {
+    shared_lock<shared_mutex> lock(registry_mutex);
+    auto it = index.find(name);
+    return it != index.end() && instruments[it->second].listed;
+}
+
+optional<instrument_info> InstrumentRegistry::get(uint32_t id) const {
+    shared_lock<shared_mutex> lock(registry_mutex);
+    if (id >= instruments.size()) return nullopt;
+    return instruments[id];
+}
+
+void InstrumentRegistry::expect_listing(long request_id, string_view currency, string_view kind) {
+    unique_lock<shared_mutex> lock(registry_mutex);
+    pending_listings[request_id] = string(currency.empty() ? "any" : currency) + "/" + string(kind);
+}
+
+size_t InstrumentRegistry::load(const json& result, long request_id) {
+    unique_lock<shared_mutex> lock(registry_mutex);
+    long long now = utils::time_now();
+    size_t changes = 0;
+
+    string scope;
+    if (auto it = pending_listings.find(request_id); it != pending_listings.end()) {
+        scope = move(it->second);
+        pending_listings.erase(it);
+    }
+    vector<uint32_t> returned;
+    returned.reserve(result.size());
+
+    for (const auto& item : result) {
+        if (!item.contains("instrument_name") || !item["instrument_name"].is_string()) continue;
+
+        instrument_info fresh;
+        fresh.base_currency = item.value("base_currency", "");
+        fresh.kind = parse_instrument_kind(item.value("kind", ""));
+        fresh.tick_size = item.value("tick_size", 0.0);
+        fresh.contract_size = item.value("contract_size", 0.0);
+        fresh.min_trade_amount = item.value("min_trade_amount", 0.0);
+        fresh.expiration_timestamp = item.value("expiration_timestamp", 0LL);
+        fresh.inverse = item.value("instrument_type", "") == "reversed";
+        if (fresh.expiration_timestamp > 0 && fresh.expiration_timestamp < now) continue;
+
+        instrument_info& info = instruments[intern_locked(item["instrument_name"].get<string>())];
+        returned.push_back(info.id);
+        if (info.listed &&
+            info.base_currency == fresh.base_currency &&
+            info.kind == fresh.kind &&
+            info.tick_size == fresh.tick_size &&
+            info.contract_size == fresh.contract_size &&
+            info.min_trade_amount == fresh.min_trade_amount &&
+            info.expiration_timestamp == fresh.expiration_timestamp &&
+            info.inverse == fresh.inverse) {
+            continue;
+        }
+
+        info.base_currency = move(fresh.base_currency);
+        info.kind = fresh.kind;
+        info.tick_size = fresh.tick_size;
+        info.contract_size = fresh.contract_size;
+        info.min_trade_amount = fresh.min_trade_amount;
+        info.expiration_timestamp = fresh.expiration_timestamp;
+        info.inverse = fresh.inverse;
+        if (!info.listed) {
+            info.listed = true;
+            listed_count++;
+        }
+        changes++;
+    }
+
+    // Expired instruments are never returned again, so they are delisted here
+    for (auto& info : instruments) {
+        if (info.listed && info.expiration_timestamp > 0 && info.expiration_timestamp < now) {
+            info.listed = false;
+            listed_count--;
+            changes++;
+        }
+    }
+
+    // A complete result for its scope: whatever that scope listed before and
+    // is missing now has been delisted
+    if (!scope.empty()) {
+        sort(returned.begin(), returned.end());
+        auto delist = [&](instrument_info& info) {
+            if (info.listed && !binary_search(returned.begin(), returned.end(), info.id)) {
+                info.listed = false;
+                listed_count--;
+                changes++;
+            }
+        };
+        if (scope == "any/") {
+            for (auto& info : instruments) delist(info);
+        } else {
+            for (uint32_t id : listings[scope]) delist(instruments[id]);
+        }
+        listings[scope] = move(returned);
+    }
+    return changes;
+}
+
+bool InstrumentRegistry::load_cache(const string& path) {
+    unique_lock<shared_mutex> lock(registry_mutex);
+    cache_path = path;
+
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(cache_header))) {
+        ::close(fd);
+        return false;
+    }
+
+    size_t file_size = static_cast<size_t>(st.st_size);
+    void* mapped = mmap(nullptr, file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapped == MAP_FAILED) return false;
+
+    const char* base = static_cast<const char*>(mapped);
+    const cache_header* header = reinterpret_cast<const cache_header*>(base);
+    size_t records_size = static_cast<size_t>(header->count) * sizeof(cache_record);
+
+    bool valid = memcmp(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC)) == 0 &&
+                 header->version == CACHE_VERSION &&
+                 sizeof(cache_header) + records_size + header->strings_size == file_size;
+    if (!valid) {
+        munmap(mapped, file_size);
+        return false;
+    }
+
+    const cache_record* records = reinterpret_cast<const cache_record*>(base + sizeof(cache_header));
+    const char* strings = base + sizeof(cache_header) + records_size;
+    long long now = utils::time_now();
+
+    for (uint32_t i = 0; i < header->count; ++i) {
+        const cache_record& record = records[i];
+        if (record.name_offset + record.name_length > header->strings_size ||
+            record.base_offset + record.base_length > header->strings_size) {
+            continue;
+        }
+        if (record.expiration_timestamp > 0 && record.expiration_timestamp < now) continue;
+
+        instrument_info& info = instruments[intern_locked(string_view(strings + record.name_offset, record.name_length))];
+        info.base_currency.assign(strings + record.base_offset, record.base_length);
+        info.kind = static_cast<InstrumentKind>(record.kind);
+        info.tick_size = record.tick_size;
+        info.contract_size = record.contract_size;
+        info.min_trade_amount = record.min_trade_amount;
+        info.expiration_timestamp = record.expiration_timestamp;
+        info.inverse = record.inverse != 0;
+        if (!info.listed) {
+            info.listed = true;
+            listed_count++;
+        }
+    }
+    writer->cached_at = header->timestamp;
+
+    munmap(mapped, file_size);
+    return true;
+}
+
+bool InstrumentRegistry::save_cache() {
+    // Only the snapshot is taken under the lock; readers on the hot path never wait on the disk
+    shared_lock<shared_mutex> lock(registry_mutex);
+    if (cache_path.empty()) return false;
+
+    vector<cache_record> records;
+    string strings;
+    records.reserve(listed_count);
+
+    for (const auto& info : instruments) {
+        if (!info.listed) continue;
+
+        cache_record record{};
+        record.tick_size = info.tick_size;
+        record.contract_size = info.contract_size;
+        record.min_trade_amount = info.min_trade_amount;
+        record.expiration_timestamp = info.expiration_timestamp;
+        record.name_offset = static_cast<uint32_t>(strings.size());
+        record.name_length = static_cast<uint16_t>(info.name.size());
+        strings += info.name;
+        record.base_offset = static_cast<uint32_t>(strings.size());
+        record.base_length = static_cast<uint8_t>(info.base_currency.size());
+        strings += info.base_currency;
+        record.kind = static_cast<uint8_t>(info.kind);
+        record.inverse = info.inverse ? 1 : 0;
+        records.push_back(record);
+    }
+
+    cache_header header{};
+    memcpy(header.magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+    header.version = CACHE_VERSION;
+    header.count = static_cast<uint32_t>(records.size());
+    header.timestamp = utils::time_now();
+    header.strings_size = strings.size();
+    string path = cache_path;
+    lock.unlock();
+
+    shared_ptr<cache_writer> w = writer;
+    uint64_t generation = ++w->queued;
+    thread([w, generation, path, header, records = move(records), strings = move(strings)] {
+        lock_guard<mutex> write_lock(w->write_mutex);
+        // A newer snapshot already reached the disk
+        if (generation < w->written) return;
+
+        // Write beside the cache and rename so readers never see a partial file
+        string tmp_path = path + ".tmp";
+        FILE* file = fopen(tmp_path.c_str(), "wb");
+        if (file == nullptr) return;
+
+        bool ok = fwrite(&header, sizeof(header), 1, file) == 1 &&
+                  (records.empty() || fwrite(records.data(), sizeof(cache_record), records.size(), file) == records.size()) &&
+                  (strings.empty() || fwrite(strings.data(), 1, strings.size(), file) == strings.size());
+        ok = fclose(file) == 0 && ok;
+
+        if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+            remove(tmp_path.c_str());
+            return;
+        }
+        w->written = generation;
+        w->cached_at = header.timestamp;
+    }).detach();
+    return true;
+}
+
+long long InstrumentRegistry::cache_timestamp() const {
+    return writer->cached_at.load();
+}
+
+size_t InstrumentRegistry::size() const {
+    shared_lock<shared_mutex> lock(registry_mutex);
+    return listed_count;
+}
+
+bool InstrumentRegistry::loaded() const {
+    return size() > 0;
+}
+
+bool InstrumentRegistry::is_instrument_list(const json& result) {
+    return result.is_array() && !result.empty() && result[0].is_object() &&
+           result[0].contains("instrument_name") && result[0].contains("tick_size");
+}
+
+InstrumentRegistry& getInstrumentRegistry() {
+    static InstrumentRegistry registry;
+    return registry;
+}
@@ -8,6 +8,16 @@
 #include "websocket.hpp"
 #include "api.hpp"
 #include "util.hpp"
+#include "instruments.hpp"
+#include "risk.hpp"
+#include "sessions.hpp"
+#include "accounts.hpp"
+#include "auth.hpp"
+#include "hmac.hpp"
+#include "subscriptions.hpp"
+#include "arbiter.hpp"
+#include "plugins.hpp"
+#include "pool.hpp"
 
 #include "tracker.hpp"
 
@@ -17,6 +27,8 @@ enum class MenuOption {
     CONNECT,
     ORDER_MANAGEMENT,
     MARKET_COVERAGE,
+    ACCOUNTS,
+    STRATEGIES,
     HELP,
     PERFORMANCE_METRICS,
     EXIT
@@ -28,6 +40,24 @@ enum class OrderManagementOption {
     MODIFY_ORDER,
     VIEW_ORDERS,
     VIEW_POSITIONS,
+    ORDER_STATUS,
+    KILL_SWITCH,
+    RESUME_TRADING,
+    BACK
+};
+
+enum class AccountOption {
+    LIST_SESSIONS,
+    ADD_SESSION,
+    SWITCH_ACCOUNT,
+    BACK
+};
+
+enum class StrategyOption {
+    LIST_STRATEGIES,
+    LOAD_STRATEGY,
+    RELOAD_STRATEGY,
+    UNLOAD_STRATEGY,
     BACK
 };
 
@@ -42,9 +72,13 @@ enum class MarketCoverageOption {
 void displayMainMenu();
 void displayOrderManagementMenu();
 void displayMarketCoverageMenu();
+void displayAccountMenu(SessionStore& sessions);
+void displayStrategyMenu();
 
-void handleOrderManagement(websocket_endpoint& endpoint, int connection_id);
+void handleOrderManagement(SessionStore& sessions);
 void handleMarketCoverage(websocket_endpoint& endpoint, int connection_id);
+void handleAccounts(SessionStore& sessions);
+void handleStrategies(SessionStore& sessions);
 
 
 void displayMainMenu() {
@@ -54,9 +88,11 @@ void displayMainMenu() {
         "1. Connect to Exchange\n"
         "2. Order Management\n"
         "3. Market Coverage\n"
-        "4. Help\n"
-        "5. Performance Metrics\n"            
-        "6. Exit\n\n"
+        "4. Accounts\n"
+        "5. Strategies\n"
+        "6. Help\n"
+        "7. Performance Metrics\n"            
+        "8. Exit\n\n"
         "Select an option (or press 'h' for help): ");
 }
 
@@ -69,7 +105,10 @@ void displayOrderManagementMenu() {
         "3. Modify Order\n"
         "4. View Open Orders\n"
         "5. View Positions\n"
-        "6. Back to Main Menu\n\n"
+        "6. Order Status\n"
+        "7. Kill Switch (cancel everything)\n"
+        "8. Resume Trading (after the kill switch)\n"
+        "9. Back to Main Menu\n\n"
         "Select an option: ");
 }
 
@@ -86,7 +125,35 @@ void displayMarketCoverageMenu() {
         "Select an option: ");
 }
 
-void handleOrderManagement(websocket_endpoint& endpoint, int connection_id) {
+void displayAccountMenu(SessionStore& sessions) {
+    utils::clear_console();
+    fmt::print(fg(fmt::color::magenta) | fmt::emphasis::bold,
+        "\nAccounts (trading: {}):\n"
+        "1. List Sessions\n"
+        "2. Add Subaccount Session\n"
+        "3. Switch Account\n"
+        "4. Back to Main Menu\n\n"
+        "Select an option: ", sessions.active().name);
+}
+
+void displayStrategyMenu() {
+    utils::clear_console();
+    fmt::print(fg(fmt::color::blue) | fmt::emphasis::bold,
+        "\nStrategies:\n"
+        "1. List Strategies\n"
+        "2. Load Strategy\n"
+        "3. Reload Strategy\n"
+        "4. Unload Strategy\n"
+        "5. Back to Main Menu\n\n"
+        "Select an option: ");
+}
+
+void handleOrderManagement(SessionStore& sessions) {
+    // Everything below routes to the account selected under Accounts
+    session& active = sessions.active();
+    websocket_endpoint& endpoint = *active.endpoint;
+    int connection_id = active.connection_id;
+
     bool back_to_main = false;
     while (!back_to_main) {
         displayOrderManagementMenu();
@@ -163,6 +230,7 @@ void handleOrderManagement(websocket_endpoint& endpoint, int connection_id) {
                     "1. All Open Orders\n"
                     "2. Orders by Instrument\n"
                     "3. Orders by Currency\n"
+                    "4. Orders by Label\n"
                     "Select: ");
 
                 int view_choice;
@@ -183,6 +251,15 @@ void handleOrderManagement(websocket_endpoint& endpoint, int connection_id) {
                     getline(cin, currency);
                     command += " " + currency;
                 }
+                else if (view_choice == 4) {
+                    fmt::print(fg(fmt::color::cyan), "Enter currency: ");
+                    string currency;
+                    getline(cin, currency);
+                    fmt::print(fg(fmt::color::cyan), "Enter label: ");
+                    string label;
+                    getline(cin, label);
+                    command += " " + currency + " " + label;
+                }
 
                 string msg = api::process(command);
                 if (!msg.empty()) {
@@ -201,6 +278,30 @@ void handleOrderManagement(websocket_endpoint& endpoint, int connection_id) {
                 break;
             }
 
+            case OrderManagementOption::ORDER_STATUS: {
+                utils::clear_console();
+                fmt::print(fg(fmt::color::cyan), "Enter order ID or label: ");
+                string key;
+                getline(cin, key);
+
+                api::process("Deribit " + to_string(connection_id) + " status " + key);
+                break;
+            }
+
+            case OrderManagementOption::KILL_SWITCH: {
+                int sent = sessions.kill_switch();
+                fmt::print(fg(fmt::color::red) | fmt::emphasis::bold,
+                    "> Kill switch fired: cancel_all sent on {} connection(s)\n", sent);
+                fmt::print(fg(fmt::color::yellow), "> Order entry stays off until trading is resumed\n");
+                break;
+            }
+
+            case OrderManagementOption::RESUME_TRADING: {
+                sessions.resume_trading();
+                fmt::print(fg(fmt::color::green), "> Order entry resumed\n");
+                break;
+            }
+
             case OrderManagementOption::BACK:
                 back_to_main = true;
                 break;
@@ -245,7 +346,10 @@ void handleMarketCoverage(websocket_endpoint& endpoint, int connection_id) {
 
             case MarketCoverageOption::SUBSCRIBE_SYMBOL: {
                 utils::clear_console();
-                fmt::print(fg(fmt::color::cyan), "Enter symbol to subscribe (e.g., BTC_USD): ");
+                fmt::print(fg(fmt::color::cyan),
+                    "Enter index or channel to subscribe\n"
+                    "(e.g., btc_usd, ticker.BTC-PERPETUAL.100ms, book.BTC-PERPETUAL.100ms,\n"
+                    " trades.BTC-PERPETUAL.raw, user.orders.any.any.raw): ");
                 string symbol;
                 getline(cin, symbol);
 
@@ -277,11 +381,16 @@ void handleMarketCoverage(websocket_endpoint& endpoint, int connection_id) {
                 if (!connections.empty()) {
                     fmt::print(fg(fmt::color::green) | fmt::emphasis::bold, 
                         "> Current Subscriptions:\n");
+                    feed_sharding sharding = getSubscriptionManager().sharding();
                     for (const auto& connection : connections) {
+                        string feed = sharding.feed_links() > 0
+                            ? fmt::format(" (feed {})", feed_shard(connection, sharding)) : "";
                         size_t prefix_pos = connection.find("deribit_price_index.");
                         if (prefix_pos != string::npos) {
                             string index_name = connection.substr(prefix_pos + strlen("deribit_price_index."));
-                            fmt::print(fg(fmt::color::green), " - {}\n", index_name);
+                            fmt::print(fg(fmt::color::green), " - {}{}\n", index_name, feed);
+                        } else {
+                            fmt::print(fg(fmt::color::green), " - {}{}\n", connection, feed);
                         }
                     }
                 } else {
@@ -320,13 +429,207 @@ void handleMarketCoverage(websocket_endpoint& endpoint, int connection_id) {
     }
 }
 
+void handleAccounts(SessionStore& sessions) {
+    const string uri = "wss://test.deribit.com/ws/api/v2";
+
+    bool back_to_main = false;
+    while (!back_to_main) {
+        displayAccountMenu(sessions);
+        int account_choice;
+        cin >> account_choice;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+        AccountOption account_option = static_cast<AccountOption>(account_choice - 1);
+
+        switch (account_option) {
+            case AccountOption::LIST_SESSIONS: {
+                utils::clear_console();
+                size_t active = sessions.active().account;
+                for (const session* s : sessions.list()) {
+                    Password& credentials = Password::password(s->account);
+                    long long expires_in = credentials.getExpiry() > 0
+                        ? (credentials.getExpiry() - utils::time_now()) / 1000 : 0;
+                    fmt::print(fg(s->account == active ? fmt::color::green : fmt::color::cyan),
+                        "{} [{}] {:<12} client {:<12} connection {:<3} scope {} (expires in {}s)\n",
+                        s->account == active ? '*' : ' ', s->account, s->name,
+                        s->client_id.empty() ? "-" : s->client_id,
+                        s->connection_id, credentials.getScope().empty() ? "-" : credentials.getScope(),
+                        expires_in);
+                }
+                break;
+            }
+
+            case AccountOption::ADD_SESSION: {
+                utils::clear_console();
+                fmt::print(fg(fmt::color::cyan), "Enter a name for the account: ");
+                string name;
+                getline(cin, name);
+
+                session* s = sessions.add(name);
+                if (s == nullptr) {
+                    fmt::print(fg(fmt::color::red) | fmt::emphasis::bold,
+                        "> Name already in use or account limit ({}) reached\n", MAX_ACCOUNTS);
+                    break;
+                }
+
+                fmt::print(fg(fmt::color::cyan), "Enter client ID: ");
+                string client_id;
+                getline(cin, client_id);
+                string client_secret = utils::getPassword();
+                fmt::print("\n");
+
+                if (sessions.connect(*s, uri, client_id, client_secret)) {
+                    fmt::print(fg(fmt::color::green) | fmt::emphasis::bold,
+                        "> Account {} connected on its own io thread, authorization request sent.\n", name);
+                } else {
+                    fmt::print(fg(fmt::color::red) | fmt::emphasis::bold,
+                        "> Failed to connect account {}.\n", name);
+                }
+                break;
+            }
+
+            case AccountOption::SWITCH_ACCOUNT: {
+                utils::clear_console();
+                fmt::print(fg(fmt::color::cyan), "Enter account name: ");
+                string name;
+                getline(cin, name);
+
+                if (sessions.select(name)) {
+                    fmt::print(fg(fmt::color::green) | fmt::emphasis::bold,
+                        "> Orders and views now route to {}\n", name);
+                } else {
+                    fmt::print(fg(fmt::color::red) | fmt::emphasis::bold,
+                        "> Unknown account: {}\n", name);
+                }
+                break;
+            }
+
+            case AccountOption::BACK:
+                back_to_main = true;
+                break;
+
+            default:
+                fmt::print(fg(fmt::color::red) | fmt::emphasis::bold,
+                    "> Invalid option! Please try again.\n");
+                break;
+        }
+
+        if (!back_to_main) {
+            utils::printcmd("\nPress Enter to continue...");
+            cin.get();
+        }
+    }
+}
+
+void handleStrategies(SessionStore& sessions) {
+    StrategyHost& host = getStrategyHost();
+
+    bool back_to_main = false;
+    while (!back_to_main) {
+        displayStrategyMenu();
+        int strategy_choice;
+        cin >> strategy_choice;
+        cin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+        StrategyOption strategy_option = static_cast<StrategyOption>(strategy_choice - 1);
+
+        switch (strategy_option) {
+            case StrategyOption::LIST_STRATEGIES: {
+                utils::clear_console();
+                string report = host.report();
+                if (report.empty()) {
+                    fmt::print(fg(fmt::color::yellow), "> No strategies loaded\n");
+                } else {
+                    cout << report;
+                }
+                break;
+            }
+
+            case StrategyOption::LOAD_STRATEGY: {
+                utils::clear_console();
+                fmt::print(fg(fmt::color::cyan), "Enter path to the strategy .so: ");
+                string path;
+                getline(cin, path);
+                fmt::print(fg(fmt::color::cyan), "Pin to CPU (-1 for none): ");
+                int cpu = -1;
+                cin >> cpu;
+                cin.ignore(numeric_limits<streamsize>::max(), '\n');
+
+                if (host.load(path, sessions, sessions.active(), cpu)) {
+                    fmt::print(fg(fmt::color::green) | fmt::emphasis::bold,
+                        "> {} running for account {}\n", path, sessions.active().name);
+                }
+                break;
+            }
+
+            case StrategyOption::RELOAD_STRATEGY: {
+                utils::clear_console();
+                fmt::print(fg(fmt::color::cyan), "Enter path of the loaded strategy: ");
+                string path;
+                getline(cin, path);
+
+                if (host.reload(path)) {
+                    fmt::print(fg(fmt::color::green) | fmt::emphasis::bold, "> {} reloaded\n", path);
+                }
+                break;
+            }
+
+            case StrategyOption::UNLOAD_STRATEGY: {
+                utils::clear_console();
+                fmt::print(fg(fmt::color::cyan), "Enter path of the loaded strategy: ");
+                string path;
+                getline(cin, path);
+
+                if (host.unload(path)) {
+                    fmt::print(fg(fmt::color::green) | fmt::emphasis::bold, "> {} unloaded\n", path);
+                } else {
+                    fmt::print(fg(fmt::color::red) | fmt::emphasis::bold, "> {} is not loaded\n", path);
+                }
+                break;
+            }
+
+            case StrategyOption::BACK:
+                back_to_main = true;
+                break;
+
+            default:
+                fmt::print(fg(fmt::color::red) | fmt::emphasis::bold,
+                    "> Invalid option! Please try again.\n");
+                break;
+        }
+
+        if (!back_to_main) {
+            utils::printcmd("\nPress Enter to continue...");
+            cin.get();
+        }
+    }
+}
+
 int main() {
-    websocket_endpoint endpoint;
+    SessionStore sessions;
+    websocket_endpoint& endpoint = *sessions.get(0).endpoint;
     int active_connection_id = -1;
     bool done = false;
 
     utils::printHeader();
 
+    const char* cache_path = getenv("DERIBIT_INSTRUMENT_CACHE");
+    InstrumentRegistry& registry = getInstrumentRegistry();
+    if (registry.load_cache(cache_path != nullptr ? cache_path : "instruments.cache")) {
+        fmt::print(fg(fmt::color::green), "> Loaded {} instruments from cache ({}s old)\n",
+                   registry.size(), (utils::time_now() - registry.cache_timestamp()) / 1000);
+    }
+
+    const char* risk_path = getenv("DERIBIT_RISK_LIMITS");
+    if (getRiskGate().load_file(risk_path != nullptr ? risk_path : "risk.json")) {
+        fmt::print(fg(fmt::color::green), "> Loaded pre-trade risk limits\n");
+    }
+
+    size_t strategies = getStrategyHost().load_from_env(sessions);
+    if (strategies > 0) {
+        fmt::print(fg(fmt::color::green), "> Loaded {} strategies\n", strategies);
+    }
+
     while (!done) {
         displayMainMenu();
         
@@ -351,6 +654,7 @@ int main() {
             utils::clear_console();
             const string uri = "wss://test.deribit.com/ws/api/v2";
             active_connection_id = endpoint.connect(uri);
+            sessions.get(0).connection_id = active_connection_id;
 
             if (active_connection_id != -1) {
                 fmt::print(fg(fmt::color::green) | fmt::emphasis::bold,
@@ -367,21 +671,14 @@ int main() {
                     
                     fmt::print(fg(fmt::color::cyan), "Enter client ID: ");
                     getline(cin, client_id);
+                    sessions.get(0).client_id = client_id;
 
                     client_secret = utils::getPassword();
+                    fmt::print("\n");
 
-                    fmt::print(fg(fmt::color::cyan), "\nSave access token for this session? (y/n): ");
-                    char save_choice;
-                    cin >> save_choice;
-                    cin.ignore(numeric_limits<streamsize>::max(), '\n');
-
+                    // The session is kept and refreshed in the background
                     string command = "Deribit " + to_string(active_connection_id) + 
                                 " authorize " + client_id + " " + client_secret;
-                    
-       
-                    if (tolower(save_choice) == 'y') {
-                        command += " -s";
-                    }
 
                     string msg = api::process(command);
                     if (!msg.empty()) {
@@ -390,6 +687,11 @@ int main() {
                             "> Authorization request sent.\n");
                     }
                 }
+
+                string instruments = api::process("Deribit " + to_string(active_connection_id) + " instruments");
+                if (!instruments.empty()) {
+                    endpoint.send(active_connection_id, instruments);
+                }
             } else {
                 fmt::print(fg(fmt::color::red) | fmt::emphasis::bold,
                     "> Failed to connect to Deribit TESTNET.\n");
@@ -401,32 +703,52 @@ int main() {
         }
 
             case MenuOption::ORDER_MANAGEMENT: {
-                if (active_connection_id == -1) {
+                if (!sessions.active().connected()) {
                     fmt::print(fg(fmt::color::red) | fmt::emphasis::bold,
                         "> Please connect to exchange first!\n");
                     utils::printcmd("Press Enter to continue...");
                     cin.get();
                     break;
                 }
-                handleOrderManagement(endpoint, active_connection_id);
+                handleOrderManagement(sessions);
                 break;
             }
 
             case MenuOption::MARKET_COVERAGE: {
-                if (active_connection_id == -1) {
+                if (!sessions.active().connected()) {
                     fmt::print(fg(fmt::color::red) | fmt::emphasis::bold,
                         "> Please connect to exchange first!\n");
                     utils::printcmd("Press Enter to continue...");
                     cin.get();
                     break;
                 }
-                handleMarketCoverage(endpoint, active_connection_id);
+                handleMarketCoverage(*sessions.active().endpoint, sessions.active().connection_id);
                 break;
             }
 
+            case MenuOption::ACCOUNTS:
+                handleAccounts(sessions);
+                break;
+
+            case MenuOption::STRATEGIES:
+                handleStrategies(sessions);
+                break;
+
             case MenuOption::PERFORMANCE_METRICS: {
                 utils::clear_console();
                 cout << getLatencyTracker().generate_report() << endl;
+                cout << getMarketDataShards().report() << endl;
+                cout << getFeedArbiter().report() << endl;
+                cout << sessions.active().endpoint->router().report() << endl;
+                cout << getStrategyHost().report() << endl;
+                cout << allocation_report() << endl;
+                fmt::print("Armed timers: {} (tick {}ms)\n", sessions.active().endpoint->timers().size(),
+                           sessions.active().endpoint->timers().tick().count());
+                fmt::print(fg(fmt::color::cyan), "Pre-trade risk check benchmark: {:.1f} ns/check\n",
+                           getRiskGate().benchmark(100000));
+                signature_benchmark auth = benchmark_signatures(100000);
+                fmt::print(fg(fmt::color::cyan), "Auth signature: {:.1f} ns legacy helper, {:.1f} ns keyed HMAC ({:.1f}x)\n\n",
+                           auth.legacy_ns, auth.keyed_ns, auth.legacy_ns / max(auth.keyed_ns, 1.0));
                 utils::printcmd("Press Enter to continue...");
                 cin.get();
                 break;
@@ -452,5 +774,7 @@ int main() {
                 break;
         }
     }
+    // Strategies hold pointers into the sessions, which go first
+    getStrategyHost().unload_all();
     return 0;
 }
\ No newline at end of file
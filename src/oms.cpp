@@ -0,0 +1,484 @@
+#include "oms.hpp"
+#include "accounts.hpp"
+#include "api.hpp"
+#include "dispatcher.hpp"
+#include "instruments.hpp"
+#include "util.hpp"
+
+using namespace std;
+
+const char* to_string(OrderState state) {
+    switch (state) {
+        case OrderState::PENDING_NEW: return "pending_new";
+        case OrderState::OPEN: return "open";
+        case OrderState::PARTIALLY_FILLED: return "partially_filled";
+        case OrderState::FILLED: return "filled";
+        case OrderState::CANCELLED: return "cancelled";
+        case OrderState::REJECTED: return "rejected";
+        case OrderState::UNTRIGGERED: return "untriggered";
+    }
+    return "unknown";
+}
+
+namespace {
+    OrderState parse_state(const string& state, double filled_amount, OrderState current) {
+        if (state == "open") return filled_amount > 0 ? OrderState::PARTIALLY_FILLED : OrderState::OPEN;
+        if (state == "filled") return OrderState::FILLED;
+        if (state == "cancelled") return OrderState::CANCELLED;
+        if (state == "rejected") return OrderState::REJECTED;
+        if (state == "untriggered") return OrderState::UNTRIGGERED;
+        return current;
+    }
+
+    // Whether an instrument settles in currency, from the registry when it has one
+    bool settles_in(const order& o, string_view currency) {
+        if (optional<instrument_info> info = getInstrumentRegistry().get(o.instrument_id)) {
+            if (!info->base_currency.empty()) return info->base_currency == currency;
+        }
+        string_view name = o.instrument_name;
+        return name.substr(0, name.find_first_of("-_")) == currency;
+    }
+}
+
+OrderManager::OrderManager() : by_order_id(1024), label_heads(256), instrument_heads(256),
+                               instrument_live(256), pending_requests(64), requests(1024) {
+    orders.reserve(1024);
+}
+
+uint32_t OrderManager::allocate() {
+    uint32_t slot;
+    if (!free_slots.empty()) {
+        slot = free_slots.back();
+        free_slots.pop_back();
+    } else {
+        orders.emplace_back();
+        slot = static_cast<uint32_t>(orders.size() - 1);
+    }
+    orders[slot].data.slot = slot;
+    return slot;
+}
+
+// Keeps a finished order queryable for a while, then hands its slot back
+void OrderManager::retire(uint32_t slot) {
+    if (orders[slot].retired) return;
+    orders[slot].retired = true;
+    if (finished.size() < MAX_FINISHED) {
+        finished.push_back(slot);
+        return;
+    }
+
+    uint32_t oldest = finished[finished_cursor];
+    finished[finished_cursor] = slot;
+    finished_cursor = (finished_cursor + 1) % MAX_FINISHED;
+    orders[oldest].retired = false;
+    // Came back to life since, e.g. through reconciliation
+    if (!orders[oldest].linked) recycle(oldest);
+}
+
+void OrderManager::recycle(uint32_t slot) {
+    const order& o = orders[slot].data;
+    auto forget = [&](auto& index, const auto& key) {
+        const uint32_t* mapped = index.find(key);
+        if (mapped != nullptr && *mapped == slot) index.erase(key);
+    };
+    if (!o.order_id.empty()) forget(by_order_id, o.order_id);
+    if (o.request_id != 0) {
+        forget(requests, o.request_id);
+        forget(pending_requests, o.request_id);
+    }
+    // The strings keep their capacity for the slot's next order
+    order& data = orders[slot].data;
+    string* strings[] = {&data.order_id, &data.label, &data.instrument_name, &data.order_type, &data.reject_reason};
+    string kept[size(strings)];
+    for (size_t i = 0; i < size(strings); ++i) kept[i] = move(*strings[i]);
+    orders[slot] = entry{};
+    for (size_t i = 0; i < size(strings); ++i) {
+        kept[i].clear();
+        *strings[i] = move(kept[i]);
+    }
+    free_slots.push_back(slot);
+}
+
+void OrderManager::link(uint32_t slot) {
+    entry& e = orders[slot];
+    if (e.linked || !e.data.is_live()) return;
+
+    auto push = [&](auto& heads, const auto& key, links entry::*member) {
+        uint32_t* head = heads.find(key);
+        uint32_t old = head != nullptr ? *head : NIL;
+        orders[slot].*member = {NIL, old};
+        if (old != NIL) (orders[old].*member).prev = slot;
+        heads.insert_or_assign(key, slot);
+    };
+
+    if (!e.data.label.empty()) push(label_heads, e.data.label, &entry::by_label);
+    push(instrument_heads, e.data.instrument_id, &entry::by_instrument);
+
+    uint32_t* live = instrument_live.find(e.data.instrument_id);
+    instrument_live.insert_or_assign(e.data.instrument_id, live != nullptr ? *live + 1 : 1);
+    e.linked = true;
+}
+
+void OrderManager::unlink(uint32_t slot) {
+    entry& e = orders[slot];
+    if (!e.linked) return;
+
+    auto remove = [&](auto& heads, const auto& key, links entry::*member) {
+        links l = orders[slot].*member;
+        if (l.prev != NIL) {
+            (orders[l.prev].*member).next = l.next;
+        } else if (l.next != NIL) {
+            heads.insert_or_assign(key, l.next);
+        } else {
+            heads.erase(key);
+        }
+        if (l.next != NIL) (orders[l.next].*member).prev = l.prev;
+        orders[slot].*member = links{};
+    };
+
+    if (!e.data.label.empty()) remove(label_heads, e.data.label, &entry::by_label);
+    remove(instrument_heads, e.data.instrument_id, &entry::by_instrument);
+
+    uint32_t* live = instrument_live.find(e.data.instrument_id);
+    if (live != nullptr && *live > 1) {
+        --*live;
+    } else {
+        instrument_live.erase(e.data.instrument_id);
+    }
+    e.linked = false;
+}
+
+void OrderManager::apply(uint32_t slot, const order_event& update) {
+    order& o = orders[slot].data;
+
+    if (o.order_id.empty() && !update.order_id.empty()) {
+        o.order_id = update.order_id;
+        by_order_id.insert_or_assign(o.order_id, slot);
+    }
+    if (o.instrument_name.empty()) {
+        o.instrument_name = update.instrument_name;
+        o.instrument_id = update.instrument_id;
+    }
+    if (o.label.empty() && !update.label.empty() && !orders[slot].linked) {
+        o.label = update.label;
+    }
+    if (!update.order_type.empty()) o.order_type = update.order_type;
+
+    o.buy = update.buy;
+    if (update.price > 0) o.price = update.price;
+    if (update.amount > 0) o.amount = update.amount;
+    o.filled_amount = update.filled_amount;
+    o.average_price = update.average_price;
+    o.state = parse_state(update.order_state, update.filled_amount, o.state);
+    // Local receipt time, the clock reconcile_sent_at is taken on
+    o.last_update = utils::time_now();
+
+    if (o.is_live()) {
+        link(slot);
+    } else {
+        unlink(slot);
+        retire(slot);
+    }
+}
+
+uint32_t OrderManager::match_pending(const order_event& update) const {
+    uint32_t match = NIL;
+    pending_requests.for_each([&](long, uint32_t slot) {
+        const order& o = orders[slot].data;
+        if (match == NIL && o.order_id.empty() && o.instrument_id == update.instrument_id &&
+            o.label == update.label && o.buy == update.buy) {
+            match = slot;
+        }
+    });
+    return match;
+}
+
+void OrderManager::apply_json(const json& data) {
+    order_event update = decode::order(data);
+    if (update.order_id.empty()) return;
+    on_order_update(update);
+}
+
+void OrderManager::on_order_sent(long request_id, const string& instrument, const string& label,
+                                 bool buy, double amount, double price, const string& order_type) {
+    uint32_t instrument_id = getInstrumentRegistry().intern(instrument);
+
+    lock_guard<mutex> lock(orders_mutex);
+    uint32_t slot = allocate();
+    order& o = orders[slot].data;
+    o.request_id = request_id;
+    o.instrument_name = instrument;
+    o.instrument_id = instrument_id;
+    o.label = label;
+    o.buy = buy;
+    o.amount = amount;
+    o.price = price;
+    o.order_type = order_type;
+    o.state = OrderState::PENDING_NEW;
+    o.last_update = utils::time_now();
+
+    pending_requests.insert_or_assign(request_id, slot);
+    requests.insert_or_assign(request_id, slot);
+    link(slot);
+}
+
+void OrderManager::on_order_routed(long request_id, int connection_id) {
+    lock_guard<mutex> lock(orders_mutex);
+    const uint32_t* slot = requests.find(request_id);
+    if (slot != nullptr) orders[*slot].data.connection_id = connection_id;
+}
+
+bool OrderManager::on_response(const json& response) {
+    if (!response.contains("id") || !response["id"].is_number_integer()) return false;
+    long id = response["id"].get<long>();
+
+    if (response.contains("result") && response["result"].is_array()) {
+        unique_lock<mutex> lock(orders_mutex);
+        if (id != reconcile_id) return false;
+        reconcile_id = 0;
+        reconcile(response["result"], reconcile_sent_at);
+        reconcile_report report = reconciled;
+        lock.unlock();
+
+        if (reconcile_handler) reconcile_handler(report);
+        return true;
+    }
+
+    {
+        lock_guard<mutex> lock(orders_mutex);
+
+        uint32_t* pending = pending_requests.find(id);
+        if (pending != nullptr) {
+            uint32_t slot = *pending;
+            pending_requests.erase(id);
+
+            if (response.contains("error")) {
+                order& o = orders[slot].data;
+                o.state = OrderState::REJECTED;
+                o.reject_reason = response["error"].value("message", response["error"].dump());
+                o.last_update = utils::time_now();
+                unlink(slot);
+                retire(slot);
+                return true;
+            }
+
+            if (response.contains("result") && response["result"].contains("order")) {
+                order_event update = decode::order(response["result"]["order"]);
+                uint32_t* existing = by_order_id.find(update.order_id);
+                if (existing != nullptr && *existing != slot) {
+                    // A user.orders notification beat the response and created its own entry;
+                    // that entry takes over the request and the pending one is dropped
+                    uint32_t real = *existing;
+                    orders[real].data.connection_id = orders[slot].data.connection_id;
+                    unlink(slot);
+                    orders[slot].data.request_id = 0;
+                    recycle(slot);
+                    orders[real].data.request_id = id;
+                    requests.insert_or_assign(id, real);
+                    apply(real, update);
+                } else {
+                    apply(slot, update);
+                }
+            }
+            return true;
+        }
+    }
+
+    // Edits return {order, trades}, cancels return the order itself
+    if (!response.contains("result") || !response["result"].is_object()) return false;
+    const json& result = response["result"];
+    if (result.contains("order") && result["order"].is_object()) {
+        apply_json(result["order"]);
+        return true;
+    }
+    if (result.contains("order_id") && result.contains("order_state")) {
+        apply_json(result);
+        return true;
+    }
+    return false;
+}
+
+bool OrderManager::on_order_dropped(long request_id, const string& reason) {
+    lock_guard<mutex> lock(orders_mutex);
+    uint32_t* pending = pending_requests.find(request_id);
+    if (pending == nullptr) return false;
+
+    uint32_t slot = *pending;
+    pending_requests.erase(request_id);
+    order& o = orders[slot].data;
+    o.state = OrderState::REJECTED;
+    o.reject_reason = reason;
+    o.last_update = utils::time_now();
+    unlink(slot);
+    retire(slot);
+    return true;
+}
+
+void OrderManager::on_order_update(const order_event& update) {
+    if (update.order_id.empty()) return;
+
+    lock_guard<mutex> lock(orders_mutex);
+    uint32_t* existing = by_order_id.find(update.order_id);
+    uint32_t slot = existing != nullptr ? *existing : match_pending(update);
+    if (slot == NIL) slot = allocate();
+    apply(slot, update);
+}
+
+optional<order> OrderManager::find(string_view order_id) const {
+    lock_guard<mutex> lock(orders_mutex);
+    const uint32_t* slot = by_order_id.find(order_id);
+    if (slot == nullptr) return nullopt;
+    return orders[*slot].data;
+}
+
+optional<order> OrderManager::find_request(long request_id) const {
+    lock_guard<mutex> lock(orders_mutex);
+    const uint32_t* slot = pending_requests.find(request_id);
+    if (slot == nullptr) return nullopt;
+    return orders[*slot].data;
+}
+
+optional<order> OrderManager::by_request(long request_id) const {
+    lock_guard<mutex> lock(orders_mutex);
+    const uint32_t* slot = requests.find(request_id);
+    if (slot == nullptr) return nullopt;
+    return orders[*slot].data;
+}
+
+template <typename Index, typename Key>
+vector<order> OrderManager::collect(const Index& index, const Key& key, links entry::*member) const {
+    vector<order> result;
+    const uint32_t* head = index.find(key);
+    for (uint32_t slot = head != nullptr ? *head : NIL; slot != NIL; slot = (orders[slot].*member).next) {
+        result.push_back(orders[slot].data);
+    }
+    return result;
+}
+
+vector<order> OrderManager::by_label(string_view label) const {
+    lock_guard<mutex> lock(orders_mutex);
+    return collect(label_heads, label, &entry::by_label);
+}
+
+vector<order> OrderManager::by_instrument(uint32_t instrument_id) const {
+    lock_guard<mutex> lock(orders_mutex);
+    return collect(instrument_heads, instrument_id, &entry::by_instrument);
+}
+
+vector<order> OrderManager::live_orders() const {
+    lock_guard<mutex> lock(orders_mutex);
+    vector<order> result;
+    for (const auto& e : orders) {
+        if (e.linked) result.push_back(e.data);
+    }
+    return result;
+}
+
+size_t OrderManager::live_count(uint32_t instrument_id) const {
+    lock_guard<mutex> lock(orders_mutex);
+    const uint32_t* live = instrument_live.find(instrument_id);
+    return live != nullptr ? *live : 0;
+}
+
+vector<order> OrderManager::open_orders(string_view currency, string_view label) const {
+    lock_guard<mutex> lock(orders_mutex);
+    if (!label.empty()) {
+        vector<order> result;
+        for (const auto& o : collect(label_heads, label, &entry::by_label)) {
+            if (currency.empty() || settles_in(o, currency)) result.push_back(o);
+        }
+        return result;
+    }
+
+    vector<order> result;
+    for (const auto& e : orders) {
+        if (e.linked && (currency.empty() || settles_in(e.data, currency))) result.push_back(e.data);
+    }
+    return result;
+}
+
+string OrderManager::reconcile_request() {
+    jsonrpc j("private/get_open_orders");
+    j["params"] = json::object();
+
+    lock_guard<mutex> lock(orders_mutex);
+    reconcile_id = j["id"].get<long>();
+    reconcile_sent_at = utils::time_now();
+    return j.dump();
+}
+
+void OrderManager::on_reconcile(function<void(const reconcile_report&)> fn) {
+    lock_guard<mutex> lock(orders_mutex);
+    reconcile_handler = move(fn);
+}
+
+reconcile_report OrderManager::last_reconcile() const {
+    lock_guard<mutex> lock(orders_mutex);
+    return reconciled;
+}
+
+void OrderManager::reconcile(const json& snapshot, long long sent_at) {
+    reconcile_report report;
+    open_hash_map<string, bool, hash<string_view>> seen(snapshot.size());
+
+    for (const auto& item : snapshot) {
+        order_event update = decode::order(item);
+        if (update.order_id.empty()) continue;
+        seen.insert_or_assign(update.order_id, true);
+
+        uint32_t* existing = by_order_id.find(update.order_id);
+        if (existing == nullptr) {
+            report.added++;
+            report.details.push_back("missing locally: " + update.order_id + " " + update.instrument_name);
+            uint32_t slot = match_pending(update);
+            if (slot == NIL) slot = allocate();
+            apply(slot, update);
+            continue;
+        }
+
+        // Local state changed after the snapshot was requested; it is the newer view
+        order& o = orders[*existing].data;
+        if (o.last_update >= sent_at) continue;
+
+        if (!orders[*existing].linked) {
+            report.added++;
+            report.details.push_back("finished locally, open on exchange: " + update.order_id + " " +
+                                     update.instrument_name);
+            apply(*existing, update);
+            continue;
+        }
+
+        if (o.filled_amount != update.filled_amount || o.amount != update.amount || o.price != update.price) {
+            report.updated++;
+            report.details.push_back(fmt::format("{}: local {}/{} @ {}, exchange {}/{} @ {}",
+                                                 o.order_id, o.filled_amount, o.amount, o.price,
+                                                 update.filled_amount, update.amount, update.price));
+            apply(*existing, update);
+        }
+    }
+
+    for (uint32_t slot = 0; slot < orders.size(); ++slot) {
+        order& o = orders[slot].data;
+        if (!orders[slot].linked || o.order_id.empty() || seen.find(o.order_id) != nullptr) continue;
+        if (o.last_update >= sent_at) continue;
+
+        report.closed++;
+        report.details.push_back("closed on exchange: " + o.order_id + " " + o.instrument_name);
+        o.state = OrderState::CANCELLED;
+        o.reject_reason = "closed on exchange (reconciled)";
+        o.last_update = utils::time_now();
+        unlink(slot);
+        retire(slot);
+    }
+
+    reconciled = move(report);
+    is_synced.store(true, memory_order_release);
+}
+
+OrderManager& getOrderManager() {
+    return accounts::local<OrderManager>();
+}
+
+OrderManager& getOrderManager(size_t account) {
+    return accounts::local<OrderManager>(account);
+}
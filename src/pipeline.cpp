@@ -0,0 +1,62 @@
+#include "pipeline.hpp"
+#include "util.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <sched.h>
+
+using namespace std;
+
+const char* stage_name(PipelineStage stage) {
+    switch (stage) {
+        case PipelineStage::IO: return "IO";
+        case PipelineStage::DECODE: return "DECODE";
+        case PipelineStage::LOGIC: return "LOGIC";
+    }
+    return "UNKNOWN";
+}
+
+stage_config stage_config_from_env(PipelineStage stage) {
+    stage_config config;
+    string prefix = string("DERIBIT_PIPELINE_") + stage_name(stage) + "_";
+
+    if (const char* cpu = getenv((prefix + "CPU").c_str())) config.cpu = atoi(cpu);
+    if (const char* policy = getenv((prefix + "POLICY").c_str())) {
+        if (strcmp(policy, "fifo") == 0) config.policy = SCHED_FIFO;
+        else if (strcmp(policy, "rr") == 0) config.policy = SCHED_RR;
+        else config.policy = SCHED_OTHER;
+    }
+    if (const char* priority = getenv((prefix + "PRIORITY").c_str())) config.priority = atoi(priority);
+    if (const char* spin = getenv((prefix + "SPIN").c_str())) config.spin = strtoul(spin, nullptr, 10);
+    return config;
+}
+
+bool apply_stage_config(PipelineStage stage, const stage_config& config) {
+    bool applied = true;
+    pthread_t self = pthread_self();
+
+    if (config.cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(config.cpu, &cpus);
+        if (pthread_setaffinity_np(self, sizeof(cpus), &cpus) != 0) {
+            utils::printerr(string("> Could not pin ") + stage_name(stage) + " stage to CPU " +
+                            to_string(config.cpu) + "\n");
+            applied = false;
+        }
+    }
+
+    if (config.policy != SCHED_OTHER) {
+        sched_param param{};
+        param.sched_priority = config.priority;
+        if (pthread_setschedparam(self, config.policy, &param) != 0) {
+            // Real-time policies need CAP_SYS_NICE
+            utils::printerr(string("> Could not set scheduling policy for ") + stage_name(stage) + " stage\n");
+            applied = false;
+        }
+    }
+
+    string name = string("deribit-") + stage_name(stage);
+    pthread_setname_np(self, name.substr(0, 15).c_str());
+    return applied;
+}
@@ -0,0 +1,326 @@
+#include "plugins.hpp"
+#include "accounts.hpp"
+#include "dispatcher.hpp"
+#include "pipeline.hpp"
+#include "tracker.hpp"
+#include "util.hpp"
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+    vector<string> split_list(const char* list) {
+        vector<string> items;
+        if (list == nullptr) return items;
+        stringstream ss(list);
+        string item;
+        while (getline(ss, item, ',')) {
+            if (!item.empty()) items.push_back(item);
+        }
+        return items;
+    }
+
+    string file_name(const string& path) {
+        size_t slash = path.rfind('/');
+        return slash == string::npos ? path : path.substr(slash + 1);
+    }
+
+    const char* callback_name(size_t callback) {
+        static const char* names[] = {"book", "trades", "ticker", "order", "fill", "task"};
+        return names[callback];
+    }
+}
+
+long StrategyHost::plugin::submit(const api::order_request& request) {
+    return requests->submit(request);
+}
+
+bool StrategyHost::plugin::cancel(const string& order_id) {
+    return sessions->route(*owner, "cancel " + order_id);
+}
+
+bool StrategyHost::plugin::cancel_all() {
+    return sessions->route(*owner, "cancel_all");
+}
+
+void StrategyHost::plugin::post(function<void()> task) {
+    {
+        lock_guard<mutex> lock(queue_mutex);
+        queue.push_back(move(task));
+    }
+    wake.notify_one();
+}
+
+size_t StrategyHost::load_from_env(SessionStore& sessions) {
+    vector<string> paths = split_list(getenv("DERIBIT_STRATEGIES"));
+    vector<string> cpus = split_list(getenv("DERIBIT_STRATEGY_CPUS"));
+
+    size_t count = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        int cpu = i < cpus.size() ? atoi(cpus[i].c_str()) : -1;
+        if (load(paths[i], sessions, sessions.get(0), cpu)) count++;
+    }
+    return count;
+}
+
+bool StrategyHost::load(const string& path, SessionStore& sessions, session& owner, int cpu) {
+    {
+        shared_lock<shared_mutex> lock(plugins_mutex);
+        for (const auto& p : plugins) {
+            if (p->path == path) {
+                utils::printerr("> Strategy " + path + " is already loaded; reload it instead\n");
+                return false;
+            }
+        }
+    }
+
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (handle == nullptr) {
+        utils::printerr("> Could not load strategy " + path + ": " + dlerror() + "\n");
+        return false;
+    }
+
+    auto abi = reinterpret_cast<strategy_abi_fn>(dlsym(handle, "deribit_strategy_abi"));
+    auto create = reinterpret_cast<create_strategy_fn>(dlsym(handle, "deribit_create_strategy"));
+    auto destroy = reinterpret_cast<destroy_strategy_fn>(dlsym(handle, "deribit_destroy_strategy"));
+    if (abi == nullptr || create == nullptr || destroy == nullptr) {
+        utils::printerr("> " + path + " does not export a strategy (missing DERIBIT_STRATEGY)\n");
+        dlclose(handle);
+        return false;
+    }
+    if (abi() != DERIBIT_STRATEGY_ABI_VERSION) {
+        utils::printerr("> " + path + " was built against strategy ABI " + to_string(abi()) +
+                        ", expected " + to_string(DERIBIT_STRATEGY_ABI_VERSION) + "\n");
+        dlclose(handle);
+        return false;
+    }
+
+    Strategy* strategy = create();
+    if (strategy == nullptr) {
+        utils::printerr("> " + path + " did not create a strategy\n");
+        dlclose(handle);
+        return false;
+    }
+
+    call_once(handlers_registered, [this] { register_handlers(); });
+
+    auto p = make_unique<plugin>();
+    p->path = path;
+    p->sessions = &sessions;
+    p->owner = &owner;
+    p->cpu = cpu;
+    p->handle = handle;
+    p->strategy = strategy;
+    p->destroy = destroy;
+    p->alive->target = p.get();
+    p->requests = make_unique<AsyncSession>(owner, [alive = p->alive](function<void()> task) {
+        lock_guard<mutex> lock(alive->target_mutex);
+        if (alive->target != nullptr) alive->target->post(move(task));
+    });
+    p->worker = thread(&StrategyHost::run, this, ref(*p));
+
+    unique_lock<shared_mutex> lock(plugins_mutex);
+    plugins.push_back(move(p));
+    loaded.store(plugins.size(), memory_order_release);
+    return true;
+}
+
+bool StrategyHost::reload(const string& path) {
+    SessionStore* sessions = nullptr;
+    session* owner = nullptr;
+    int cpu = -1;
+    {
+        shared_lock<shared_mutex> lock(plugins_mutex);
+        for (const auto& p : plugins) {
+            if (p->path != path) continue;
+            sessions = p->sessions;
+            owner = p->owner;
+            cpu = p->cpu;
+        }
+    }
+    if (owner == nullptr || !unload(path)) {
+        utils::printerr("> Strategy " + path + " is not loaded\n");
+        return false;
+    }
+    return load(path, *sessions, *owner, cpu);
+}
+
+bool StrategyHost::unload(const string& path) {
+    unique_ptr<plugin> removed;
+    {
+        unique_lock<shared_mutex> lock(plugins_mutex);
+        for (auto it = plugins.begin(); it != plugins.end(); ++it) {
+            if ((*it)->path != path) continue;
+            removed = move(*it);
+            plugins.erase(it);
+            break;
+        }
+        loaded.store(plugins.size(), memory_order_release);
+    }
+    // Joined outside the lock so publishers never wait on a strategy shutting down
+    if (!removed) return false;
+    stop(*removed);
+    return true;
+}
+
+void StrategyHost::unload_all() {
+    vector<unique_ptr<plugin>> removed;
+    {
+        unique_lock<shared_mutex> lock(plugins_mutex);
+        removed.swap(plugins);
+        loaded.store(0, memory_order_release);
+    }
+    for (auto& p : removed) stop(*p);
+}
+
+void StrategyHost::stop(plugin& p) {
+    {
+        lock_guard<mutex> lock(p.alive->target_mutex);
+        p.alive->target = nullptr;
+    }
+    {
+        lock_guard<mutex> lock(p.queue_mutex);
+        p.running = false;
+    }
+    p.wake.notify_one();
+    p.worker.join();
+
+    // Awaited replies and the tasks resuming them hold handlers built by the
+    // strategy's code, so they go before it is unloaded
+    p.requests->abandon();
+    p.queue.clear();
+    p.destroy(p.strategy);
+    dlclose(p.handle);
+}
+
+void StrategyHost::register_handlers() {
+    ChannelDispatcher& dispatcher = getChannelDispatcher();
+
+    dispatcher.on_book([this](const book_event& e) { publish(e, 0, true); });
+    dispatcher.on_trades([this](const trades_event& e) { publish(e, 0, true); });
+    dispatcher.on_ticker([this](const ticker_event& e) { publish(e, 0, true); });
+
+    // Private channels are dispatched bound to the account they belong to
+    dispatcher.on_user_orders([this](const user_orders_event& e) {
+        for (const auto& o : e.orders) publish(o, accounts::current(), false);
+    });
+    dispatcher.on_user_trades([this](const user_trades_event& e) {
+        for (const auto& t : e.trades) publish(t, accounts::current(), false);
+    });
+}
+
+void StrategyHost::publish(const strategy_event& event, size_t account, bool market_data) {
+    if (loaded.load(memory_order_acquire) == 0) return;
+
+    shared_lock<shared_mutex> lock(plugins_mutex);
+    for (auto& p : plugins) {
+        if (!market_data && p->owner->account != account) continue;
+        {
+            lock_guard<mutex> queue_lock(p->queue_mutex);
+            if (market_data && p->queue.size() >= MAX_QUEUED) {
+                p->dropped.fetch_add(1, memory_order_relaxed);
+                continue;
+            }
+            p->queue.push_back(event);
+        }
+        p->wake.notify_one();
+    }
+}
+
+void StrategyHost::run(plugin& p) {
+    accounts::bind(p.owner->account);
+    stage_config config = stage_config_from_env(PipelineStage::LOGIC);
+    config.cpu = p.cpu;
+    apply_stage_config(PipelineStage::LOGIC, config);
+    pthread_setname_np(pthread_self(), ("strat-" + file_name(p.path)).substr(0, 15).c_str());
+
+    p.strategy->on_start(p);
+
+    strategy_event event;
+    while (true) {
+        {
+            unique_lock<mutex> lock(p.queue_mutex);
+            p.wake.wait(lock, [&p] { return !p.queue.empty() || !p.running; });
+            if (!p.running) break;
+            event = move(p.queue.front());
+            p.queue.pop_front();
+        }
+
+        size_t callback = event.index();
+        auto start = chrono::steady_clock::now();
+        try {
+            switch (static_cast<StrategyCallback>(callback)) {
+                case StrategyCallback::BOOK:   p.strategy->on_book(get<book_event>(event)); break;
+                case StrategyCallback::TRADES: p.strategy->on_trades(get<trades_event>(event)); break;
+                case StrategyCallback::TICKER: p.strategy->on_ticker(get<ticker_event>(event)); break;
+                case StrategyCallback::ORDER:  p.strategy->on_order(get<order_event>(event)); break;
+                case StrategyCallback::FILL:   p.strategy->on_fill(get<trade_event>(event)); break;
+                case StrategyCallback::TASK:   get<function<void()>>(event)(); break;
+                default: break;
+            }
+        } catch (const exception& e) {
+            utils::printerr("> Strategy " + p.path + " threw in on_" + callback_name(callback) + ": " +
+                            e.what() + "\n");
+        }
+        auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+
+        auto& counters = p.callbacks[callback];
+        uint64_t ns = elapsed.count();
+        counters.calls.fetch_add(1, memory_order_relaxed);
+        counters.total_ns.fetch_add(ns, memory_order_relaxed);
+        if (ns > counters.max_ns.load(memory_order_relaxed)) counters.max_ns.store(ns, memory_order_relaxed);
+
+        getLatencyTracker().record(LatencyTracker::STRATEGY_CALLBACK, elapsed);
+        if (elapsed > SLOW_CALLBACK) getLatencyTracker().count_event("strategy_slow." + file_name(p.path));
+    }
+
+    p.strategy->on_stop();
+}
+
+vector<strategy_load> StrategyHost::load_stats() const {
+    vector<strategy_load> result;
+    shared_lock<shared_mutex> lock(plugins_mutex);
+    for (const auto& p : plugins) {
+        strategy_load l;
+        l.path = p->path;
+        l.account = p->owner->account;
+        l.cpu = p->cpu;
+        l.dropped = p->dropped.load(memory_order_relaxed);
+        {
+            lock_guard<mutex> queue_lock(p->queue_mutex);
+            l.queued = p->queue.size();
+        }
+        for (size_t c = 0; c < l.callbacks.size(); ++c) {
+            l.callbacks[c] = {p->callbacks[c].calls.load(), p->callbacks[c].total_ns.load(),
+                              p->callbacks[c].max_ns.load()};
+        }
+        result.push_back(move(l));
+    }
+    return result;
+}
+
+string StrategyHost::report() const {
+    vector<strategy_load> all = load_stats();
+    if (all.empty()) return "";
+
+    ostringstream os;
+    os << "Strategies:\n";
+    for (const auto& l : all) {
+        os << fmt::format("  {} (account {}, cpu {:>2}): {} queued, {} market data updates dropped\n",
+                          l.path, l.account, l.cpu, l.queued, l.dropped);
+        for (size_t c = 0; c < l.callbacks.size(); ++c) {
+            const strategy_callback_stats& s = l.callbacks[c];
+            if (s.calls == 0) continue;
+            os << fmt::format("    on_{:<7} {:>9} calls  {:8.2f} us mean  {:8.2f} us max\n",
+                              callback_name(c), s.calls, s.total_ns / 1000.0 / s.calls, s.max_ns / 1000.0);
+        }
+    }
+    return os.str();
+}
+
+StrategyHost& getStrategyHost() {
+    static StrategyHost host;
+    return host;
+}
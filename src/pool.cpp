@@ -0,0 +1,73 @@
+#include "pool.hpp"
+
+#include <array>
+#include <cstdlib>
+#include <fmt/core.h>
+#include <mutex>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+    // Trivially initialised, so counting works before any constructor has run
+    thread_local uint64_t thread_allocations = 0;
+    atomic<bool> counting{false};
+
+    struct path_counters {
+        atomic<uint64_t> passes{0};
+        atomic<uint64_t> allocations{0};
+    };
+
+    array<path_counters, static_cast<size_t>(HotPath::COUNT)> paths;
+
+    const char* path_names[] = {"dispatch", "order entry", "request"};
+
+    mutex pools_mutex;
+
+    vector<pair<string, uint64_t (*)()>>& pools() {
+        static vector<pair<string, uint64_t (*)()>> registered;
+        return registered;
+    }
+}
+
+void count_heap_allocation() {
+    if (thread_allocations++ == 0) counting.store(true, memory_order_relaxed);
+}
+
+uint64_t heap_allocations() {
+    return thread_allocations;
+}
+
+alloc_probe::~alloc_probe() {
+    path_counters& counters = paths[static_cast<size_t>(path)];
+    counters.passes.fetch_add(1, memory_order_relaxed);
+    counters.allocations.fetch_add(heap_allocations() - start, memory_order_relaxed);
+}
+
+void track_pool(const string& name, uint64_t (*allocated)()) {
+    lock_guard<mutex> lock(pools_mutex);
+    for (const auto& pool : pools()) {
+        if (pool.first == name) return;
+    }
+    pools().emplace_back(name, allocated);
+}
+
+string allocation_report() {
+    ostringstream os;
+    os << "Heap allocations per pass:\n";
+    bool counted = counting.load(memory_order_relaxed);
+    if (!counted) os << "  not counted in this build\n";
+    for (size_t i = 0; counted && i < paths.size(); ++i) {
+        uint64_t passes = paths[i].passes.load(memory_order_relaxed);
+        uint64_t allocations = paths[i].allocations.load(memory_order_relaxed);
+        if (passes == 0) continue;
+        os << fmt::format("  {:<12} {:8.2f}  ({} passes)\n", path_names[i],
+                          static_cast<double>(allocations) / passes, passes);
+    }
+
+    lock_guard<mutex> lock(pools_mutex);
+    for (const auto& pool : pools()) {
+        os << fmt::format("  pool {:<20} {} objects built\n", pool.first, pool.second());
+    }
+    return os.str();
+}
@@ -0,0 +1,258 @@
+#include "portfolio.hpp"
+#include "accounts.hpp"
+#include "api.hpp"
+#include "dispatcher.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <cmath>
+#include <mutex>
+
+using namespace std;
+
+namespace {
+    constexpr double EPSILON = 1e-9;
+
+    bool is_flat(double size) { return fabs(size) < EPSILON; }
+}
+
+position& PortfolioCache::slot(uint32_t instrument_id, string_view name) {
+    if (instrument_id >= by_instrument.size()) {
+        by_instrument.resize(max<size_t>(instrument_id + 1, by_instrument.size() * 2));
+    }
+
+    position& p = by_instrument[instrument_id];
+    if (p.instrument_name.empty()) {
+        p.instrument_id = instrument_id;
+        p.instrument_name = string(name);
+
+        if (optional<instrument_info> info = getInstrumentRegistry().get(instrument_id); info && info->listed) {
+            p.currency = info->base_currency;
+            p.kind = info->kind;
+            p.inverse = info->inverse && info->kind == InstrumentKind::FUTURE;
+        } else {
+            // Unlisted: BTC-PERPETUAL style names are inverse futures, -C/-P suffixes are options
+            p.currency = string(name.substr(0, name.find_first_of("-_")));
+            bool option = name.size() > 2 && name[name.size() - 2] == '-' &&
+                          (name.back() == 'C' || name.back() == 'P');
+            p.kind = option ? InstrumentKind::OPTION : InstrumentKind::FUTURE;
+            p.inverse = !option && name.find('_') == string_view::npos;
+        }
+    }
+    return p;
+}
+
+void PortfolioCache::mark(position& p, double price) {
+    if (price <= 0) return;
+    p.mark_price = price;
+    if (is_flat(p.size) || p.average_price <= 0) {
+        p.unrealized_pnl = 0;
+    } else if (p.inverse) {
+        p.unrealized_pnl = p.size * (1.0 / p.average_price - 1.0 / price);
+    } else {
+        p.unrealized_pnl = p.size * (price - p.average_price);
+    }
+}
+
+position PortfolioCache::marked(const position& p) const {
+    position copy = p;
+    const ticker_mark* ticker = ticker_marks.find(p.instrument_id);
+    if (ticker == nullptr) return copy;
+
+    double index_price = ticker->index_price.load(memory_order_relaxed);
+    double mark_price = ticker->mark_price.load(memory_order_relaxed);
+    if (index_price > 0) copy.index_price = index_price;
+    if (mark_price > 0) {
+        copy.marked_by_ticker = true;
+        mark(copy, mark_price);
+    }
+    return copy;
+}
+
+bool PortfolioCache::seen_trade(const string& trade_id) {
+    if (trade_id.empty()) return false;
+    if (applied_trades.find(trade_id) != nullptr) return true;
+
+    if (trade_history.size() < TRADE_HISTORY) {
+        trade_history.push_back(trade_id);
+    } else {
+        applied_trades.erase(trade_history[trade_cursor]);
+        trade_history[trade_cursor] = trade_id;
+        trade_cursor = (trade_cursor + 1) % TRADE_HISTORY;
+    }
+    applied_trades.insert_or_assign(trade_id, true);
+    return false;
+}
+
+void PortfolioCache::apply_trade(const trade_event& trade) {
+    if (trade.amount <= 0 || trade.price <= 0 || seen_trade(trade.trade_id)) return;
+
+    position& p = slot(trade.instrument_id, trade.instrument_name);
+    double qty = trade.buy ? trade.amount : -trade.amount;
+    double held = fabs(p.size);
+
+    if (is_flat(p.size) || (p.size > 0) == (qty > 0)) {
+        // Adding: inverse contracts average harmonically, linear ones arithmetically
+        double total = held + trade.amount;
+        p.average_price = p.inverse
+            ? total / (held / max(p.average_price, EPSILON) + trade.amount / trade.price)
+            : (held * p.average_price + trade.amount * trade.price) / total;
+        if (is_flat(p.size)) p.average_price = trade.price;
+    } else {
+        double closed = min(held, trade.amount);
+        double direction = p.size > 0 ? 1.0 : -1.0;
+        p.realized_pnl += p.inverse
+            ? closed * direction * (1.0 / p.average_price - 1.0 / trade.price)
+            : closed * direction * (trade.price - p.average_price);
+
+        // Flipped through zero: the remainder opens at the trade price
+        if (trade.amount > held) p.average_price = trade.price;
+    }
+
+    p.size += qty;
+    if (is_flat(p.size)) {
+        p.size = 0;
+        p.average_price = 0;
+    }
+    p.realized_pnl -= trade.fee;
+    p.last_update = trade.timestamp > 0 ? trade.timestamp : utils::time_now();
+    mark(p, trade.mark_price > 0 ? trade.mark_price : p.mark_price);
+}
+
+void PortfolioCache::apply_position(const position_event& update) {
+    position& p = slot(update.instrument_id, update.instrument_name);
+    p.size = update.size;
+    p.average_price = update.average_price;
+    p.index_price = update.index_price;
+    p.realized_pnl = update.realized_profit_loss;
+    p.initial_margin = update.initial_margin;
+    p.maintenance_margin = update.maintenance_margin;
+    p.last_update = utils::time_now();
+    mark(p, update.mark_price);
+    if (update.mark_price <= 0) p.unrealized_pnl = update.floating_profit_loss;
+}
+
+void PortfolioCache::on_trade(const trade_event& trade) {
+    unique_lock<shared_mutex> lock(portfolio_mutex);
+    apply_trade(trade);
+}
+
+void PortfolioCache::on_position(const position_event& update) {
+    unique_lock<shared_mutex> lock(portfolio_mutex);
+    apply_position(update);
+}
+
+void PortfolioCache::on_changes(const user_changes_event& changes) {
+    unique_lock<shared_mutex> lock(portfolio_mutex);
+    // The positions already include these trades, so only record them as applied
+    if (!changes.positions.empty()) {
+        for (const auto& t : changes.trades) seen_trade(t.trade_id);
+        for (const auto& p : changes.positions) apply_position(p);
+        return;
+    }
+    for (const auto& t : changes.trades) apply_trade(t);
+}
+
+void PortfolioCache::on_portfolio(const portfolio_event& update) {
+    unique_lock<shared_mutex> lock(portfolio_mutex);
+    for (auto& account : accounts) {
+        if (account.currency == update.currency) {
+            account = update;
+            return;
+        }
+    }
+    accounts.push_back(update);
+}
+
+void PortfolioCache::on_ticker(const ticker_event& ticker) {
+    ticker_mark* slot = ticker_marks.at(ticker.instrument_id);
+    if (slot == nullptr) return;
+    if (ticker.index_price > 0) slot->index_price.store(ticker.index_price, memory_order_relaxed);
+    if (ticker.mark_price > 0) slot->mark_price.store(ticker.mark_price, memory_order_relaxed);
+}
+
+void PortfolioCache::on_index(const price_index_event& index) {
+    unique_lock<shared_mutex> lock(portfolio_mutex);
+    for (auto& p : by_instrument) {
+        if (p.instrument_name.empty() || p.currency != index.currency) continue;
+        p.index_price = index.price;
+        // Futures without a ticker feed are marked at the index; option marks are not index prices
+        const ticker_mark* ticker = ticker_marks.find(p.instrument_id);
+        bool ticked = ticker != nullptr && ticker->mark_price.load(memory_order_relaxed) > 0;
+        if (!ticked && p.kind == InstrumentKind::FUTURE) mark(p, index.price);
+    }
+}
+
+string PortfolioCache::snapshot_request() {
+    jsonrpc j("private/get_positions");
+    j["params"] = {{"currency", "any"}};
+
+    unique_lock<shared_mutex> lock(portfolio_mutex);
+    snapshot_id = j["id"].get<long>();
+    return j.dump();
+}
+
+bool PortfolioCache::on_response(const json& response) {
+    if (!response.contains("id") || !response["id"].is_number_integer() ||
+        !response.contains("result") || !response["result"].is_array()) {
+        return false;
+    }
+
+    unique_lock<shared_mutex> lock(portfolio_mutex);
+    if (response["id"].get<long>() != snapshot_id) return false;
+    snapshot_id = 0;
+
+    // Anything not in the snapshot is flat
+    for (auto& p : by_instrument) {
+        p.size = 0;
+        p.average_price = 0;
+        p.unrealized_pnl = 0;
+    }
+    for (const auto& item : response["result"]) {
+        apply_position(decode::position(item));
+    }
+    is_synced.store(true, memory_order_release);
+    return true;
+}
+
+double PortfolioCache::exposure(uint32_t instrument_id) const {
+    shared_lock<shared_mutex> lock(portfolio_mutex);
+    return instrument_id < by_instrument.size() ? by_instrument[instrument_id].size : 0.0;
+}
+
+optional<position> PortfolioCache::get(uint32_t instrument_id) const {
+    shared_lock<shared_mutex> lock(portfolio_mutex);
+    if (instrument_id >= by_instrument.size() || by_instrument[instrument_id].instrument_name.empty()) {
+        return nullopt;
+    }
+    return marked(by_instrument[instrument_id]);
+}
+
+vector<position> PortfolioCache::positions(string_view currency, string_view kind) const {
+    InstrumentKind wanted = kind.empty() ? InstrumentKind::UNKNOWN : parse_instrument_kind(kind);
+
+    shared_lock<shared_mutex> lock(portfolio_mutex);
+    vector<position> result;
+    for (const auto& p : by_instrument) {
+        if (p.instrument_name.empty() || is_flat(p.size)) continue;
+        if (!currency.empty() && p.currency != currency) continue;
+        if (wanted != InstrumentKind::UNKNOWN && p.kind != wanted) continue;
+        result.push_back(marked(p));
+    }
+    return result;
+}
+
+optional<portfolio_event> PortfolioCache::account(string_view currency) const {
+    shared_lock<shared_mutex> lock(portfolio_mutex);
+    for (const auto& account : accounts) {
+        if (account.currency == currency) return account;
+    }
+    return nullopt;
+}
+
+PortfolioCache& getPortfolioCache() {
+    return accounts::local<PortfolioCache>();
+}
+
+PortfolioCache& getPortfolioCache(size_t account) {
+    return accounts::local<PortfolioCache>(account);
+}
@@ -0,0 +1,229 @@
+#include "ratelimit.hpp"
+#include "json.hpp"
+#include <algorithm>
+
+using namespace std;
+
+using json = nlohmann::json;
+
+namespace {
+    // "method":"private/buy" as written by json::dump()
+    string_view method_of(string_view message) {
+        constexpr string_view key = "\"method\":\"";
+        size_t start = message.find(key);
+        if (start == string_view::npos) return {};
+        start += key.size();
+        size_t end = message.find('"', start);
+        return end == string_view::npos ? string_view() : message.substr(start, end - start);
+    }
+
+    bool starts_with(string_view text, string_view prefix) {
+        return text.substr(0, prefix.size()) == prefix;
+    }
+}
+
+credit_bucket::credit_bucket(double capacity, double refill_per_second, double cost)
+    : capacity(capacity), refill_per_second(refill_per_second), cost(cost), credits(capacity),
+      last_refill(chrono::steady_clock::now()) {}
+
+void credit_bucket::refill(chrono::steady_clock::time_point now) {
+    double elapsed = chrono::duration<double>(now - last_refill).count();
+    credits = min(capacity, credits + elapsed * refill_per_second);
+    last_refill = now;
+}
+
+bool credit_bucket::try_take(chrono::steady_clock::time_point now) {
+    refill(now);
+    if (credits < cost) return false;
+    credits -= cost;
+    return true;
+}
+
+chrono::nanoseconds credit_bucket::time_until_available(chrono::steady_clock::time_point now) {
+    refill(now);
+    if (credits >= cost) return chrono::nanoseconds(0);
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::duration<double>((cost - credits) / refill_per_second));
+}
+
+RateLimiter::RateLimiter()
+    : matching(20000, 5000, 1000),
+      non_matching(50000, 10000, 500) {}
+
+void RateLimiter::set_bucket(RequestClass type, double capacity, double refill_per_second, double cost) {
+    lock_guard<mutex> lock(limiter_mutex);
+    bucket(type) = credit_bucket(capacity, refill_per_second, cost);
+}
+
+void RateLimiter::set_mode(ThrottleMode mode) {
+    lock_guard<mutex> lock(limiter_mutex);
+    throttle_mode = mode;
+}
+
+credit_bucket& RateLimiter::bucket(RequestClass type) {
+    return type == RequestClass::MATCHING_ENGINE ? matching : non_matching;
+}
+
+RequestClass RateLimiter::classify(string_view message) {
+    static constexpr string_view matching_methods[] = {
+        "private/buy", "private/sell", "private/edit", "private/edit_by_label",
+        "private/cancel", "private/cancel_all", "private/cancel_by_label",
+        "private/close_position", "private/mass_quote", "private/cancel_quotes"
+    };
+
+    string_view method = method_of(message);
+    for (string_view m : matching_methods) {
+        // cancel_all_by_currency and friends share the cancel_all prefix
+        if (method == m || (m == "private/cancel_all" && starts_with(method, m))) {
+            return RequestClass::MATCHING_ENGINE;
+        }
+    }
+    return RequestClass::NON_MATCHING_ENGINE;
+}
+
+bool RateLimiter::is_cancel(string_view message) {
+    return starts_with(method_of(message), "private/cancel");
+}
+
+SendPriority RateLimiter::priority(string_view message) {
+    string_view method = method_of(message);
+    if (starts_with(method, "private/cancel")) return SendPriority::CANCEL;
+    if (starts_with(method, "private/edit")) return SendPriority::AMEND;
+    if (method == "private/buy" || method == "private/sell" || method == "private/close_position" ||
+        method == "private/mass_quote") {
+        return SendPriority::NEW_ORDER;
+    }
+    return SendPriority::QUERY;
+}
+
+RateLimiter::Decision RateLimiter::admit(const string& message, bool congested, long* superseded) {
+    RequestClass type = classify(message);
+    size_t level = static_cast<size_t>(priority(message));
+    auto now = chrono::steady_clock::now();
+
+    // Edits are parsed before taking the lock, in case they have to be coalesced
+    json edit;
+    string order_id;
+    if (method_of(message) == "private/edit") {
+        edit = json::parse(message, nullptr, false);
+        if (!edit.is_discarded() && edit.contains("params") && edit["params"].is_object() &&
+            edit.contains("id") && edit["id"].is_number_integer()) {
+            order_id = edit["params"].value("order_id", "");
+        }
+    }
+
+    lock_guard<mutex> lock(limiter_mutex);
+
+    // Only frames of equal or higher priority drawing on the same bucket go first
+    bool clear_ahead = !congested;
+    for (size_t p = 0; p <= level && clear_ahead; ++p) {
+        for (const auto& queued : lanes[p]) {
+            if (queued.type == type) {
+                clear_ahead = false;
+                break;
+            }
+        }
+    }
+
+    if (clear_ahead && bucket(type).try_take(now)) return SEND;
+    // Only user order entry is refusable; losing anything else would break the client silently
+    bool order_entry = level == static_cast<size_t>(SendPriority::NEW_ORDER) ||
+                       level == static_cast<size_t>(SendPriority::AMEND);
+    if (throttle_mode == ThrottleMode::REJECT && order_entry && !congested) return REJECTED;
+
+    if (!order_id.empty()) {
+        // Folded into the queued edit of the same order: later params win and the
+        // newest request id is the one the exchange answers
+        auto queued = queued_edits.find(order_id);
+        if (queued != queued_edits.end()) {
+            queued_message& pending = *queued->second;
+            if (superseded != nullptr) *superseded = pending.request_id;
+            pending.params.update(edit["params"]);
+            pending.request_id = edit["id"].get<long>();
+            pending.message = json{{"jsonrpc", "2.0"}, {"id", pending.request_id},
+                                   {"method", "private/edit"}, {"params", pending.params}}.dump();
+            return COALESCED;
+        }
+    }
+
+    lanes[level].push_back({message, type, now});
+    if (!order_id.empty()) {
+        queued_message& pending = lanes[level].back();
+        pending.request_id = edit["id"].get<long>();
+        pending.order_id = order_id;
+        pending.params = move(edit["params"]);
+        queued_edits[order_id] = &pending;
+    }
+    return QUEUED;
+}
+
+bool RateLimiter::next_ready(string& message, chrono::nanoseconds& queued_for) {
+    auto now = chrono::steady_clock::now();
+
+    lock_guard<mutex> lock(limiter_mutex);
+
+    // Most urgent lane first; a lane whose bucket is dry does not block the other bucket
+    bool dry[2] = {false, false};
+    for (auto& lane : lanes) {
+        if (lane.empty()) continue;
+        RequestClass type = lane.front().type;
+        bool& is_dry = dry[static_cast<size_t>(type)];
+        if (is_dry) continue;
+        if (!bucket(type).try_take(now)) {
+            is_dry = true;
+            continue;
+        }
+
+        queued_message& front = lane.front();
+        message = move(front.message);
+        queued_for = chrono::duration_cast<chrono::nanoseconds>(now - front.queued_at);
+        if (!front.order_id.empty()) {
+            auto queued = queued_edits.find(front.order_id);
+            if (queued != queued_edits.end() && queued->second == &front) queued_edits.erase(queued);
+        }
+        lane.pop_front();
+        return true;
+    }
+    return false;
+}
+
+chrono::nanoseconds RateLimiter::next_delay() {
+    auto now = chrono::steady_clock::now();
+
+    lock_guard<mutex> lock(limiter_mutex);
+    chrono::nanoseconds delay = chrono::nanoseconds::max();
+    for (auto& lane : lanes) {
+        if (!lane.empty()) delay = min(delay, bucket(lane.front().type).time_until_available(now));
+    }
+    return delay == chrono::nanoseconds::max() ? chrono::nanoseconds(0) : delay;
+}
+
+bool RateLimiter::has_queued() {
+    lock_guard<mutex> lock(limiter_mutex);
+    for (const auto& lane : lanes) {
+        if (!lane.empty()) return true;
+    }
+    return false;
+}
+
+vector<string> RateLimiter::drop_pending_orders() {
+    lock_guard<mutex> lock(limiter_mutex);
+    vector<string> dropped;
+    for (SendPriority p : {SendPriority::AMEND, SendPriority::NEW_ORDER}) {
+        lane& pending = lanes[static_cast<size_t>(p)];
+        for (auto& queued : pending) dropped.push_back(move(queued.message));
+        pending.clear();
+    }
+    queued_edits.clear();
+    return dropped;
+}
+
+void RateLimiter::on_throttled() {
+    auto now = chrono::steady_clock::now();
+
+    lock_guard<mutex> lock(limiter_mutex);
+    for (auto* b : {&matching, &non_matching}) {
+        b->refill(now);
+        b->credits = 0;
+    }
+}
@@ -0,0 +1,223 @@
+#include "risk.hpp"
+#include "instruments.hpp"
+#include "oms.hpp"
+#include "portfolio.hpp"
+#include "util.hpp"
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <limits>
+#include <mutex>
+
+using namespace std;
+
+namespace {
+    constexpr double UNLIMITED = numeric_limits<double>::infinity();
+
+    double limit(double value) { return value > 0 ? value : UNLIMITED; }
+
+    risk_limits parse_limits(const json& j, const risk_limits& base) {
+        risk_limits limits = base;
+        limits.max_order_size = j.value("max_order_size", base.max_order_size);
+        limits.max_notional = j.value("max_notional", base.max_notional);
+        limits.price_collar = j.value("price_collar", base.price_collar);
+        limits.max_position = j.value("max_position", base.max_position);
+        limits.max_open_orders = j.value("max_open_orders", base.max_open_orders);
+        return limits;
+    }
+}
+
+string describe_violations(uint8_t violations) {
+    static const pair<uint8_t, const char*> names[] = {
+        {RISK_ORDER_SIZE, "order size"},
+        {RISK_NOTIONAL, "notional"},
+        {RISK_PRICE_COLLAR, "price collar"},
+        {RISK_POSITION, "position limit"},
+        {RISK_OPEN_ORDERS, "open order count"}
+    };
+
+    string result;
+    for (const auto& [bit, name] : names) {
+        if (!(violations & bit)) continue;
+        if (!result.empty()) result += ", ";
+        result += name;
+    }
+    return result;
+}
+
+RiskGate::RiskGate() : overrides(64) {
+    currencies.reserve(16);
+    index_prices.reserve(16);
+}
+
+uint32_t RiskGate::currency_index(string_view currency) {
+    for (uint32_t i = 0; i < currencies.size(); ++i) {
+        if (currencies[i] == currency) return i;
+    }
+    currencies.emplace_back(currency);
+    index_prices.push_back(0.0);
+    return static_cast<uint32_t>(currencies.size() - 1);
+}
+
+RiskGate::slot RiskGate::make_slot(uint32_t instrument_id) {
+    const risk_limits* custom = overrides.find(instrument_id);
+    const risk_limits& limits = custom != nullptr ? *custom : defaults;
+
+    slot s{};
+    s.max_order_size = limit(limits.max_order_size);
+    s.max_notional = limit(limits.max_notional);
+    s.price_collar = limit(limits.price_collar);
+    s.max_position = limit(limits.max_position);
+    s.max_open_orders = limits.max_open_orders > 0 ? limits.max_open_orders : UNLIMITED;
+    s.resolved = true;
+
+    // Inverse futures are sized in USD, everything else in the base currency
+    optional<instrument_info> info = getInstrumentRegistry().get(instrument_id);
+    string_view name = info ? string_view(info->name) : string_view();
+    // Unlisted: -C/-P suffixes are options, names without '_' inverse futures
+    bool listed = info && info->listed;
+    bool option = listed ? info->kind == InstrumentKind::OPTION
+                         : name.size() > 2 && name[name.size() - 2] == '-' && (name.back() == 'C' || name.back() == 'P');
+    bool inverse = listed ? info->inverse && info->kind == InstrumentKind::FUTURE
+                          : !option && name.find('_') == string_view::npos;
+    s.notional_fixed = inverse ? 1.0 : 0.0;
+    s.notional_price = inverse || option ? 0.0 : 1.0;
+    s.notional_index = option ? 1.0 : 0.0;
+    s.index_weight = option ? 0.0 : 1.0;
+
+    string_view currency = info && !info->base_currency.empty()
+        ? string_view(info->base_currency) : name.substr(0, name.find_first_of("-_"));
+    s.currency = currency_index(currency);
+    return s;
+}
+
+void RiskGate::build(uint32_t instrument_id) {
+    if (instrument_id >= slots.size()) {
+        slots.resize(max<size_t>(instrument_id + 1, slots.size() * 2), slot{});
+    }
+    slots[instrument_id] = make_slot(instrument_id);
+}
+
+double RiskGate::mark_of(uint32_t instrument_id) const {
+    const atomic<double>* mark = marks.find(instrument_id);
+    return mark != nullptr ? mark->load(memory_order_relaxed) : 0.0;
+}
+
+void RiskGate::set_default_limits(const risk_limits& limits) {
+    unique_lock<shared_mutex> lock(gate_mutex);
+    defaults = limits;
+    for (uint32_t id = 0; id < slots.size(); ++id) {
+        if (slots[id].resolved) build(id);
+    }
+}
+
+void RiskGate::set_limits(string_view instrument, const risk_limits& limits) {
+    uint32_t id = getInstrumentRegistry().intern(instrument);
+
+    unique_lock<shared_mutex> lock(gate_mutex);
+    overrides.insert_or_assign(id, limits);
+    build(id);
+}
+
+bool RiskGate::load(const json& config) {
+    if (!config.is_object()) return false;
+
+    risk_limits base = config.contains("default") ? parse_limits(config["default"], risk_limits{}) : risk_limits{};
+    set_default_limits(base);
+
+    if (config.contains("instruments") && config["instruments"].is_object()) {
+        for (const auto& [name, limits] : config["instruments"].items()) {
+            set_limits(name, parse_limits(limits, base));
+        }
+    }
+    return true;
+}
+
+bool RiskGate::load_file(const string& path) {
+    ifstream file(path);
+    if (!file) return false;
+
+    try {
+        return load(json::parse(file));
+    } catch (const exception& e) {
+        utils::printerr("> Invalid risk limits in " + path + ": " + e.what() + "\n");
+        return false;
+    }
+}
+
+uint8_t RiskGate::evaluate(const slot& s, double mark_price, double index_price, const risk_order& order,
+                           double exposure, size_t open_orders) {
+    // Fall back to the index when there is no mark, except for options
+    double reference = mark_price + (mark_price <= 0) * index_price * s.index_weight;
+    double price = order.price > 0 ? order.price : reference;
+    double notional = order.amount * (s.notional_fixed + s.notional_price * price + s.notional_index * index_price);
+    double signed_amount = order.buy ? order.amount : -order.amount;
+
+    uint8_t violations = 0;
+    violations |= (order.amount > s.max_order_size) * RISK_ORDER_SIZE;
+    violations |= (notional > s.max_notional) * RISK_NOTIONAL;
+    violations |= ((order.price > 0) & (reference > 0) &
+                   (fabs(order.price - reference) > s.price_collar * reference)) * RISK_PRICE_COLLAR;
+    violations |= (order.new_order & (fabs(exposure + signed_amount) > s.max_position)) * RISK_POSITION;
+    violations |= (order.new_order & (open_orders + 1 > s.max_open_orders)) * RISK_OPEN_ORDERS;
+    return violations;
+}
+
+uint8_t RiskGate::check(const risk_order& order) {
+    double exposure = getPortfolioCache().exposure(order.instrument_id);
+    size_t open_orders = getOrderManager().live_count(order.instrument_id);
+
+    if (order.instrument_id == InstrumentRegistry::INVALID_ID) {
+        unique_lock<shared_mutex> lock(gate_mutex);
+        slot fallback = make_slot(order.instrument_id);
+        return evaluate(fallback, 0.0, index_prices[fallback.currency], order, exposure, open_orders);
+    }
+
+    {
+        shared_lock<shared_mutex> lock(gate_mutex);
+        if (order.instrument_id < slots.size() && slots[order.instrument_id].resolved) {
+            const slot& s = slots[order.instrument_id];
+            return evaluate(s, mark_of(order.instrument_id), index_prices[s.currency], order, exposure, open_orders);
+        }
+    }
+
+    unique_lock<shared_mutex> lock(gate_mutex);
+    build(order.instrument_id);
+    const slot& s = slots[order.instrument_id];
+    return evaluate(s, mark_of(order.instrument_id), index_prices[s.currency], order, exposure, open_orders);
+}
+
+void RiskGate::on_ticker(const ticker_event& ticker) {
+    if (ticker.mark_price <= 0 || ticker.instrument_id == InstrumentRegistry::INVALID_ID) return;
+
+    // Slots are built on the first check instead
+    if (atomic<double>* mark = marks.at(ticker.instrument_id)) mark->store(ticker.mark_price, memory_order_relaxed);
+}
+
+void RiskGate::on_index(const price_index_event& index) {
+    if (index.currency.empty() || index.price <= 0) return;
+
+    unique_lock<shared_mutex> lock(gate_mutex);
+    index_prices[currency_index(index.currency)] = index.price;
+}
+
+double RiskGate::benchmark(size_t iterations) {
+    risk_order order;
+    order.instrument_id = getInstrumentRegistry().intern("BTC-PERPETUAL");
+    order.amount = 10;
+    order.price = 1;
+
+    volatile uint8_t sink = 0;
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < iterations; ++i) {
+        order.buy = i & 1;
+        sink = sink | check(order);
+    }
+    auto elapsed = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start);
+    return iterations > 0 ? static_cast<double>(elapsed.count()) / iterations : 0.0;
+}
+
+RiskGate& getRiskGate() {
+    static RiskGate gate;
+    return gate;
+}
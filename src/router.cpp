@@ -0,0 +1,151 @@
+#include "router.hpp"
+#include <fmt/core.h>
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+#include <sstream>
+
+using namespace std;
+
+route_stats* OrderRouter::find(int connection_id) {
+    for (auto& c : connections) {
+        if (c.connection_id == connection_id) return &c;
+    }
+    return nullptr;
+}
+
+bool OrderRouter::add(int connection_id) {
+    lock_guard<mutex> lock(router_mutex);
+    if (find(connection_id) != nullptr) return false;
+    connections.push_back({connection_id});
+    return true;
+}
+
+void OrderRouter::remove(int connection_id) {
+    lock_guard<mutex> lock(router_mutex);
+    connections.erase(remove_if(connections.begin(), connections.end(),
+                                [&](const route_stats& c) { return c.connection_id == connection_id; }),
+                      connections.end());
+}
+
+size_t OrderRouter::size() const {
+    lock_guard<mutex> lock(router_mutex);
+    return connections.size();
+}
+
+int OrderRouter::pick(int preferred, const function<bool(int)>& congested) {
+    lock_guard<mutex> lock(router_mutex);
+    if (connections.size() < 2 || find(preferred) == nullptr) return preferred;
+
+    route_stats* best = nullptr;
+    route_stats* fallback = nullptr;
+    double best_score = numeric_limits<double>::max();
+    double fallback_score = numeric_limits<double>::max();
+
+    for (auto& c : connections) {
+        // Unmeasured connections score 0 so they get a sample early
+        double score = c.ewma_rtt_us * (1.0 + c.in_flight);
+        if (score < fallback_score) {
+            fallback_score = score;
+            fallback = &c;
+        }
+        if (congested(c.connection_id)) {
+            c.skipped_congested++;
+            continue;
+        }
+        if (score < best_score) {
+            best_score = score;
+            best = &c;
+        }
+    }
+
+    // Everything is backed up: queue behind the least loaded
+    route_stats* chosen = best != nullptr ? best : fallback;
+    chosen->picked++;
+    return chosen->connection_id;
+}
+
+void OrderRouter::on_sent(int connection_id, long request_id, chrono::steady_clock::time_point sent_at) {
+    if (request_id == 0) return;
+
+    lock_guard<mutex> lock(router_mutex);
+    route_stats* c = find(connection_id);
+    if (c == nullptr) return;
+
+    c->in_flight++;
+    pending.insert_or_assign(request_id, in_flight_request{connection_id, sent_at});
+}
+
+void OrderRouter::on_timeout(long request_id) {
+    lock_guard<mutex> lock(router_mutex);
+    in_flight_request* request = pending.find(request_id);
+    if (request == nullptr) return;
+
+    if (route_stats* c = find(request->connection_id)) {
+        c->timeouts++;
+        if (c->in_flight > 0) c->in_flight--;
+    }
+    pending.erase(request_id);
+}
+
+bool OrderRouter::on_response(int connection_id, long request_id, bool error,
+                              chrono::steady_clock::time_point now) {
+    lock_guard<mutex> lock(router_mutex);
+    in_flight_request* request = pending.find(request_id);
+    if (request == nullptr || request->connection_id != connection_id) return false;
+
+    double rtt_us = chrono::duration<double, micro>(now - request->sent_at).count();
+    pending.erase(request_id);
+
+    route_stats* c = find(connection_id);
+    if (c == nullptr) return true;
+
+    if (c->in_flight > 0) c->in_flight--;
+    c->ewma_rtt_us = c->ewma_rtt_us == 0.0 ? rtt_us : EWMA_ALPHA * rtt_us + (1.0 - EWMA_ALPHA) * c->ewma_rtt_us;
+    (error ? c->errors : c->acked)++;
+    return true;
+}
+
+vector<route_stats> OrderRouter::stats() const {
+    lock_guard<mutex> lock(router_mutex);
+    return connections;
+}
+
+string OrderRouter::report() const {
+    vector<route_stats> all = stats();
+    if (all.empty()) return "";
+
+    ostringstream os;
+    os << "Order routing:\n";
+    for (const auto& c : all) {
+        os << fmt::format("  connection {:<3} rtt {:8.1f} us  {:>3} in flight  {:>7} routed  {:>7} acked  "
+                          "{} errors  {} timeouts  {} skipped while congested\n",
+                          c.connection_id, c.ewma_rtt_us, c.in_flight, c.picked, c.acked,
+                          c.errors, c.timeouts, c.skipped_congested);
+    }
+    return os.str();
+}
+
+static string_view string_param(string_view message, string_view key) {
+    size_t start = message.find(key);
+    if (start == string_view::npos) return {};
+    start += key.size();
+    size_t end = message.find('"', start);
+    if (end == string_view::npos) return {};
+    return message.substr(start, end - start);
+}
+
+string_view OrderRouter::order_id(string_view message) {
+    return string_param(message, "\"order_id\":\"");
+}
+
+string_view OrderRouter::label(string_view message) {
+    return string_param(message, "\"label\":\"");
+}
+
+long OrderRouter::request_id(string_view message) {
+    constexpr string_view key = "\"id\":";
+    size_t start = message.find(key);
+    if (start == string_view::npos) return 0;
+    return strtol(message.data() + start + key.size(), nullptr, 10);
+}
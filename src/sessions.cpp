@@ -0,0 +1,121 @@
+#include "sessions.hpp"
+#include "accounts.hpp"
+#include "api.hpp"
+#include "util.hpp"
+
+using namespace std;
+
+SessionStore::SessionStore() {
+    session& main_account = sessions.emplace_back();
+    main_account.account = 0;
+    main_account.name = "main";
+    main_account.endpoint = make_unique<websocket_endpoint>(0);
+    accounts::bind(0);
+}
+
+session* SessionStore::add(const string& name) {
+    lock_guard<mutex> lock(store_mutex);
+    for (const auto& s : sessions) {
+        if (s.name == name) return nullptr;
+    }
+
+    size_t account = accounts::open();
+    if (account >= MAX_ACCOUNTS) return nullptr;
+
+    session& s = sessions.emplace_back();
+    s.account = account;
+    s.name = name;
+    s.endpoint = make_unique<websocket_endpoint>(account);
+    return &s;
+}
+
+session* SessionStore::find(string_view name) {
+    lock_guard<mutex> lock(store_mutex);
+    for (auto& s : sessions) {
+        if (s.name == name) return &s;
+    }
+    return nullptr;
+}
+
+session& SessionStore::get(size_t account) {
+    lock_guard<mutex> lock(store_mutex);
+    for (auto& s : sessions) {
+        if (s.account == account) return s;
+    }
+    return sessions.front();
+}
+
+session& SessionStore::active() {
+    return get(active_account);
+}
+
+bool SessionStore::select(string_view name) {
+    session* s = find(name);
+    if (s == nullptr) return false;
+
+    active_account = s->account;
+    accounts::bind(active_account);
+    return true;
+}
+
+bool SessionStore::connect(session& s, const string& uri, const string& client_id,
+                           const string& client_secret) {
+    s.connection_id = s.endpoint->connect(uri);
+    if (s.connection_id == -1) return false;
+
+    if (!client_id.empty()) {
+        s.client_id = client_id;
+        route(s, "authorize " + client_id + " " + client_secret);
+    }
+    return true;
+}
+
+bool SessionStore::route(session& s, const string& args) {
+    if (!s.connected()) {
+        utils::printerr("> Account " + s.name + " is not connected\n");
+        return false;
+    }
+
+    // Order and portfolio state read by the command belong to the target account
+    accounts::scope bound(s.account);
+    string msg = api::process("Deribit " + to_string(s.connection_id) + " " + args);
+    if (msg.empty()) return false;
+    return s.endpoint->send(s.connection_id, msg) == 0;
+}
+
+bool SessionStore::route(string_view name, const string& args) {
+    session* s = find(name);
+    if (s == nullptr) {
+        utils::printerr("> Unknown account: " + string(name) + "\n");
+        return false;
+    }
+    return route(*s, args);
+}
+
+int SessionStore::kill_switch() {
+    vector<websocket_endpoint*> endpoints;
+    {
+        lock_guard<mutex> lock(store_mutex);
+        for (auto& s : sessions) {
+            if (s.connected()) endpoints.push_back(s.endpoint.get());
+        }
+    }
+
+    int sent = 0;
+    for (auto* endpoint : endpoints) sent += endpoint->kill_switch();
+    return sent;
+}
+
+void SessionStore::resume_trading() {
+    lock_guard<mutex> lock(store_mutex);
+    for (auto& s : sessions) {
+        if (s.endpoint) s.endpoint->resume_trading();
+    }
+}
+
+vector<const session*> SessionStore::list() const {
+    lock_guard<mutex> lock(store_mutex);
+    vector<const session*> result;
+    for (const auto& s : sessions) result.push_back(&s);
+    return result;
+}
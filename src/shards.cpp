@@ -0,0 +1,162 @@
+#include "shards.hpp"
+#include "accounts.hpp"
+#include "instruments.hpp"
+#include "util.hpp"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <pthread.h>
+#include <sstream>
+
+using namespace std;
+
+namespace {
+    size_t default_shard_count() {
+        if (const char* count = getenv("DERIBIT_MD_SHARDS")) return strtoul(count, nullptr, 10);
+        unsigned cores = thread::hardware_concurrency();
+        return cores >= 8 ? 4 : (cores >= 4 ? 2 : 1);
+    }
+
+    vector<int> shard_cpus() {
+        vector<int> cpus;
+        if (const char* list = getenv("DERIBIT_MD_SHARD_CPUS")) {
+            stringstream ss(list);
+            string cpu;
+            while (getline(ss, cpu, ',')) {
+                if (!cpu.empty()) cpus.push_back(atoi(cpu.c_str()));
+            }
+        }
+        return cpus;
+    }
+
+    // "ticker.BTC-PERPETUAL.100ms", "book.BTC-PERPETUAL.none.10.100ms", "trades.BTC-PERPETUAL.raw";
+    // trades.<kind>.<currency>.<interval> spans instruments and is not sharded
+    string_view channel_instrument(string_view channel, ChannelKind kind) {
+        size_t start = channel.find('.');
+        if (start == string_view::npos) return {};
+        size_t end = channel.find('.', start + 1);
+        if (end == string_view::npos) return {};
+
+        if (kind == ChannelKind::TRADES && count(channel.begin(), channel.end(), '.') != 2) return {};
+        return channel.substr(start + 1, end - start - 1);
+    }
+}
+
+MarketDataShards::MarketDataShards() {
+    size_t count = default_shard_count();
+    vector<int> cpus = shard_cpus();
+
+    for (size_t i = 0; i < count; ++i) {
+        shards.push_back(make_unique<shard>(SHARD_QUEUE_CAPACITY));
+        shards.back()->cpu = i < cpus.size() ? cpus[i] : -1;
+    }
+    // Started only once every shard exists, so workers never see the vector move
+    for (size_t i = 0; i < count; ++i) {
+        shards[i]->worker = thread(&MarketDataShards::run, this, ref(*shards[i]), i);
+    }
+}
+
+MarketDataShards::~MarketDataShards() {
+    running.store(false, memory_order_release);
+    for (auto& s : shards) {
+        s->queue.wake_consumer();
+        s->worker.join();
+    }
+}
+
+size_t MarketDataShards::shard_of(uint32_t instrument_id) const {
+    return shards.empty() ? 0 : instrument_id % shards.size();
+}
+
+bool MarketDataShards::route(string_view channel, json& data) {
+    if (shards.empty()) return false;
+
+    ChannelKind kind = channel_kind(channel);
+    if (kind != ChannelKind::TICKER && kind != ChannelKind::BOOK && kind != ChannelKind::TRADES) return false;
+
+    string_view instrument = channel_instrument(channel, kind);
+    if (instrument.empty()) return false;
+
+    uint32_t instrument_id = getInstrumentRegistry().intern(instrument);
+    shard& s = *shards[shard_of(instrument_id)];
+    lock_guard<mutex> lock(s.producer_mutex);
+    s.queue.push({accounts::current(), instrument_id, string(channel), move(data)});
+    return true;
+}
+
+void MarketDataShards::track_book(shard& s, const md_frame& frame) {
+    const json& data = frame.data;
+    uint64_t key = (static_cast<uint64_t>(frame.account) << 32) | frame.instrument_id;
+    long long change_id = data.value("change_id", 0LL);
+    long long* last = s.last_change.find(key);
+
+    if (last == nullptr) {
+        s.instruments.fetch_add(1, memory_order_relaxed);
+    } else if (data.value("type", "") != "snapshot" && data.contains("prev_change_id") &&
+               data["prev_change_id"].get<long long>() != *last) {
+        s.book_gaps.fetch_add(1, memory_order_relaxed);
+    }
+    s.last_change.insert_or_assign(key, change_id);
+}
+
+void MarketDataShards::run(shard& s, size_t index) {
+    stage_config config = stage_config_from_env(PipelineStage::LOGIC);
+    config.cpu = s.cpu;
+    apply_stage_config(PipelineStage::LOGIC, config);
+    pthread_setname_np(pthread_self(), ("deribit-md" + to_string(index)).substr(0, 15).c_str());
+
+    md_frame frame;
+    while (running.load(memory_order_acquire)) {
+        if (!s.queue.pop(frame, config.spin, chrono::milliseconds(100))) continue;
+
+        auto start = chrono::steady_clock::now();
+        accounts::bind(frame.account);
+        // As on the logic stage, a bad frame or a throwing handler costs only this frame
+        try {
+            if (channel_kind(frame.channel) == ChannelKind::BOOK) track_book(s, frame);
+            getChannelDispatcher().dispatch(frame.channel, frame.data);
+        } catch (const exception& e) {
+            cerr << "Error processing " << frame.channel << " on shard " << index << ": " << e.what() << endl;
+        }
+
+        s.events.fetch_add(1, memory_order_relaxed);
+        s.busy_ns.fetch_add(chrono::duration_cast<chrono::nanoseconds>(
+            chrono::steady_clock::now() - start).count(), memory_order_relaxed);
+        s.overflow.fetch_add(s.queue.take_overflow_count(), memory_order_relaxed);
+    }
+}
+
+vector<shard_load> MarketDataShards::load() const {
+    vector<shard_load> result;
+    for (size_t i = 0; i < shards.size(); ++i) {
+        const shard& s = *shards[i];
+        result.push_back({i, s.cpu, s.events.load(), s.busy_ns.load(), s.overflow.load(),
+                          s.book_gaps.load(), s.instruments.load()});
+    }
+    return result;
+}
+
+string MarketDataShards::report() const {
+    vector<shard_load> shard_loads = load();
+    if (shard_loads.empty()) return "Market data shards: off (dispatched on the logic stage)\n";
+
+    uint64_t total = 0;
+    for (const auto& l : shard_loads) total += l.events;
+
+    ostringstream os;
+    os << "Market data shards:\n";
+    for (const auto& l : shard_loads) {
+        double share = total > 0 ? 100.0 * l.events / total : 0.0;
+        double mean_us = l.events > 0 ? l.busy_ns / 1000.0 / l.events : 0.0;
+        os << fmt::format("  shard {} (cpu {:>2}): {:>9} events {:5.1f}%  {:6.2f} us/event  "
+                          "{} books  {} gaps  {} overflow\n",
+                          l.shard, l.cpu, l.events, share, mean_us, l.instruments, l.book_gaps, l.overflow);
+    }
+    return os.str();
+}
+
+MarketDataShards& getMarketDataShards() {
+    static MarketDataShards shards;
+    return shards;
+}
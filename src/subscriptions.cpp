@@ -0,0 +1,331 @@
+#include "subscriptions.hpp"
+#include "accounts.hpp"
+#include "api.hpp"
+
+#include "instruments.hpp"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_set>
+
+using namespace std;
+
+namespace {
+    bool is_private_channel(string_view channel) {
+        return channel.substr(0, 5) == "user.";
+    }
+
+    // "ticker.BTC-PERPETUAL.100ms" -> BTC-PERPETUAL, "deribit_price_index.btc_usd" -> btc_usd,
+    // "trades.option.BTC.raw" -> option.BTC
+    string_view channel_subject(string_view channel) {
+        size_t start = channel.find('.');
+        if (start == string_view::npos) return channel;
+        size_t end = channel.find('.', start + 1);
+        if (channel.substr(0, start) == "trades" && end != string_view::npos) {
+            size_t next = channel.find('.', end + 1);
+            if (next != string_view::npos) end = next;
+        }
+        return channel.substr(start + 1, end == string_view::npos ? string_view::npos : end - start - 1);
+    }
+
+    string currency_of(string_view channel) {
+        string_view subject = channel_subject(channel);
+        if (channel.substr(0, 7) == "trades." && subject.find('.') != string_view::npos) {
+            subject = subject.substr(subject.find('.') + 1);
+        }
+        string currency(subject.substr(0, subject.find_first_of("-_")));
+        for (auto& c : currency) c = static_cast<char>(toupper(static_cast<unsigned char>(c)));
+        return currency;
+    }
+
+    size_t kind_of(string_view channel) {
+        if (channel.substr(0, 20) == "deribit_price_index.") return 3;
+        string_view subject = channel_subject(channel);
+        if (channel.substr(0, 7) == "trades." && subject.find('.') != string_view::npos) {
+            InstrumentKind kind = parse_instrument_kind(subject.substr(0, subject.find('.')));
+            return kind == InstrumentKind::OPTION ? 1 : (kind == InstrumentKind::SPOT ? 2 : 0);
+        }
+
+        InstrumentRegistry& registry = getInstrumentRegistry();
+        if (optional<instrument_info> info = registry.get(registry.find(subject)); info && info->listed) {
+            return info->kind == InstrumentKind::OPTION || info->kind == InstrumentKind::OPTION_COMBO ? 1
+                 : info->kind == InstrumentKind::SPOT ? 2 : 0;
+        }
+        // Unlisted: -C/-P suffixes are options, BASE_QUOTE names without a dash are spot
+        bool option = subject.size() > 2 && subject[subject.size() - 2] == '-' &&
+                      (subject.back() == 'C' || subject.back() == 'P');
+        if (option) return 1;
+        return subject.find('_') != string_view::npos && subject.find('-') == string_view::npos ? 2 : 0;
+    }
+}
+
+feed_sharding feed_sharding_from_env() {
+    feed_sharding config;
+    if (const char* connections = getenv("DERIBIT_FEED_CONNECTIONS")) {
+        config.connections = max<size_t>(1, strtoul(connections, nullptr, 10));
+    }
+    if (const char* policy = getenv("DERIBIT_FEED_SHARD_POLICY")) {
+        if (strcmp(policy, "currency") == 0) config.policy = ShardPolicy::CURRENCY;
+        else if (strcmp(policy, "kind") == 0) config.policy = ShardPolicy::KIND;
+    }
+    if (const char* copies = getenv("DERIBIT_FEED_COPIES")) {
+        config.copies = max<size_t>(1, strtoul(copies, nullptr, 10));
+    }
+    if (const char* layout = getenv("DERIBIT_SESSION_LAYOUT")) {
+        config.split = strcmp(layout, "split") == 0;
+    }
+    return config;
+}
+
+size_t feed_shard(string_view channel, const feed_sharding& sharding) {
+    if (is_private_channel(channel)) return 0;
+
+    // Split: public channels go to the market-data connections 1..connections
+    size_t first = sharding.split ? 1 : 0;
+    if (sharding.connections <= 1) return first;
+
+    switch (sharding.policy) {
+        case ShardPolicy::CURRENCY:
+            return first + hash<string>{}(currency_of(channel)) % sharding.connections;
+        case ShardPolicy::KIND:
+            return first + kind_of(channel) % sharding.connections;
+        case ShardPolicy::HASH:
+        default:
+            return first + hash<string_view>{}(channel_subject(channel)) % sharding.connections;
+    }
+}
+
+vector<string> SubscriptionManager::build_frames(bool subscribe, const vector<string>& channels) {
+    vector<string> frames;
+    vector<string> public_channels;
+    vector<string> private_channels;
+
+    for (const auto& channel : channels) {
+        (is_private_channel(channel) ? private_channels : public_channels).push_back(channel);
+    }
+
+    // Grouped by feed connection so a chunk never straddles two of them
+    if (shards.connections > 1) {
+        stable_sort(public_channels.begin(), public_channels.end(), [this](const string& a, const string& b) {
+            return feed_shard(a, shards) < feed_shard(b, shards);
+        });
+    }
+
+    auto emit = [&](const string& scope, const vector<string>& group) {
+        for (size_t begin = 0; begin < group.size();) {
+            size_t end = min(begin + chunk_size, group.size());
+            size_t shard = feed_shard(group[begin], shards);
+            for (size_t i = begin + 1; i < end; ++i) {
+                if (feed_shard(group[i], shards) != shard) {
+                    end = i;
+                    break;
+                }
+            }
+            vector<string> chunk(group.begin() + begin, group.begin() + end);
+
+            jsonrpc j(scope + (subscribe ? "/subscribe" : "/unsubscribe"));
+            j["params"] = {{"channels", chunk}};
+
+            pending[j["id"].get<long>()] = {subscribe, move(chunk)};
+            frames.push_back(j.dump());
+            begin = end;
+        }
+    };
+
+    emit("public", public_channels);
+    emit("private", private_channels);
+    return frames;
+}
+
+vector<string> SubscriptionManager::subscribe(const vector<string>& channels) {
+    lock_guard<mutex> lock(subscription_mutex);
+    vector<string> delta;
+
+    for (const auto& channel : channels) {
+        auto it = channel_states.find(channel);
+        if (it == channel_states.end()) {
+            channel_states.emplace(channel, SubscriptionState::PENDING_SUBSCRIBE);
+            delta.push_back(channel);
+        }
+        else if (it->second == SubscriptionState::INACTIVE ||
+                 it->second == SubscriptionState::PENDING_UNSUBSCRIBE) {
+            it->second = SubscriptionState::PENDING_SUBSCRIBE;
+            delta.push_back(channel);
+        }
+    }
+    return build_frames(true, delta);
+}
+
+vector<string> SubscriptionManager::unsubscribe(const vector<string>& channels) {
+    lock_guard<mutex> lock(subscription_mutex);
+    vector<string> delta;
+
+    for (const auto& channel : channels) {
+        auto it = channel_states.find(channel);
+        if (it == channel_states.end()) continue;
+
+        if (it->second == SubscriptionState::INACTIVE) {
+            channel_states.erase(it);
+        }
+        else if (it->second != SubscriptionState::PENDING_UNSUBSCRIBE) {
+            it->second = SubscriptionState::PENDING_UNSUBSCRIBE;
+            delta.push_back(channel);
+        }
+    }
+    return build_frames(false, delta);
+}
+
+bool SubscriptionManager::clear() {
+    lock_guard<mutex> lock(subscription_mutex);
+    bool live = false;
+    for (const auto& entry : channel_states) {
+        live |= entry.second != SubscriptionState::INACTIVE;
+    }
+    channel_states.clear();
+    pending.clear();
+    return live;
+}
+
+vector<string> SubscriptionManager::resubscribe() {
+    lock_guard<mutex> lock(subscription_mutex);
+    vector<string> delta;
+
+    for (auto& entry : channel_states) {
+        if (entry.second == SubscriptionState::INACTIVE) {
+            entry.second = SubscriptionState::PENDING_SUBSCRIBE;
+            delta.push_back(entry.first);
+        }
+    }
+    return build_frames(true, delta);
+}
+
+void SubscriptionManager::mark_all_inactive() {
+    lock_guard<mutex> lock(subscription_mutex);
+    for (auto it = channel_states.begin(); it != channel_states.end();) {
+        if (it->second == SubscriptionState::PENDING_UNSUBSCRIBE) {
+            it = channel_states.erase(it);
+        } else {
+            it->second = SubscriptionState::INACTIVE;
+            ++it;
+        }
+    }
+    pending.clear();
+}
+
+void SubscriptionManager::mark_inactive(size_t shard) {
+    lock_guard<mutex> lock(subscription_mutex);
+    for (auto it = channel_states.begin(); it != channel_states.end();) {
+        if (is_private_channel(it->first) || feed_shard(it->first, shards) != shard) {
+            ++it;
+        } else if (it->second == SubscriptionState::PENDING_UNSUBSCRIBE) {
+            it = channel_states.erase(it);
+        } else {
+            it->second = SubscriptionState::INACTIVE;
+            ++it;
+        }
+    }
+    // Requests in flight on the dropped connection will never be answered
+    for (auto it = pending.begin(); it != pending.end();) {
+        const vector<string>& channels = it->second.channels;
+        bool dropped = !channels.empty() && !is_private_channel(channels.front()) &&
+                       feed_shard(channels.front(), shards) == shard;
+        it = dropped ? pending.erase(it) : next(it);
+    }
+}
+
+vector<string> SubscriptionManager::resubscribe(size_t shard) {
+    lock_guard<mutex> lock(subscription_mutex);
+    vector<string> delta;
+
+    for (auto& entry : channel_states) {
+        if (entry.second == SubscriptionState::INACTIVE && !is_private_channel(entry.first) &&
+            feed_shard(entry.first, shards) == shard) {
+            entry.second = SubscriptionState::PENDING_SUBSCRIBE;
+            delta.push_back(entry.first);
+        }
+    }
+    return build_frames(true, delta);
+}
+
+bool SubscriptionManager::on_response(const json& response) {
+    if (!response.contains("id") || !response["id"].is_number_integer()) return false;
+
+    lock_guard<mutex> lock(subscription_mutex);
+    auto it = pending.find(response["id"].get<long>());
+    if (it == pending.end()) return false;
+
+    pending_request request = move(it->second);
+    pending.erase(it);
+
+    unordered_set<string> acknowledged;
+    if (response.contains("result") && response["result"].is_array()) {
+        for (const auto& channel : response["result"]) {
+            if (channel.is_string()) acknowledged.insert(channel.get<string>());
+        }
+    }
+
+    for (const auto& channel : request.channels) {
+        auto state = channel_states.find(channel);
+        if (state == channel_states.end()) continue;
+
+        bool ok = acknowledged.count(channel) > 0;
+        if (request.subscribe && state->second == SubscriptionState::PENDING_SUBSCRIBE) {
+            state->second = ok ? SubscriptionState::ACTIVE : SubscriptionState::INACTIVE;
+        }
+        else if (!request.subscribe && state->second == SubscriptionState::PENDING_UNSUBSCRIBE) {
+            if (ok) {
+                channel_states.erase(state);
+            } else {
+                state->second = SubscriptionState::ACTIVE;
+            }
+        }
+    }
+    return true;
+}
+
+vector<string> SubscriptionManager::channels() const {
+    lock_guard<mutex> lock(subscription_mutex);
+    vector<string> result;
+    for (const auto& entry : channel_states) {
+        if (entry.second != SubscriptionState::PENDING_UNSUBSCRIBE) {
+            result.push_back(entry.first);
+        }
+    }
+    sort(result.begin(), result.end());
+    return result;
+}
+
+bool SubscriptionManager::contains(const string& channel) const {
+    lock_guard<mutex> lock(subscription_mutex);
+    auto it = channel_states.find(channel);
+    return it != channel_states.end() && it->second != SubscriptionState::PENDING_UNSUBSCRIBE;
+}
+
+SubscriptionState SubscriptionManager::state(const string& channel) const {
+    lock_guard<mutex> lock(subscription_mutex);
+    auto it = channel_states.find(channel);
+    return it == channel_states.end() ? SubscriptionState::INACTIVE : it->second;
+}
+
+void SubscriptionManager::set_chunk_size(size_t size) {
+    lock_guard<mutex> lock(subscription_mutex);
+    chunk_size = max<size_t>(size, 1);
+}
+
+void SubscriptionManager::set_sharding(const feed_sharding& config) {
+    lock_guard<mutex> lock(subscription_mutex);
+    shards = config;
+    shards.connections = max<size_t>(shards.connections, 1);
+    shards.copies = max<size_t>(shards.copies, 1);
+}
+
+feed_sharding SubscriptionManager::sharding() const {
+    lock_guard<mutex> lock(subscription_mutex);
+    return shards;
+}
+
+SubscriptionManager& getSubscriptionManager() {
+    return accounts::local<SubscriptionManager>();
+}
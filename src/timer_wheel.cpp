@@ -0,0 +1,140 @@
+#include "timer_wheel.hpp"
+
+using namespace std;
+
+namespace {
+    size_t round_up_pow2(size_t n) {
+        size_t p = 1;
+        while (p < n) p <<= 1;
+        return p;
+    }
+}
+
+TimerWheel::TimerWheel(chrono::milliseconds tick, size_t slots, size_t capacity)
+    : tick_length(max(tick, chrono::milliseconds(1))), origin(chrono::steady_clock::now()),
+      slot_mask(round_up_pow2(max<size_t>(slots, 2)) - 1) {
+    heads.assign(slot_mask + 1, NIL);
+    nodes.resize(max<size_t>(capacity, 1));
+    for (uint32_t i = 0; i < nodes.size(); ++i) {
+        nodes[i].next = i + 1 < nodes.size() ? i + 1 : NIL;
+    }
+    free_head = 0;
+    due.reserve(256);
+}
+
+void TimerWheel::on(TimerKind kind, handler fn) {
+    lock_guard<mutex> lock(wheel_mutex);
+    handlers[static_cast<size_t>(kind)] = move(fn);
+}
+
+uint64_t TimerWheel::ticks_at(chrono::steady_clock::time_point now) const {
+    return now <= origin ? 0 : static_cast<uint64_t>((now - origin) / tick_length);
+}
+
+uint32_t TimerWheel::acquire() {
+    if (free_head == NIL) {
+        // Doubling keeps growth amortised; indices stay valid
+        uint32_t first = static_cast<uint32_t>(nodes.size());
+        nodes.resize(nodes.size() * 2);
+        for (uint32_t i = first; i < nodes.size(); ++i) {
+            nodes[i].next = i + 1 < nodes.size() ? i + 1 : NIL;
+        }
+        free_head = first;
+    }
+    uint32_t index = free_head;
+    free_head = nodes[index].next;
+    return index;
+}
+
+void TimerWheel::release(uint32_t index) {
+    node& n = nodes[index];
+    n.armed = false;
+    n.generation++;
+    n.prev = NIL;
+    n.next = free_head;
+    free_head = index;
+}
+
+void TimerWheel::unlink(uint32_t index) {
+    node& n = nodes[index];
+    if (n.prev != NIL) {
+        nodes[n.prev].next = n.next;
+    } else {
+        heads[n.deadline & slot_mask] = n.next;
+    }
+    if (n.next != NIL) nodes[n.next].prev = n.prev;
+}
+
+timer_id TimerWheel::schedule(TimerKind kind, uint64_t key, chrono::milliseconds delay) {
+    // Rounded up so a timer never fires early
+    uint64_t ticks = max<int64_t>(1, (delay.count() + tick_length.count() - 1) / tick_length.count());
+
+    lock_guard<mutex> lock(wheel_mutex);
+    uint32_t index = acquire();
+    node& n = nodes[index];
+    n.key = key;
+    n.kind = kind;
+    n.deadline = max(current, ticks_at(chrono::steady_clock::now())) + ticks;
+    n.armed = true;
+
+    uint32_t& head = heads[n.deadline & slot_mask];
+    n.prev = NIL;
+    n.next = head;
+    if (head != NIL) nodes[head].prev = index;
+    head = index;
+
+    armed_count++;
+    return (static_cast<uint64_t>(n.generation) << 32) | index;
+}
+
+bool TimerWheel::cancel(timer_id id) {
+    uint32_t index = static_cast<uint32_t>(id);
+    uint32_t generation = static_cast<uint32_t>(id >> 32);
+
+    lock_guard<mutex> lock(wheel_mutex);
+    if (index >= nodes.size()) return false;
+    node& n = nodes[index];
+    if (!n.armed || n.generation != generation) return false;
+
+    unlink(index);
+    release(index);
+    armed_count--;
+    return true;
+}
+
+size_t TimerWheel::advance(chrono::steady_clock::time_point now) {
+    due.clear();
+    {
+        lock_guard<mutex> lock(wheel_mutex);
+        uint64_t target = ticks_at(now);
+        if (target <= current) return 0;
+
+        // After a stall longer than a revolution, one pass over every slot finds everything due
+        uint64_t steps = min<uint64_t>(target - current, slot_mask + 1);
+        for (uint64_t step = 1; step <= steps; ++step) {
+            uint32_t index = heads[(current + step) & slot_mask];
+            while (index != NIL) {
+                uint32_t next = nodes[index].next;
+                if (nodes[index].deadline <= target) {
+                    due.push_back({nodes[index].kind, nodes[index].key});
+                    unlink(index);
+                    release(index);
+                    armed_count--;
+                }
+                index = next;
+            }
+        }
+        current = target;
+    }
+
+    for (const auto& timer : due) {
+        handler* fn = &handlers[static_cast<size_t>(timer.kind)];
+        if (*fn) (*fn)(timer.key);
+    }
+    return due.size();
+}
+
+size_t TimerWheel::size() const {
+    lock_guard<mutex> lock(wheel_mutex);
+    return armed_count;
+}
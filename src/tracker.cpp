@@ -48,6 +48,33 @@ void LatencyTracker::stop_measurement(LatencyType type, const string& unique_id)
     }
 }
 
+void LatencyTracker::record(LatencyType type, chrono::nanoseconds duration) {
+    lock_guard<mutex> lock(metrics_mutex);
+
+    LatencyMetric metric;
+    metric.duration = duration;
+    metric.completed = true;
+
+    // Hot paths record on every pass; past MAX_SAMPLES the oldest sample is overwritten
+    vector<LatencyMetric>& samples = latency_metrics[type];
+    if (samples.size() < MAX_SAMPLES) {
+        samples.push_back(metric);
+    } else {
+        samples[sample_cursor[type]] = metric;
+        sample_cursor[type] = (sample_cursor[type] + 1) % MAX_SAMPLES;
+    }
+}
+
+void LatencyTracker::count_event(const string& event, size_t count) {
+    lock_guard<mutex> lock(metrics_mutex);
+    event_counts[event] += count;
+}
+
+map<string, size_t> LatencyTracker::get_event_counts() {
+    lock_guard<mutex> lock(metrics_mutex);
+    return event_counts;
+}
+
 string LatencyTracker::generate_report() {
     lock_guard<mutex> lock(metrics_mutex);
     
@@ -72,14 +99,19 @@ string LatencyTracker::generate_report() {
         "Order Placement",
         "Market Data Processing", 
         "WebSocket Message Propagation", 
-        "Trading Loop End-to-End"
+        "Trading Loop End-to-End",
+        "Pre-Trade Risk Check",
+        "Rate Limiter Queue Wait",
+        "Kill Switch Trigger-to-Wire",
+        "Feed Arbitration Lead Time",
+        "Strategy Callback"
     };
 
     // Define column widths based on terminal width
     int type_col_width = 30;
     int metric_col_width = (terminal_width - type_col_width - 4) / 2;
 
-    for (int type = 0; type < 4; ++type) {
+    for (int type = 0; type < LATENCY_TYPE_COUNT; ++type) {
         auto metrics = latency_metrics[static_cast<LatencyType>(type)];
         
         if (metrics.empty()) continue;
@@ -132,6 +164,12 @@ string LatencyTracker::generate_report() {
                << "  " << metric_color << "99th: " << reset_color << setw(8) << percentile_99.count() / 1000.0 << " µs\n\n";
     }
 
+    for (const auto& [event, count] : event_counts) {
+        report << section_color << left << setw(type_col_width) << event << reset_color
+               << "  " << metric_color << "Count: " << reset_color << count << "\n";
+    }
+    if (!event_counts.empty()) report << "\n";
+
     report << footer_color << string(terminal_width, '=') << reset_color << "\n";
 
     return report.str();
@@ -146,7 +184,9 @@ map<LatencyTracker::LatencyType, vector<LatencyTracker::LatencyMetric>> LatencyT
 void LatencyTracker::reset() {
     lock_guard<mutex> lock(metrics_mutex);
     latency_metrics.clear();
+    fill(begin(sample_cursor), end(sample_cursor), 0);
     active_measurements.clear();
+    event_counts.clear();
 
     int terminal_width = utils::getTerminalWidth();
 
@@ -4,6 +4,8 @@
 #include "util.hpp"
 #include <thread>
 #include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <time.h>
 #include <openssl/hmac.h>
 #include <openssl/evp.h>
@@ -59,6 +61,12 @@ void utils::printerr(string const &str) {
     fmt::print(fg(fmt::rgb(255, 83, 29)) | fmt::emphasis::bold, str);
 }
 
+bool utils::is_finite(double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return (bits & 0x7ff0000000000000ULL) != 0x7ff0000000000000ULL;
+}
+
 long long utils::time_now() {
     auto now = chrono::system_clock::now();
     auto now_ms = chrono::time_point_cast<chrono::milliseconds>(now);
@@ -191,8 +199,11 @@ void utils::printHelp() {
          << fmt::format("  {:<30} : {}\n", "1. Connect to Exchange", "Connect to Deribit TESTNET and authorize")
          << fmt::format("  {:<30} : {}\n", "2. Order Management", "Access order-related functions")
          << fmt::format("  {:<30} : {}\n", "3. Market Coverage", "Access market data and streaming")
-         << fmt::format("  {:<30} : {}\n", "4. Performance Metrics", "View system latency statistics")
-         << fmt::format("  {:<30} : {}\n", "5. Exit", "Close the application")
+         << fmt::format("  {:<30} : {}\n", "4. Accounts", "Trade several subaccounts from one process")
+         << fmt::format("  {:<30} : {}\n", "5. Strategies", "Load, reload and unload strategy plugins (.so)")
+         << fmt::format("  {:<30} : {}\n", "6. Help", "Show this command list")
+         << fmt::format("  {:<30} : {}\n", "7. Performance Metrics", "View system latency statistics")
+         << fmt::format("  {:<30} : {}\n", "8. Exit", "Close the application")
          << "\n";
 
     // Order Management Options
@@ -202,6 +213,24 @@ void utils::printHelp() {
          << fmt::format("  {:<30} : {}\n", "Modify Order", "Edit existing orders")
          << fmt::format("  {:<30} : {}\n", "View Open Orders", "List all active orders")
          << fmt::format("  {:<30} : {}\n", "View Positions", "Show current positions")
+         << fmt::format("  {:<30} : {}\n", "Order Status", "Show an order's locally tracked state")
+         << fmt::format("  {:<30} : {}\n", "Kill Switch", "Cancel all orders on every account (also 'k' while streaming, SIGUSR1)")
+         << fmt::format("  {:<30} : {}\n", "Resume Trading", "Re-enable order entry after the kill switch")
+         << "\n";
+
+    // Account Options
+    cout << "ACCOUNT OPTIONS:\n"
+         << fmt::format("  {:<30} : {}\n", "List Sessions", "Show every account session and its state")
+         << fmt::format("  {:<30} : {}\n", "Add Subaccount Session", "Connect and authorize another account")
+         << fmt::format("  {:<30} : {}\n", "Switch Account", "Route orders and views to another account")
+         << "\n";
+
+    // Strategy Options
+    cout << "STRATEGY OPTIONS:\n"
+         << fmt::format("  {:<30} : {}\n", "List Strategies", "Show loaded strategies and their callback latency")
+         << fmt::format("  {:<30} : {}\n", "Load Strategy", "dlopen a strategy for the active account")
+         << fmt::format("  {:<30} : {}\n", "Reload Strategy", "Stop a strategy and load its rebuilt .so")
+         << fmt::format("  {:<30} : {}\n", "Unload Strategy", "Stop a strategy and close its .so")
          << "\n";
 
     // Market Coverage Options
@@ -6,11 +6,128 @@
 #include <util.hpp>
 #include <tracker.hpp>
 #include <auth.hpp>
+#include <instruments.hpp>
+#include <subscriptions.hpp>
+#include <dispatcher.hpp>
+#include <oms.hpp>
+#include <portfolio.hpp>
+#include <risk.hpp>
 #include <websocket.hpp>
+#include <accounts.hpp>
+#include <arbiter.hpp>
+#include <async.hpp>
 
 
 bool isStreaming = false;
 
+// Keeps local state (orders, positions) current from notifications
+static void register_state_handlers() {
+    ChannelDispatcher& dispatcher = getChannelDispatcher();
+
+    dispatcher.on_user_orders([](const user_orders_event& e) {
+        for (const auto& o : e.orders) getOrderManager().on_order_update(o);
+    });
+
+    dispatcher.on_user_changes([](const user_changes_event& e) {
+        for (const auto& o : e.orders) getOrderManager().on_order_update(o);
+        getPortfolioCache().on_changes(e);
+    });
+
+    dispatcher.on_user_trades([](const user_trades_event& e) {
+        for (const auto& t : e.trades) getPortfolioCache().on_trade(t);
+    });
+
+    dispatcher.on_user_portfolio([](const portfolio_event& e) {
+        getPortfolioCache().on_portfolio(e);
+    });
+
+    // Market data arrives on whichever session subscribed but marks every account
+    dispatcher.on_ticker([](const ticker_event& e) {
+        for (size_t a = 0; a < accounts::count(); ++a) getPortfolioCache(a).on_ticker(e);
+        getRiskGate().on_ticker(e);
+    });
+
+    dispatcher.on_price_index([](const price_index_event& e) {
+        for (size_t a = 0; a < accounts::count(); ++a) getPortfolioCache(a).on_index(e);
+        getRiskGate().on_index(e);
+    });
+
+    for (size_t a = 0; a < MAX_ACCOUNTS; ++a) {
+        getOrderManager(a).on_reconcile([a](const reconcile_report& report) {
+            if (!report.diverged()) return;
+            fmt::print(fmt::fg(fmt::color::yellow) | fmt::emphasis::bold,
+                "> Order reconciliation (account {}): {} added, {} updated, {} closed\n",
+                a, report.added, report.updated, report.closed);
+            for (const auto& detail : report.details) {
+                fmt::print(fmt::fg(fmt::color::yellow), ">   {}\n", detail);
+            }
+        });
+    }
+}
+
+// Console output for the live stream; every handler is a no-op outside it
+static void register_stream_handlers() {
+    ChannelDispatcher& dispatcher = getChannelDispatcher();
+
+    dispatcher.on_price_index([](const price_index_event& e) {
+        if (!isStreaming) return;
+        fmt::print(fmt::fg(fmt::color::green) | fmt::emphasis::bold, "Price: {} ", e.price);
+        fmt::print(fmt::fg(fmt::color::yellow), "Timestamp: {} ", e.timestamp);
+        fmt::print(fmt::fg(fmt::color::cyan), "Index: {}\n", e.index_name);
+    });
+
+    dispatcher.on_ticker([](const ticker_event& e) {
+        if (!isStreaming) return;
+        fmt::print(fmt::fg(fmt::color::cyan), "Ticker {}: bid {}@{} ask {}@{} mark {} index {}\n",
+                   e.instrument_name, e.best_bid_amount, e.best_bid_price,
+                   e.best_ask_amount, e.best_ask_price, e.mark_price, e.index_price);
+    });
+
+    dispatcher.on_book([](const book_event& e) {
+        if (!isStreaming) return;
+        fmt::print(fmt::fg(fmt::color::cyan), "Book {} {} #{}: {} bids, {} asks\n",
+                   e.instrument_name, e.snapshot ? "snapshot" : "change",
+                   e.change_id, e.bids.size(), e.asks.size());
+    });
+
+    dispatcher.on_trades([](const trades_event& e) {
+        if (!isStreaming) return;
+        for (const auto& t : e.trades) {
+            fmt::print(fmt::fg(fmt::color::cyan), "Trade {} {} {} @ {}\n",
+                       t.instrument_name, t.buy ? "buy" : "sell", t.amount, t.price);
+        }
+    });
+
+    dispatcher.on_user_orders([](const user_orders_event& e) {
+        if (!isStreaming) return;
+        for (const auto& o : e.orders) {
+            fmt::print(fmt::fg(fmt::color::yellow), "Order {} {} {}: {}/{} @ {}\n",
+                       o.order_id, o.instrument_name, o.order_state,
+                       o.filled_amount, o.amount, o.price);
+        }
+    });
+
+    dispatcher.on_user_trades([](const user_trades_event& e) {
+        if (!isStreaming) return;
+        for (const auto& t : e.trades) {
+            fmt::print(fmt::fg(fmt::color::green), "Fill {} {} {} {} @ {}\n",
+                       t.order_id, t.instrument_name, t.buy ? "buy" : "sell", t.amount, t.price);
+        }
+    });
+
+    dispatcher.on_user_portfolio([](const portfolio_event& e) {
+        if (!isStreaming) return;
+        fmt::print(fmt::fg(fmt::color::green), "Portfolio {}: equity {} available {} margin {}\n",
+                   e.currency, e.equity, e.available_funds, e.initial_margin);
+    });
+
+    dispatcher.on_user_changes([](const user_changes_event& e) {
+        if (!isStreaming) return;
+        fmt::print(fmt::fg(fmt::color::yellow), "Changes {}: {} trades, {} positions, {} orders\n",
+                   e.instrument_name, e.trades.size(), e.positions.size(), e.orders.size());
+    });
+}
+
 connection_metadata::connection_metadata(
     int id, 
     websocketpp::connection_hdl hdl, 
@@ -26,14 +143,20 @@ connection_metadata::connection_metadata(
     m_summaries({}),
     m_endpoint(endpoint),
     MSG_PROCESSED(false)
-{}
+{
+    const char* mode = getenv("DERIBIT_THROTTLE_MODE");
+    if (mode != nullptr && string(mode) == "reject") {
+        m_limiter.set_mode(ThrottleMode::REJECT);
+    }
+}
 
 int connection_metadata::get_id() { return m_id; }
 websocketpp::connection_hdl connection_metadata::get_hdl() { return m_hdl; }
 string connection_metadata::get_status() { return m_status; }
 
 void connection_metadata::record_sent_message(string const &message) {
-    m_messages.push_back("SENT: " + message);
+    (void)message;
+    m_sent_count.fetch_add(1, memory_order_relaxed);
 }
 
 void connection_metadata::record_summary(string const &message, string const &sent) {
@@ -59,7 +182,7 @@ void connection_metadata::record_summary(string const &message, string const &se
             map<string, string> summary = {};
             summary["method"] = parsed_msg["method"];
             summary["instrument_name"] = parsed_msg["params"]["instrument_name"];
-            summary["access_token"] = parsed_msg["params"]["access_token"];
+            summary["access_token"] = parsed_msg["params"].value("access_token", "");
             
             if (parsed_msg["params"].contains("amount"))
                 summary["amount"] = to_string(parsed_msg["params"]["amount"].get<double>());
@@ -81,7 +204,7 @@ void connection_metadata::record_summary(string const &message, string const &se
             map<string, string> summary = {};
             summary["method"] = parsed_msg["method"];
             summary["instrument_name"] = parsed_msg["params"]["instrument_name"];
-            summary["access_token"] = parsed_msg["params"]["access_token"];
+            summary["access_token"] = parsed_msg["params"].value("access_token", "");
             
             if (parsed_msg["params"].contains("amount"))
                 summary["amount"] = to_string(parsed_msg["params"]["amount"].get<double>());
@@ -221,17 +344,24 @@ void connection_metadata::on_open(client * c, websocketpp::connection_hdl hdl) {
     m_status = "Connected";
     client::connection_ptr con = c->get_con_from_hdl(hdl);
     m_server = con->get_response_header("Server");
+    if (m_endpoint != nullptr) {
+        m_endpoint->start_heartbeat(m_id);
+        m_endpoint->on_feed_open(m_id);
+    }
 }
 
 void connection_metadata::on_fail(client * c, websocketpp::connection_hdl hdl) {
     m_status = "Failed";
+    if (m_endpoint != nullptr) m_endpoint->router().remove(m_id);
     client::connection_ptr con = c->get_con_from_hdl(hdl);
     m_server = con->get_response_header("Server");
     m_error_reason = con->get_ec().message();
+    if (m_endpoint != nullptr) m_endpoint->on_feed_lost(m_id);
 }
 
 void connection_metadata::on_close(client * c, websocketpp::connection_hdl hdl) {
     m_status = "Closed";
+    if (m_endpoint != nullptr) m_endpoint->router().remove(m_id);
     client::connection_ptr con = c->get_con_from_hdl(hdl);
     stringstream s;
     s << "Close code: " << con->get_remote_close_code() << "("
@@ -239,86 +369,199 @@ void connection_metadata::on_close(client * c, websocketpp::connection_hdl hdl)
       << "), Close reason: " << con->get_remote_close_reason();
     
     m_error_reason = s.str();
+    if (m_endpoint != nullptr) m_endpoint->on_feed_lost(m_id);
 }
 
+// IO stage: hand the payload to the decode stage and go back to reading
 void connection_metadata::on_message(websocketpp::connection_hdl hdl, client::message_ptr msg) {
-    // Start latency tracking
-    getLatencyTracker().start_measurement(
-        LatencyTracker::WEBSOCKET_MESSAGE_PROPAGATION, 
-        "websocket_message_" + to_string(m_id)
-    );
+    if (!msg) return;
+
+    auto received_at = chrono::steady_clock::now();
+    bool text = msg->get_opcode() == websocketpp::frame::opcode::text;
+    if (m_endpoint != nullptr) {
+        m_endpoint->enqueue_frame(this, move(msg->get_raw_payload()), text, received_at);
+        return;
+    }
+
+    json received_json;
+    if (decode_frame(msg->get_payload(), received_json)) {
+        process_message(received_json, msg->get_payload(), text, received_at);
+    }
+}
 
+bool connection_metadata::decode_frame(const string& payload, json& received_json) {
     try {
-        if (!msg) return;
+        received_json = json::parse(payload);
+        return true;
+    } catch (const json::parse_error& e) {
+        cerr << "JSON parse error: " << e.what() << endl;
+        cerr << "Problematic payload: " << payload << endl;
+        return false;
+    }
+}
 
-        string payload = msg->get_payload();
+// Logic stage: everything that touches order, portfolio and session state
+void connection_metadata::process_message(json& received_json, const string& payload, bool text,
+                                          chrono::steady_clock::time_point received_at) {
+    try {
+        // Liveness only: answered here and kept out of every other path
+        if (received_json.value("method", "") == "heartbeat") {
+            if (m_endpoint != nullptr) {
+                bool test_request = received_json.contains("params") &&
+                                    received_json["params"].value("type", "") == "test_request";
+                m_endpoint->on_heartbeat(m_id, test_request);
+            }
+            MSG_PROCESSED = true;
+            cv.notify_one();
+            return;
+        }
+
+        bool notification = received_json.value("method", "") == "subscription";
+        if (notification && received_json.contains("params")) {
+            // Read in place: copying the channel or data would allocate, and a
+            // tree is only freed with the frame, outside the logic stage
+            json& params = received_json["params"];
+            static const json none;
+            const json& channel_name = params.contains("channel") ? params["channel"] : none;
+            string_view channel = channel_name.is_string() ? string_view(channel_name.get_ref<const string&>())
+                                                           : string_view();
+            if (!params.contains("data")) params["data"] = nullptr;
+            json& data = params["data"];
+
+            // A redundant copy of this update already arrived on another connection
+            if (m_endpoint != nullptr && !m_endpoint->arbitrate(channel, data, received_at)) {
+                MSG_PROCESSED = true;
+                cv.notify_one();
+                return;
+            }
+
+            if (isStreaming) {
+                utils::clear_console();
+                fmt::print(fmt::fg(fmt::color::blue) | fmt::emphasis::bold,
+                    "> (Press q to stop streaming, k to cancel all orders)\n\n");
+                cout << "Subscription Data: " << data.dump(4) << endl;
+            }
+
+            // Per-instrument market data goes to its shard; the rest is handled here in order
+            bool sharded = m_endpoint != nullptr && getMarketDataShards().route(channel, data);
+            if (!sharded && !getChannelDispatcher().dispatch(channel, data) && isStreaming) {
+                cerr << "Unsupported channel: " << channel << endl;
+            }
+        }
 
-        json received_json;
-        try {
-            received_json = json::parse(payload);
-        } catch (const json::parse_error& e) {
-            cerr << "JSON parse error: " << e.what() << endl;
-            cerr << "Problematic payload: " << payload << endl;
+        // Mirrors replay the primary's subscribe frames under the same ids, so
+        // their replies would settle requests the primary is still waiting on
+        if (m_endpoint != nullptr && m_endpoint->is_mirror()) {
+            MSG_PROCESSED = true;
+            cv.notify_one();
             return;
         }
+        getSubscriptionManager().on_response(received_json);
 
-        if (received_json.contains("method")) {
-            string method = received_json.value("method", "");
-
-            if (method == "subscription" && isStreaming) {
-                auto params = received_json.value("params", json{});
-                auto data = params.value("data", json{});
-
-                if (!data.is_null() && data.is_object()) {
-                    utils::clear_console();
-                    fmt::print(fmt::fg(fmt::color::blue) | fmt::emphasis::bold,
-                        "> (Press q to stop streaming)\n\n");
-                    cout << "Subscription Data: " << data.dump(4) << endl;
-
-                    if (data.contains("price") && data["price"].is_number() &&
-                        data.contains("timestamp") && data["timestamp"].is_number() &&
-                        data.contains("index_name") && data["index_name"].is_string()) {
-                        double price = data["price"];
-                        int64_t timestamp = data["timestamp"];
-                        string index_name = data["index_name"];
-
-                        fmt::print(fmt::fg(fmt::color::green) | fmt::emphasis::bold,
-                                   "Price: {} ", price);
-                        fmt::print(fmt::fg(fmt::color::yellow),
-                                   "Timestamp: {} ", timestamp);
-                        fmt::print(fmt::fg(fmt::color::cyan),
-                                   "Index: {}\n", index_name);
-                    } else {
-                        cerr << "Unexpected data format" << endl;
-                    }
-                } else {
-                    cerr << "Invalid or null data received" << endl;
-                }
+        // 10028 too_many_requests: the exchange thinks our credits are spent
+        if (received_json.contains("error") && received_json["error"].value("code", 0) == 10028) {
+            m_limiter.on_throttled();
+            getLatencyTracker().count_event("too_many_requests");
+        }
+        // Round trip of a routed order request
+        if (m_endpoint != nullptr && received_json.contains("id") && received_json["id"].is_number_integer()) {
+            m_endpoint->request_answered(received_json["id"].get<long>());
+            m_endpoint->router().on_response(m_id, received_json["id"].get<long>(),
+                                             received_json.contains("error"), received_at);
+        }
+        // Replies to our own background token refresh are handled quietly below
+        bool token_refresh = received_json.contains("id") && received_json["id"].is_number_integer() &&
+                             Password::password().consumeRefresh(received_json["id"].get<long long>());
+
+        // Background reconciliation and snapshot replies only update local state
+        bool reconciliation = token_refresh || (getOrderManager().on_response(received_json) &&
+                               received_json.contains("result") && received_json["result"].is_array()) ||
+                              getPortfolioCache().on_response(received_json);
+
+        // Someone is awaiting this reply (AsyncSession); it is theirs to report
+        bool awaited = getPendingRequests().waiting(received_json);
+
+        bool authenticated = received_json.contains("result") && received_json["result"].is_object() &&
+                             received_json["result"].contains("access_token");
+
+        if (received_json.contains("result") &&
+            InstrumentRegistry::is_instrument_list(received_json["result"])) {
+            InstrumentRegistry& registry = getInstrumentRegistry();
+            long request_id = received_json.contains("id") && received_json["id"].is_number_integer()
+                              ? received_json["id"].get<long>() : 0;
+            size_t changes = registry.load(received_json["result"], request_id);
+            if (changes > 0) {
+                registry.save_cache();
             }
+            utils::printcmd("> Instrument refresh: " + to_string(registry.size()) + " listed, " +
+                            to_string(changes) + " changed\n");
         }
-        if(!isStreaming){
-            if (msg->get_opcode() == websocketpp::frame::opcode::text) {
-                m_messages.push_back("RECEIVED: " + msg->get_payload());
-            record_summary(msg->get_payload(), "RECEIVED");
+        else if(!isStreaming && !notification && !reconciliation && !awaited && !(m_order_entry && authenticated)){
+            if (text) {
+                m_messages.push_back("RECEIVED: " + payload);
+            record_summary(payload, "RECEIVED");
             } else {
-                m_messages.push_back("RECEIVED: " + websocketpp::utility::to_hex(msg->get_payload()));
-            record_summary(websocketpp::utility::to_hex(msg->get_payload()), "RECEIVED");
+                m_messages.push_back("RECEIVED: " + websocketpp::utility::to_hex(payload));
+            record_summary(websocketpp::utility::to_hex(payload), "RECEIVED");
             }
-            if (msg->get_payload()[0] == '{') {
-                cout << "Received message: " << utils::pretty(msg->get_payload()) << endl;
+            if (!payload.empty() && payload[0] == '{') {
+                cout << "Received message: " << utils::pretty(payload) << endl;
             }
             else{
-                cout << "Received message: " << msg->get_payload() << endl;
+                cout << "Received message: " << payload << endl;
+            }
+        }
+
+        if (authenticated && m_order_entry) {
+            // Order-only connection: the session and its refresh belong to the first connection
+            if (m_endpoint != nullptr && m_endpoint->router().add(m_id)) {
+                jsonrpc cancel_on_disconnect("private/enable_cancel_on_disconnect");
+                cancel_on_disconnect["params"] = {{"scope", "connection"}};
+                m_endpoint->send(m_id, cancel_on_disconnect.dump());
+                m_endpoint->arm_kill_switch(m_id);
             }
         }
+        else if (authenticated) {
+            const json& session = received_json["result"];
+            Password::password().setSession(session["access_token"], session.value("refresh_token", ""),
+                                            session.value("expires_in", 0LL), session.value("scope", ""));
+            if (m_endpoint != nullptr) m_endpoint->schedule_token_refresh(m_id);
+            if (token_refresh) getLatencyTracker().count_event("token_refresh");
+        }
+        else if (token_refresh) {
+            utils::printerr("> Token refresh failed: " + received_json.value("error", json::object()).dump() + "\n");
+            // The next attempt signs a fresh login instead
+            Password::password().dropRefreshToken();
+            if (m_endpoint != nullptr) m_endpoint->schedule_token_refresh(m_id, chrono::seconds(5));
+        }
+
+        if (authenticated && !token_refresh && !m_order_entry && m_endpoint != nullptr) {
+            // Authenticated: follow our own orders and positions so local state stays current
+            for (const auto& frame : getSubscriptionManager().subscribe({
+                     "user.orders.any.any.raw", "user.trades.any.any.raw",
+                     "user.changes.any.any.raw", "user.portfolio.any"})) {
+                m_endpoint->send(m_id, frame);
+            }
+            m_endpoint->send(m_id, getPortfolioCache().snapshot_request());
+            m_endpoint->start_reconciliation(m_id);
+
+            // Let the exchange pull our orders if this connection drops
+            jsonrpc cancel_on_disconnect("private/enable_cancel_on_disconnect");
+            cancel_on_disconnect["params"] = {{"scope", "connection"}};
+            m_endpoint->send(m_id, cancel_on_disconnect.dump());
+            m_endpoint->arm_kill_switch(m_id);
+
+            m_endpoint->router().add(m_id);
+            m_endpoint->authenticate_order_connections();
+        }
 
-        if (AUTH_SENT && received_json.contains("result") && 
-            received_json["result"].contains("access_token")) {
-            Password::password().setAccessToken(received_json["result"]["access_token"]);
+        if (authenticated && !token_refresh && !m_order_entry && !awaited) {
             utils::printcmd("Authorization successful!\n");
-            AUTH_SENT = false;
         }
 
+        // Resumed once local state reflects the reply
+        if (awaited) getPendingRequests().complete(received_json);
+
         MSG_PROCESSED = true;
         cv.notify_one();
     }
@@ -328,11 +571,9 @@ void connection_metadata::on_message(websocketpp::connection_hdl hdl, client::me
         cv.notify_one();
     }
 
-    // Stop latency tracking
-    getLatencyTracker().stop_measurement(
-        LatencyTracker::WEBSOCKET_MESSAGE_PROPAGATION, 
-        "websocket_message_" + to_string(m_id)
-    );
+    // Frames overlap in the pipeline, so propagation is timed from the io stage's receipt
+    getLatencyTracker().record(LatencyTracker::WEBSOCKET_MESSAGE_PROPAGATION,
+        chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - received_at));
 }
 
 int websocket_endpoint::streamSubscriptions(const vector<string>& connections) {
@@ -341,21 +582,22 @@ int websocket_endpoint::streamSubscriptions(const vector<string>& connections) {
         return -1;
     }
 
-    json subscribe = {
-        {"jsonrpc", "2.0"},
-        {"id", 4235},
-        {"method", "private/subscribe"},
-        {"params", {
-            {"channels", connections}
-        }}
-    };
+    SubscriptionManager& subscriptions = getSubscriptionManager();
     
     isStreaming = true;
     
-    if (!m_connection_list.empty()) {
-        int connectionId = m_connection_list.begin()->first;
+    int connectionId = -1;
+    {
+        shared_lock<shared_mutex> lock(m_connection_mutex);
+        if (!m_connection_list.empty()) connectionId = m_connection_list.begin()->first;
+    }
+
+    if (connectionId != -1) {
         
-        send(connectionId, subscribe.dump());
+        // Only channels that are not already live need a subscribe frame
+        for (const auto& frame : subscriptions.resubscribe()) {
+            send(connectionId, frame);
+        }
         
         struct termios oldt, newt;
         tcgetattr(STDIN_FILENO, &oldt);
@@ -368,7 +610,7 @@ int websocket_endpoint::streamSubscriptions(const vector<string>& connections) {
         fcntl(STDIN_FILENO, F_SETFL, oldf | O_NONBLOCK);
         
         fmt::print(fmt::fg(fmt::color::blue) | fmt::emphasis::bold,
-                "> Streaming... Press 'q' to quit.\n");
+                "> Streaming... Press 'q' to quit, 'k' to cancel all orders.\n");
         while(isStreaming) {
             // Check for 'q' key press
             char ch;
@@ -376,17 +618,19 @@ int websocket_endpoint::streamSubscriptions(const vector<string>& connections) {
                 if (ch == 'q' || ch == 'Q') {
                     isStreaming = false;
                     
-                    // Unsubscribe
-                    json unsubscribe = {
-                        {"jsonrpc", "2.0"},
-                        {"id", 154},
-                        {"method", "private/unsubscribe_all"},
-                        {"params", {}}
-                    };
+                    // Unsubscribe, keeping the channel list for the next stream
+                    jsonrpc unsubscribe("public/unsubscribe_all");
+                    unsubscribe["params"] = json::object();
                     
                     send(connectionId, unsubscribe.dump());
+                    subscriptions.mark_all_inactive();
                     break;
                 }
+                if (ch == 'k' || ch == 'K') {
+                    int sent = kill_switch();
+                    fmt::print(fmt::fg(fmt::color::red) | fmt::emphasis::bold,
+                        "> Kill switch fired: cancel_all sent on {} connection(s)\n", sent);
+                }
             }
             
             // Prevent busy waiting
@@ -413,7 +657,7 @@ ostream &operator<< (ostream &out, connection_metadata const &data) {
         << "> Status: " << data.m_status << "\n"
         << "> Remote Server: " << (data.m_server.empty() ? "None Specified" : data.m_server) << "\n"
         << "> Error/close reason: " << (data.m_error_reason.empty() ? "N/A" : data.m_error_reason) << "\n"
-        << "> Messages Processed: (" << data.m_messages.size() << ") \n";
+        << "> Messages Processed: (" << data.m_messages.size() + data.m_sent_count.load(memory_order_relaxed) << ") \n";
  
     vector<string>::const_iterator it;
     for (it = data.m_summaries.begin(); it != data.m_summaries.end(); ++it) {
@@ -436,20 +680,112 @@ context_ptr on_tls_init() {
     return context;
 }
 
-websocket_endpoint::websocket_endpoint(): m_next_id(0) {
+websocket_endpoint::websocket_endpoint(size_t account, FeedRole role, string feed_name)
+    : m_account(account), m_next_id(0), m_reconcile_interval(30), m_request_timeout(10000),
+      m_heartbeat_interval(30), m_feed_role(role),
+      m_feed_name(move(feed_name)), m_arbiter_source(SIZE_MAX) {
+    static bool handlers_registered = (register_state_handlers(), register_stream_handlers(), true);
+    (void)handlers_registered;
+
     m_endpoint.clear_access_channels(websocketpp::log::alevel::all);
     m_endpoint.clear_error_channels(websocketpp::log::elevel::all);
 
     m_endpoint.init_asio();
     m_endpoint.start_perpetual();
 
-    m_thread.reset(new websocketpp::lib::thread(&client::run, &m_endpoint));
+    if (const char* interval = getenv("DERIBIT_RECONCILE_SECONDS")) {
+        m_reconcile_interval = chrono::seconds(max(1, atoi(interval)));
+    }
+    if (const char* timeout = getenv("DERIBIT_REQUEST_TIMEOUT_MS")) {
+        m_request_timeout = chrono::milliseconds(max(1, atoi(timeout)));
+    }
+    if (const char* heartbeat = getenv("DERIBIT_HEARTBEAT_SECONDS")) {
+        // The exchange accepts 10s at the least
+        int seconds = atoi(heartbeat);
+        m_heartbeat_interval = chrono::seconds(seconds <= 0 ? 0 : max(10, seconds));
+    }
+
+    register_timers();
+    m_wheel_timer.reset(new boost::asio::steady_timer(m_endpoint.get_io_service()));
+    schedule_wheel_tick();
+
+    // Feed connections never carry orders, so the kill switch is not theirs to fire
+    if (m_feed_role == FeedRole::PRIMARY) {
+        m_kill_signals.reset(new boost::asio::signal_set(m_endpoint.get_io_service(), SIGUSR1));
+        wait_for_kill_signal();
+    }
+
+    // io -> decode -> logic -> market data shards; every stage works on this endpoint's account.
+    // The shard pool is shared by every endpoint, so it is started before the first one runs
+    getMarketDataShards();
+    m_decode_thread = thread(&websocket_endpoint::run_decode_stage, this,
+                             stage_config_from_env(PipelineStage::DECODE));
+    m_logic_thread = thread(&websocket_endpoint::run_logic_stage, this,
+                            stage_config_from_env(PipelineStage::LOGIC));
+
+    m_thread.reset(new websocketpp::lib::thread([this, io = stage_config_from_env(PipelineStage::IO)] {
+        accounts::bind(m_account);
+        apply_stage_config(PipelineStage::IO, io);
+        m_endpoint.run();
+    }));
+}
+
+void websocket_endpoint::enqueue_frame(connection_metadata* connection, string payload, bool text,
+                                       chrono::steady_clock::time_point received_at) {
+    m_decode_queue.push({connection, move(payload), text, received_at});
+}
+
+void websocket_endpoint::run_decode_stage(stage_config config) {
+    accounts::bind(m_account);
+    apply_stage_config(PipelineStage::DECODE, config);
+
+    inbound_frame frame;
+    while (m_pipeline_running.load(memory_order_acquire)) {
+        if (!m_decode_queue.pop(frame, config.spin, chrono::milliseconds(100))) continue;
+
+        decoded_frame decoded{frame.connection, json(), move(frame.payload), frame.text, frame.received_at};
+        if (connection_metadata::decode_frame(decoded.payload, decoded.message)) {
+            m_logic_queue.push(move(decoded));
+        }
+    }
+}
+
+void websocket_endpoint::run_logic_stage(stage_config config) {
+    accounts::bind(m_account);
+    apply_stage_config(PipelineStage::LOGIC, config);
+
+    decoded_frame frame;
+    while (m_pipeline_running.load(memory_order_acquire)) {
+        if (!m_logic_queue.pop(frame, config.spin, chrono::milliseconds(100))) continue;
+
+        frame.connection->process_message(frame.message, frame.payload, frame.text, frame.received_at);
+
+        size_t spilled = m_decode_queue.take_overflow_count() + m_logic_queue.take_overflow_count();
+        if (spilled > 0) getLatencyTracker().count_event("pipeline_overflow", spilled);
+    }
 }
 
 websocket_endpoint::~websocket_endpoint() {
+    m_closing = true;
     m_endpoint.stop_perpetual();
+    if (m_reconnect_timer) m_reconnect_timer->cancel();
+    if (m_wheel_timer) m_wheel_timer->cancel();
+    if (m_refresh_timer) m_refresh_timer->cancel();
+    if (m_kill_signals) m_kill_signals->cancel();
+    {
+        lock_guard<mutex> lock(m_drain_mutex);
+        for (auto& entry : m_drain_timers) {
+            if (entry.second.timer) entry.second.timer->cancel();
+        }
+    }
+
+    con_list connections;
+    {
+        shared_lock<shared_mutex> lock(m_connection_mutex);
+        connections = m_connection_list;
+    }
 
-    for (con_list::const_iterator it = m_connection_list.begin(); it != m_connection_list.end(); ++it) {
+    for (con_list::const_iterator it = connections.begin(); it != connections.end(); ++it) {
         if (it->second->get_status() != "Open") {
             continue;
         }
@@ -465,10 +801,21 @@ websocket_endpoint::~websocket_endpoint() {
     }
     
     m_thread->join();
+
+    // The io thread is gone, so nothing more is produced
+    m_pipeline_running.store(false, memory_order_release);
+    m_decode_queue.wake_consumer();
+    m_logic_queue.wake_consumer();
+    m_decode_thread.join();
+    m_logic_thread.join();
 }
 
 int websocket_endpoint::connect(string const &uri) {
-    int new_id = m_next_id++;
+    int new_id;
+    {
+        unique_lock<shared_mutex> lock(m_connection_mutex);
+        new_id = m_next_id++;
+    }
 
     m_endpoint.set_tls_init_handler(websocketpp::lib::bind(
                                     &on_tls_init
@@ -483,7 +830,10 @@ int websocket_endpoint::connect(string const &uri) {
     }
 
     connection_metadata::ptr metadata_ptr(new connection_metadata(new_id, con->get_handle(), uri, this));
-    m_connection_list[new_id] = metadata_ptr;
+    {
+        unique_lock<shared_mutex> lock(m_connection_mutex);
+        m_connection_list[new_id] = metadata_ptr;
+    }
 
     con->set_open_handler(websocketpp::lib::bind(
                           &connection_metadata::on_open,
@@ -513,10 +863,249 @@ int websocket_endpoint::connect(string const &uri) {
 
     m_endpoint.connect(con);
 
+    if (new_id == 0 && m_feed_role == FeedRole::PRIMARY) {
+        open_order_connections(uri);
+        open_feeds(uri);
+    }
     return new_id;
 }
 
+// Opened alongside the first connection; they sign in once it has logged in
+void websocket_endpoint::open_order_connections(string const &uri) {
+    const char* count = getenv("DERIBIT_ORDER_CONNECTIONS");
+    int connections = count != nullptr ? max(1, atoi(count)) : 1;
+
+    for (int i = 1; i < connections; ++i) {
+        int id = connect(uri);
+        if (id == -1) {
+            utils::printerr("> Could not open order connection " + to_string(i) + "\n");
+            continue;
+        }
+        get_metadata(id)->set_order_entry();
+
+        lock_guard<mutex> lock(m_order_mutex);
+        m_order_connections.push_back(id);
+    }
+}
+
+void websocket_endpoint::authenticate_order_connections() {
+    vector<int> ids;
+    {
+        lock_guard<mutex> lock(m_order_mutex);
+        ids = m_order_connections;
+    }
+    for (int id : ids) {
+        string request = Password::password().authRequest();
+        if (request.empty()) return;
+        send(id, request);
+    }
+}
+
+int websocket_endpoint::route_order(int id) {
+    return m_router.pick(id, [this](int candidate) {
+        connection_metadata::ptr metadata = get_metadata(candidate);
+        return !metadata || congested(metadata) || metadata->limiter().has_queued();
+    });
+}
+
+int websocket_endpoint::pinned_connection(string const &message) {
+    OrderManager& oms = getOrderManager(m_account);
+    optional<order> target;
+    string_view order_id = OrderRouter::order_id(message);
+    if (!order_id.empty()) {
+        target = oms.find(order_id);
+    } else {
+        string_view label = OrderRouter::label(message);
+        if (!label.empty()) {
+            vector<order> labelled = oms.by_label(label);
+            if (!labelled.empty()) target = labelled.front();
+        }
+    }
+    if (!target || target->connection_id == -1) return -1;
+
+    // A closed connection took its orders' sequencing with it
+    connection_metadata::ptr metadata = get_metadata(target->connection_id);
+    if (!metadata || metadata->get_status() != "Connected") return -1;
+    return target->connection_id;
+}
+
+void websocket_endpoint::open_feeds(string const &uri) {
+    feed_sharding sharding;
+    {
+        accounts::scope bound(m_account);
+        sharding = getSubscriptionManager().sharding();
+    }
+
+    {
+        lock_guard<mutex> lock(m_feed_mutex);
+        m_feed_sharding = sharding;
+        for (size_t i = 1; i <= m_feed_sharding.feed_links(); ++i) {
+            feed_link feed;
+            feed.endpoint.reset(new websocket_endpoint(m_account, FeedRole::FEED, "feed" + to_string(i)));
+            feed.endpoint->m_feed_shard = i;
+            feed.endpoint->m_feed_uri = uri;
+            feed.connection_id = feed.endpoint->connect(uri);
+            feed.endpoint->m_feed_connection = feed.connection_id;
+            if (feed.connection_id == -1) {
+                utils::printerr("> Could not open feed connection " + to_string(i) + "\n");
+            }
+            feed.endpoint->open_mirrors(uri, sharding.copies);
+            m_feeds.push_back(move(feed));
+        }
+    }
+    // Split: this connection carries no public data to copy
+    if (!sharding.split) open_mirrors(uri, sharding.copies);
+}
+
+// Copies b, c, ... of this feed; the arbiter keeps whichever copy of an update lands first
+void websocket_endpoint::open_mirrors(string const &uri, size_t copies) {
+    if (copies < 2) return;
+
+    accounts::scope bound(m_account);
+    FeedArbiter& arbiter = getFeedArbiter();
+    m_arbiter_source.store(arbiter.add_source(m_feed_name + ".a"), memory_order_release);
+
+    lock_guard<mutex> lock(m_feed_mutex);
+    for (size_t copy = 1; copy < copies && copy < 26; ++copy) {
+        string name = m_feed_name + "." + static_cast<char>('a' + copy);
+        feed_link mirror;
+        mirror.endpoint.reset(new websocket_endpoint(m_account, FeedRole::MIRROR, name));
+        mirror.endpoint->m_arbiter_source.store(arbiter.add_source(name), memory_order_release);
+        mirror.connection_id = mirror.endpoint->connect(uri);
+        if (mirror.connection_id == -1) {
+            utils::printerr("> Could not open redundant connection " + name + "\n");
+        }
+        m_mirrors.push_back(move(mirror));
+    }
+}
+
+bool websocket_endpoint::arbitrate(string_view channel, json const &data,
+                                   chrono::steady_clock::time_point received_at) {
+    size_t source = m_arbiter_source.load(memory_order_acquire);
+    if (source == SIZE_MAX) return true;
+    return getFeedArbiter().accept(source, channel, data, received_at);
+}
+
+static bool is_public_subscription(string const &message) {
+    return message.find("\"method\":\"public/subscribe\"") != string::npos ||
+           message.find("\"method\":\"public/unsubscribe") != string::npos;
+}
+
+// Public queries that belong on a market-data connection in the split layout
+static bool is_market_data_request(string const &message) {
+    static const string methods[] = {
+        "\"method\":\"public/get_order_book\"", "\"method\":\"public/ticker\"",
+        "\"method\":\"public/get_last_trades_by_instrument\"",
+        "\"method\":\"public/get_book_summary_by_instrument\"", "\"method\":\"public/get_index_price\""
+    };
+    for (const auto& method : methods) {
+        if (message.find(method) != string::npos) return true;
+    }
+    return false;
+}
+
+void websocket_endpoint::mirror_feed(string const &message) {
+    if (!is_public_subscription(message)) return;
+
+    lock_guard<mutex> lock(m_feed_mutex);
+    for (auto& mirror : m_mirrors) {
+        if (mirror.connection_id != -1) mirror.endpoint->send(mirror.connection_id, message);
+    }
+}
+
+size_t websocket_endpoint::feed_count() {
+    lock_guard<mutex> lock(m_feed_mutex);
+    return m_feed_sharding.split ? m_feeds.size() : m_feeds.size() + 1;
+}
+
+// Subscription frames are built per feed connection; the first channel says which one.
+// In the split layout market-data queries follow their instrument's channels.
+bool websocket_endpoint::route_feed(string const &message, int& result) {
+    bool query = is_market_data_request(message);
+    if (!query && !is_public_subscription(message)) return false;
+
+    json frame = json::parse(message, nullptr, false);
+    if (frame.is_discarded()) return false;
+    string method = frame.value("method", "");
+
+    lock_guard<mutex> lock(m_feed_mutex);
+    if (m_feeds.empty()) return false;
+
+    if (query) {
+        if (!m_feed_sharding.split) return false;
+        string instrument = frame["params"].value("instrument_name", frame["params"].value("index_name", ""));
+        size_t shard = feed_shard("ticker." + instrument, m_feed_sharding);
+        if (shard == 0 || shard > m_feeds.size()) return false;
+
+        int connection = m_feeds[shard - 1].endpoint->feed_connection();
+        result = connection == -1 ? -1 : m_feeds[shard - 1].endpoint->send(connection, message);
+        return true;
+    }
+
+    if (method == "public/unsubscribe_all") {
+        // Goes to every connection; the caller sends it on this one too
+        for (auto& feed : m_feeds) {
+            int connection = feed.endpoint->feed_connection();
+            if (connection != -1) feed.endpoint->send(connection, message);
+        }
+        return false;
+    }
+    if (method != "public/subscribe" && method != "public/unsubscribe") return false;
+
+    const json& channels = frame["params"].value("channels", json::array());
+    if (channels.empty() || !channels[0].is_string()) return false;
+
+    size_t shard = feed_shard(channels[0].get<string>(), m_feed_sharding);
+    if (shard == 0 || shard > m_feeds.size()) return false;
+
+    int connection = m_feeds[shard - 1].endpoint->feed_connection();
+    result = connection == -1 ? -1 : m_feeds[shard - 1].endpoint->send(connection, message);
+    return true;
+}
+
+void websocket_endpoint::on_feed_lost(int id) {
+    if (m_feed_role != FeedRole::FEED || m_closing || id != m_feed_connection) return;
+
+    // The exchange dropped this shard's subscriptions along with the connection
+    accounts::scope bound(m_account);
+    getSubscriptionManager().mark_inactive(m_feed_shard);
+    getLatencyTracker().count_event("feed_reconnect");
+    utils::printerr("> Feed connection " + m_feed_name + " lost, reconnecting\n");
+    schedule_reconnect();
+}
+
+void websocket_endpoint::schedule_reconnect() {
+    auto delay = chrono::seconds(1 << min(m_reconnect_attempts, 5u));
+    m_reconnect_attempts++;
+
+    if (!m_reconnect_timer) m_reconnect_timer.reset(new boost::asio::steady_timer(m_endpoint.get_io_service()));
+    m_reconnect_timer->expires_after(delay);
+    m_reconnect_timer->async_wait([this](const boost::system::error_code& ec) {
+        if (ec || m_closing) return;
+        int id = connect(m_feed_uri);
+        if (id == -1) {
+            schedule_reconnect();
+            return;
+        }
+        m_feed_connection = id;
+    });
+}
+
+void websocket_endpoint::on_feed_open(int id) {
+    if (m_feed_role != FeedRole::FEED || id != m_feed_connection || m_reconnect_attempts == 0) return;
+    m_reconnect_attempts = 0;
+
+    accounts::scope bound(m_account);
+    SubscriptionManager& subscriptions = getSubscriptionManager();
+    // Anything subscribed while the connection was down went nowhere either
+    subscriptions.mark_inactive(m_feed_shard);
+    for (const auto& frame : subscriptions.resubscribe(m_feed_shard)) {
+        send(id, frame);
+    }
+}
+
 connection_metadata::ptr websocket_endpoint::get_metadata(int id) const {
+    shared_lock<shared_mutex> lock(m_connection_mutex);
     con_list::const_iterator it = m_connection_list.find(id);
     if (it == m_connection_list.end()) {
         return connection_metadata::ptr(); // Return null/empty pointer if not found
@@ -527,36 +1116,389 @@ connection_metadata::ptr websocket_endpoint::get_metadata(int id) const {
 void websocket_endpoint::close(int id, websocketpp::close::status::value code, string reason) {
     websocketpp::lib::error_code ec;
     
-    con_list::iterator it = m_connection_list.find(id);
-    if (it == m_connection_list.end()) {
+    connection_metadata::ptr metadata = get_metadata(id);
+    if (!metadata) {
         cout << "> No connection found with id " << id << endl;
         return;
     }
     
-    m_endpoint.close(it->second->get_hdl(), code, reason, ec);
+    m_endpoint.close(metadata->get_hdl(), code, reason, ec);
     if (ec) {
         cout << "> Error closing connection " << id << ": "  
                   << ec.message() << endl;
     }
 }
 
-int websocket_endpoint::send(int id, string message) {
-    websocketpp::lib::error_code ec;
-    
-    con_list::iterator it = m_connection_list.find(id);
-    if (it == m_connection_list.end()) {
+void websocket_endpoint::start_reconciliation(int id) {
+    // The RECONCILE handler reschedules on the io thread; restarting there too
+    // keeps a single chain
+    boost::asio::post(m_endpoint.get_io_service(), [this, id]() {
+        m_timers.cancel(m_reconcile_timer.exchange(0));
+        m_reconcile_connection = id;
+        send(id, getOrderManager().reconcile_request());
+        m_reconcile_timer = m_timers.schedule(TimerKind::RECONCILE, id, m_reconcile_interval);
+    });
+}
+
+void websocket_endpoint::register_timers() {
+    m_timers.on(TimerKind::REQUEST_TIMEOUT, [this](uint64_t key) {
+        on_request_timeout(static_cast<long>(key));
+    });
+
+    m_timers.on(TimerKind::ORDER_EXPIRY, [this](uint64_t key) {
+        int connection_id = static_cast<int>(key >> 48);
+        optional<order> o = getOrderManager(m_account).by_request(static_cast<long>(key & ((1ULL << 48) - 1)));
+        if (!o || !o->is_live()) return;
+
+        // Not acknowledged yet, so there is no order id to cancel by; wait until
+        // the request is answered or rejected, either of which settles the order
+        if (o->order_id.empty()) {
+            m_timers.schedule(TimerKind::ORDER_EXPIRY, key, chrono::milliseconds(50));
+            return;
+        }
+        jsonrpc cancel("private/cancel");
+        cancel["params"] = {{"order_id", o->order_id}};
+        send(connection_id, cancel.dump());
+        getLatencyTracker().count_event("order_expired");
+    });
+
+    m_timers.on(TimerKind::RECONCILE, [this](uint64_t key) {
+        int id = static_cast<int>(key);
+        connection_metadata::ptr metadata = get_metadata(id);
+        if (!metadata || metadata->get_status() != "Connected") return;
+
+        send(id, getOrderManager().reconcile_request());
+        m_reconcile_timer = m_timers.schedule(TimerKind::RECONCILE, id, m_reconcile_interval);
+    });
+
+    m_timers.on(TimerKind::HEARTBEAT, [this](uint64_t key) {
+        int id = static_cast<int>(key);
+        {
+            lock_guard<mutex> lock(m_timer_mutex);
+            m_heartbeat_timers.erase(id);
+        }
+        connection_metadata::ptr metadata = get_metadata(id);
+        if (!metadata || metadata->get_status() != "Connected") return;
+
+        getLatencyTracker().count_event("heartbeat_missed");
+        utils::printerr("> No heartbeat on connection " + to_string(id) + " (" + m_feed_name + ") for " +
+                        to_string(2 * m_heartbeat_interval.count()) + "s\n");
+    });
+}
+
+void websocket_endpoint::schedule_wheel_tick() {
+    m_wheel_timer->expires_after(m_timers.tick());
+    m_wheel_timer->async_wait([this](const boost::system::error_code& ec) {
+        if (ec) return;
+        m_timers.advance(chrono::steady_clock::now());
+        schedule_wheel_tick();
+    });
+}
+
+void websocket_endpoint::arm_request_timeout(long request_id, int connection_id) {
+    // A mirror's copy of a subscribe frame is answered on the primary's timer
+    if (request_id == 0 || m_feed_role == FeedRole::MIRROR) return;
+    lock_guard<mutex> lock(m_timer_mutex);
+    if (request_timer* armed = m_request_timers.find(request_id)) m_timers.cancel(armed->timer);
+    m_request_timers.insert_or_assign(request_id, request_timer{
+        m_timers.schedule(TimerKind::REQUEST_TIMEOUT, request_id, m_request_timeout), connection_id});
+}
+
+void websocket_endpoint::request_answered(long request_id) {
+    lock_guard<mutex> lock(m_timer_mutex);
+    if (request_timer* armed = m_request_timers.find(request_id)) {
+        m_timers.cancel(armed->timer);
+        m_request_timers.erase(request_id);
+    }
+}
+
+void websocket_endpoint::on_request_timeout(long request_id) {
+    int connection_id = -1;
+    {
+        lock_guard<mutex> lock(m_timer_mutex);
+        if (request_timer* armed = m_request_timers.find(request_id)) connection_id = armed->connection_id;
+        m_request_timers.erase(request_id);
+    }
+    getLatencyTracker().count_event("request_timeout");
+    m_router.on_timeout(request_id);
+
+    // Whoever awaits the reply gets an error instead of waiting forever
+    json timeout = PendingRequests::local_error(request_id, "no response within " +
+                                                to_string(m_request_timeout.count()) + "ms");
+    getPendingRequests().complete(timeout);
+
+    // An unanswered order leaves the local book unsure; ask the exchange once on
+    // the connection that carried it, or the reconciling one if that is gone,
+    // leaving the periodic schedule as it is
+    if (getOrderManager().find_request(request_id) && m_feed_role == FeedRole::PRIMARY) {
+        connection_metadata::ptr metadata = get_metadata(connection_id);
+        if (!metadata || metadata->get_status() != "Connected") {
+            connection_id = m_reconcile_connection;
+            metadata = get_metadata(connection_id);
+        }
+        if (!metadata || metadata->get_status() != "Connected") return;
+
+        utils::printerr("> No response to order request " + to_string(request_id) + ", reconciling on connection " +
+                        to_string(connection_id) + "\n");
+        send(connection_id, getOrderManager().reconcile_request());
+    }
+}
+
+void websocket_endpoint::expire_order(long request_id, int connection_id, chrono::milliseconds after) {
+    if (!getOrderManager(m_account).by_request(request_id)) return;
+    // Followed by request id, which stays with the order even when a notification created its entry first
+    m_timers.schedule(TimerKind::ORDER_EXPIRY, (static_cast<uint64_t>(connection_id) << 48) | static_cast<uint64_t>(request_id), after);
+}
+
+void websocket_endpoint::start_heartbeat(int id) {
+    if (m_heartbeat_interval.count() == 0) return;
+
+    jsonrpc set_heartbeat("public/set_heartbeat");
+    set_heartbeat["params"] = {{"interval", m_heartbeat_interval.count()}};
+    // Awaited by nobody, which also keeps the reply off the console
+    getPendingRequests().expect(set_heartbeat["id"].get<long>(), [](const json&) {});
+    send(id, set_heartbeat.dump());
+    on_heartbeat(id, false);
+}
+
+void websocket_endpoint::on_heartbeat(int id, bool test_request) {
+    if (test_request) {
+        jsonrpc test("public/test");
+        test["params"] = json::object();
+        getPendingRequests().expect(test["id"].get<long>(), [](const json&) {});
+        send(id, test.dump());
+    }
+
+    lock_guard<mutex> lock(m_timer_mutex);
+    auto it = m_heartbeat_timers.find(id);
+    if (it != m_heartbeat_timers.end()) m_timers.cancel(it->second);
+    m_heartbeat_timers[id] = m_timers.schedule(TimerKind::HEARTBEAT, id, 2 * m_heartbeat_interval);
+}
+
+int websocket_endpoint::send(int id, string const &message) {
+    connection_metadata::ptr metadata = get_metadata(id);
+    if (!metadata) {
         cout << "> No connection found with id " << id << endl;
         return -1;
     }
-    
-    m_endpoint.send(it->second->get_hdl(), message, websocketpp::frame::opcode::text, ec);
+
+    int routed = 0;
+    if (m_feed_role == FeedRole::PRIMARY && route_feed(message, routed)) return routed;
+    if (m_feed_role != FeedRole::MIRROR) mirror_feed(message);
+
+    if (m_killed && RateLimiter::classify(message) == RequestClass::MATCHING_ENGINE &&
+        !RateLimiter::is_cancel(message)) {
+        utils::printerr("> Kill switch is active, order refused\n");
+        reject_request(OrderRouter::request_id(message), "kill switch active");
+        return -1;
+    }
+
+    // New orders go out on the fastest order-entry connection that is not backed
+    // up; edits and cancels follow the connection that carried their order
+    if (RateLimiter::classify(message) == RequestClass::MATCHING_ENGINE) {
+        int routed_id = RateLimiter::priority(message) == SendPriority::NEW_ORDER
+                            ? route_order(id) : pinned_connection(message);
+        if (routed_id != -1 && routed_id != id) {
+            if (connection_metadata::ptr routed = get_metadata(routed_id)) {
+                id = routed_id;
+                metadata = routed;
+            }
+        }
+        if (RateLimiter::priority(message) == SendPriority::NEW_ORDER) {
+            getOrderManager(m_account).on_order_routed(OrderRouter::request_id(message), id);
+        }
+    }
+
+    // Timed from admission, so a frame held by the limiter still gets answered
+    arm_request_timeout(OrderRouter::request_id(message), id);
+
+    long superseded = 0;
+    switch (metadata->limiter().admit(message, congested(metadata), &superseded)) {
+        case RateLimiter::QUEUED:
+            getLatencyTracker().count_event("throttle_queued");
+            schedule_drain(id);
+            return 0;
+        case RateLimiter::COALESCED: {
+            // The exchange answers only the newest edit; the one it replaced is answered here
+            getLatencyTracker().count_event("edit_coalesced");
+            request_answered(superseded);
+            getPendingRequests().complete({{"jsonrpc", "2.0"}, {"id", superseded},
+                                           {"result", {{"coalesced_into", OrderRouter::request_id(message)}}}});
+            return 0;
+        }
+        case RateLimiter::REJECTED:
+            getLatencyTracker().count_event("throttle_rejected");
+            cout << "> Request rate limit reached on connection " << id << ", message dropped" << endl;
+            reject_request(OrderRouter::request_id(message), "request rate limit reached");
+            return -1;
+        case RateLimiter::SEND:
+            break;
+    }
+
+    return transmit(metadata, message);
+}
+
+int websocket_endpoint::transmit(connection_metadata::ptr metadata, string const &message) {
+    websocketpp::lib::error_code ec;
+    auto sent_at = chrono::steady_clock::now();
+
+    // Held across the write: once kill_switch() has latched, no order can follow its cancel_all
+    bool order_entry = RateLimiter::classify(message) == RequestClass::MATCHING_ENGINE &&
+                       !RateLimiter::is_cancel(message);
+    shared_lock<shared_mutex> gate(m_kill_gate, defer_lock);
+    if (order_entry) {
+        gate.lock();
+        if (m_killed) {
+            reject_request(OrderRouter::request_id(message), "kill switch active");
+            return -1;
+        }
+    }
+
+    m_endpoint.send(metadata->get_hdl(), message, websocketpp::frame::opcode::text, ec);
+    if (gate.owns_lock()) gate.unlock();
     
     if (ec) {
-        cout << "> Error sending message to connection " << id << ": "  
+        cout << "> Error sending message to connection " << metadata->get_id() << ": "  
                   << ec.message() << endl;
         return -1;
     }
     
-    it->second->record_sent_message(message);
+    metadata->record_sent_message(message);
+    if (RateLimiter::classify(message) == RequestClass::MATCHING_ENGINE) {
+        m_router.on_sent(metadata->get_id(), OrderRouter::request_id(message), sent_at);
+    }
     return 0;
+}
+
+void websocket_endpoint::schedule_token_refresh(int id, chrono::milliseconds delay) {
+    if (delay.count() == 0) {
+        long long next = Password::password().refreshDelay(utils::time_now());
+        if (next < 0) return;
+        delay = chrono::milliseconds(next);
+    }
+
+    lock_guard<mutex> lock(m_refresh_mutex);
+    if (!m_refresh_timer) m_refresh_timer.reset(new boost::asio::steady_timer(m_endpoint.get_io_service()));
+
+    // Re-arming cancels the previous wait
+    m_refresh_timer->expires_after(delay);
+    m_refresh_timer->async_wait([this, id](const boost::system::error_code& ec) {
+        if (ec) return;
+
+        string request = Password::password().refreshRequest();
+        if (!request.empty()) send(id, request);
+        authenticate_order_connections();
+    });
+}
+
+void websocket_endpoint::arm_kill_switch(int id) {
+    jsonrpc cancel_all("private/cancel_all");
+    cancel_all["params"] = json::object();
+
+    lock_guard<mutex> lock(m_kill_mutex);
+    m_kill_frames[id] = cancel_all.dump();
+}
+
+int websocket_endpoint::kill_switch() {
+    auto triggered = chrono::steady_clock::now();
+
+    // Waits out any order frame being written right now; every later one is refused
+    {
+        unique_lock<shared_mutex> gate(m_kill_gate);
+        m_killed = true;
+    }
+
+    map<int, string> frames;
+    {
+        lock_guard<mutex> lock(m_kill_mutex);
+        frames = m_kill_frames;
+    }
+
+    int sent = 0;
+    for (const auto& [id, frame] : frames) {
+        connection_metadata::ptr metadata = get_metadata(id);
+        if (!metadata) continue;
+
+        vector<string> dropped = metadata->limiter().drop_pending_orders();
+        for (const auto& message : dropped) {
+            reject_request(OrderRouter::request_id(message), "dropped by kill switch");
+        }
+        if (!dropped.empty()) getLatencyTracker().count_event("kill_switch_dropped", dropped.size());
+
+        // Bypasses the scheduler: nothing queued may go out ahead of it
+        arm_request_timeout(OrderRouter::request_id(frame), id);
+        if (transmit(metadata, frame) == 0) {
+            getLatencyTracker().record(LatencyTracker::KILL_SWITCH,
+                chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - triggered));
+            sent++;
+        }
+
+        // Fresh request ids for the next trigger
+        arm_kill_switch(id);
+    }
+    getLatencyTracker().count_event("kill_switch");
+    return sent;
+}
+
+void websocket_endpoint::resume_trading() {
+    unique_lock<shared_mutex> gate(m_kill_gate);
+    m_killed = false;
+}
+
+void websocket_endpoint::reject_request(long request_id, const string& reason) {
+    if (request_id == 0) return;
+    getOrderManager(m_account).on_order_dropped(request_id, reason);
+    request_answered(request_id);
+    getPendingRequests().complete(PendingRequests::local_error(request_id, reason));
+}
+
+void websocket_endpoint::wait_for_kill_signal() {
+    m_kill_signals->async_wait([this](const boost::system::error_code& ec, int) {
+        if (ec) return;
+        kill_switch();
+        wait_for_kill_signal();
+    });
+}
+
+// Frames held while the socket has this much unsent data can still be reordered
+static constexpr size_t SEND_HIGH_WATER = 64 * 1024;
+
+bool websocket_endpoint::congested(connection_metadata::ptr metadata) {
+    try {
+        client::connection_ptr con = m_endpoint.get_con_from_hdl(metadata->get_hdl());
+        return con && con->get_buffered_amount() > SEND_HIGH_WATER;
+    } catch (const exception&) {
+        return false;
+    }
+}
+
+void websocket_endpoint::schedule_drain(int id) {
+    connection_metadata::ptr metadata = get_metadata(id);
+    if (!metadata) return;
+
+    chrono::nanoseconds delay = congested(metadata) ? chrono::milliseconds(1)
+                                                    : metadata->limiter().next_delay();
+
+    lock_guard<mutex> lock(m_drain_mutex);
+    drain_timer& drain = m_drain_timers[id];
+    if (drain.armed) return;
+    if (!drain.timer) drain.timer.reset(new boost::asio::steady_timer(m_endpoint.get_io_service()));
+
+    drain.armed = true;
+    drain.timer->expires_after(delay);
+    drain.timer->async_wait([this, id, metadata](const boost::system::error_code& ec) {
+        {
+            lock_guard<mutex> lock(m_drain_mutex);
+            m_drain_timers[id].armed = false;
+        }
+        if (ec) return;
+
+        string message;
+        chrono::nanoseconds waited{0};
+        while (!congested(metadata) && metadata->limiter().next_ready(message, waited)) {
+            getLatencyTracker().record(LatencyTracker::THROTTLE_DELAY, waited);
+            transmit(metadata, message);
+        }
+        if (metadata->limiter().has_queued()) schedule_drain(id);
+    });
 }
\ No newline at end of file
@@ -0,0 +1,229 @@
+#include "api.hpp"
+#include "async.hpp"
+#include "oms.hpp"
+#include "pool.hpp"
+#include "sessions.hpp"
+#include "websocket.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+
+using namespace std;
+
+using json = nlohmann::json;
+
+// Once the pools and buffers have warmed up, handling market data and order
+// updates and sending orders must not touch the heap. Frames go through the
+// logic stage (connection_metadata::process_message) with the production
+// handlers registered, and orders through AsyncSession::submit and
+// websocket_endpoint::send. Not covered: json::parse, which builds (and the
+// pipeline later frees) a fresh tree per frame, and the transport's own write.
+
+// Counts every allocation for heap_allocations(); new[] and the nothrow forms forward here
+void* operator new(size_t size) {
+    count_heap_allocation();
+    if (size == 0) size = 1;
+    while (true) {
+        if (void* p = malloc(size)) return p;
+        new_handler handler = get_new_handler();
+        if (handler == nullptr) throw bad_alloc();
+        handler();
+    }
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    free(p);
+}
+
+namespace {
+    const char* BOOK = R"({"jsonrpc":"2.0","method":"subscription","params":{"channel":"book.BTC-PERPETUAL.100ms",
+        "data":{"type":"change","timestamp":1700000000000,"prev_change_id":41,"change_id":42,
+        "instrument_name":"BTC-PERPETUAL",
+        "bids":[["new",50000.0,10.0],["change",49999.5,25.0],["delete",49990.0,0.0]],
+        "asks":[["new",50000.5,8.0],["change",50001.0,12.0]]}}})";
+
+    const char* TRADES = R"({"jsonrpc":"2.0","method":"subscription","params":{"channel":"trades.BTC-PERPETUAL.raw",
+        "data":[
+        {"trade_seq":1001,"trade_id":"BTC-9001","timestamp":1700000000001,"tick_direction":0,
+         "price":50000.5,"mark_price":50000.2,"instrument_name":"BTC-PERPETUAL","index_price":49998.1,
+         "direction":"buy","amount":10.0},
+        {"trade_seq":1002,"trade_id":"BTC-9002","timestamp":1700000000002,"tick_direction":1,
+         "price":50000.0,"mark_price":50000.2,"instrument_name":"BTC-PERPETUAL","index_price":49998.1,
+         "direction":"sell","amount":20.0}]}})";
+
+    const char* TICKER = R"({"jsonrpc":"2.0","method":"subscription","params":{"channel":"ticker.BTC-PERPETUAL.100ms",
+        "data":{"timestamp":1700000000003,"instrument_name":"BTC-PERPETUAL","best_bid_price":50000.0,
+        "best_bid_amount":10.0,"best_ask_price":50000.5,"best_ask_amount":8.0,"mark_price":50000.2,
+        "index_price":49998.1,"last_price":50000.5,"open_interest":1000.0,"state":"open"}}})";
+
+    // The exchange's reply to a new order, and the notification that closes it
+    const char* ACK = R"({"jsonrpc":"2.0","id":%ld,"result":{"trades":[],"order":{"order_id":"BTC-%ld",
+        "label":"mm","instrument_name":"BTC-PERPETUAL","order_state":"open","order_type":"limit",
+        "direction":"%s","price":50000.0,"amount":10.0,"filled_amount":0.0,"average_price":0.0,
+        "creation_timestamp":1700000000000,"last_update_timestamp":1700000000000}}})";
+
+    const char* CANCELLED = R"({"jsonrpc":"2.0","method":"subscription","params":{"channel":"user.orders.any.any.raw",
+        "data":[{"order_id":"BTC-%ld","label":"mm","instrument_name":"BTC-PERPETUAL","order_state":"cancelled",
+        "order_type":"limit","direction":"%s","price":50000.0,"amount":10.0,"filled_amount":0.0,
+        "average_price":0.0,"creation_timestamp":1700000000000,"last_update_timestamp":1700000000001}]}})";
+
+    // A frame outside order entry, for what the transport costs on its own
+    const char* QUERY = R"({"id":990000001,"jsonrpc":"2.0","method":"public/get_time","params":{}})";
+    const char* QUERY_ID = R"({"id":%ld,"jsonrpc":"2.0","method":"public/get_time","params":{}})";
+    const char* REPLY = R"({"jsonrpc":"2.0","id":%ld,"result":1700000000000})";
+
+    int failures = 0;
+
+    void expect_no_allocations(const char* what, uint64_t allocations) {
+        if (allocations == 0) return;
+        fprintf(stderr, "FAIL: %s made %llu heap allocations\n", what, static_cast<unsigned long long>(allocations));
+        failures++;
+    }
+
+    // Decodes and handles one frame as the pipeline does, returning the
+    // allocations made after parsing
+    uint64_t receive(connection_metadata& connection, json& frame, const string& payload) {
+        connection_metadata::decode_frame(payload, frame);
+        uint64_t before = heap_allocations();
+        connection.process_message(frame, payload, true, chrono::steady_clock::now());
+        return heap_allocations() - before;
+    }
+}
+
+int main() {
+    // Market data is handled on the calling thread, where allocations are counted
+    setenv("DERIBIT_MD_SHARDS", "0", 1);
+    setenv("DERIBIT_HEARTBEAT_SECONDS", "0", 1);
+
+    // Registers the order, portfolio, risk and console handlers
+    session trader;
+    trader.endpoint.reset(new websocket_endpoint());
+    trader.connection_id = trader.endpoint->connect("wss://127.0.0.1:1/ws/api/v2");
+    connection_metadata::ptr connection = trader.endpoint->get_metadata(trader.connection_id);
+    if (!connection) {
+        fprintf(stderr, "FAIL: no connection to send orders on\n");
+        return 1;
+    }
+    connection->limiter().set_bucket(RequestClass::MATCHING_ENGINE, 1e12, 1e12, 1);
+    connection->limiter().set_bucket(RequestClass::NON_MATCHING_ENGINE, 1e12, 1e12, 1);
+    AsyncSession requests(trader);
+
+    // The connection never opens, so let its attempt settle before measuring
+    for (int i = 0; i < 200 && connection->get_status() == "Connecting"; ++i) {
+        this_thread::sleep_for(chrono::milliseconds(10));
+    }
+    // Sends to it fail and say so
+    cout.setstate(ios::badbit);
+
+    const string book = BOOK;
+    const string trades = TRADES;
+    const string ticker = TICKER;
+    const string query = QUERY;
+    json frame;
+
+    api::order_request request;
+    request.instrument = "BTC-PERPETUAL";
+    request.amount = 10;
+    request.price = 50000;
+    request.label = "mm";
+
+    string ack;
+    string cancelled;
+    string reply;
+    ack.reserve(1024);
+    cancelled.reserve(1024);
+    reply.reserve(256);
+    char buffer[1024];
+
+    // Whatever the transport allocates for one frame, set once warmed up
+    uint64_t transport = 0;
+    auto beyond_transport = [&transport](uint64_t allocations) {
+        return allocations > transport ? allocations - transport : 0;
+    };
+
+    // One order from submission to its close, returning the allocations
+    // outside json::parse and the transport
+    auto trade = [&](bool buy) -> uint64_t {
+        request.buy = buy;
+        uint64_t before = heap_allocations();
+        long request_id = requests.submit(request);
+        uint64_t allocations = beyond_transport(heap_allocations() - before);
+        if (request_id == -1) {
+            fprintf(stderr, "FAIL: order refused\n");
+            exit(1);
+        }
+        const char* direction = buy ? "buy" : "sell";
+        ack.assign(buffer, snprintf(buffer, sizeof(buffer), ACK, request_id, request_id, direction));
+        allocations += receive(*connection, frame, ack);
+        cancelled.assign(buffer, snprintf(buffer, sizeof(buffer), CANCELLED, request_id, direction));
+        allocations += receive(*connection, frame, cancelled);
+        return allocations;
+    };
+
+    // An awaited request, completed inline as its reply is handled
+    long query_id = 990000100;
+    auto await = [&]() -> uint64_t {
+        long id = query_id++;
+        bool answered = false;
+        pending_response awaited(trader.endpoint.get(), trader.connection_id,
+                                 {string(buffer, snprintf(buffer, sizeof(buffer), QUERY_ID, id))});
+        uint64_t before = heap_allocations();
+        awaited.then([&answered](const json&) { answered = true; });
+        uint64_t allocations = beyond_transport(heap_allocations() - before);
+        reply.assign(buffer, snprintf(buffer, sizeof(buffer), REPLY, id));
+        allocations += receive(*connection, frame, reply);
+        if (!answered) {
+            fprintf(stderr, "FAIL: awaited request %ld was not completed\n", id);
+            failures++;
+        }
+        return allocations;
+    };
+
+    // Long enough for the OMS to recycle slots past MAX_FINISHED retired
+    // orders and for the latency samples to wrap
+    for (size_t i = 0; i < 8 * OrderManager::MAX_FINISHED; ++i) {
+        receive(*connection, frame, book);
+        receive(*connection, frame, trades);
+        receive(*connection, frame, ticker);
+        trade(i & 1);
+        await();
+        trader.endpoint->send(trader.connection_id, query);
+    }
+
+    uint64_t before = heap_allocations();
+    trader.endpoint->send(trader.connection_id, query);
+    transport = heap_allocations() - before;
+
+    uint64_t allocations = 0;
+    for (size_t i = 0; i < 1000; ++i) allocations += receive(*connection, frame, book);
+    expect_no_allocations("book notification", allocations);
+
+    allocations = 0;
+    for (size_t i = 0; i < 1000; ++i) allocations += receive(*connection, frame, trades);
+    expect_no_allocations("trades notification", allocations);
+
+    allocations = 0;
+    for (size_t i = 0; i < 1000; ++i) allocations += receive(*connection, frame, ticker);
+    expect_no_allocations("ticker notification", allocations);
+
+    allocations = 0;
+    for (size_t i = 0; i < 2 * OrderManager::MAX_FINISHED; ++i) allocations += trade(i & 1);
+    expect_no_allocations("order submit, ack and close", allocations);
+
+    allocations = 0;
+    for (size_t i = 0; i < 1000; ++i) allocations += await();
+    expect_no_allocations("awaited request", allocations);
+
+    cout.clear();
+    uint64_t parse_before = heap_allocations();
+    connection_metadata::decode_frame(book, frame);
+    printf("alloc_test: json::parse of a book frame made %llu heap allocations (not covered)\n",
+           static_cast<unsigned long long>(heap_allocations() - parse_before));
+    if (failures == 0) printf("alloc_test: steady state made no heap allocations\n");
+    return failures == 0 ? 0 : 1;
+}